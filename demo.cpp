@@ -11,6 +11,36 @@
 #include <vector>
 #include <string>
 #include <random>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <map>
+#include <array>
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <cfloat>
+#include <chrono>
+#include <functional>
+
+// CPU遮挡缓冲的AVX2路径: 按函数开target, 运行时检测, 不支持时走标量
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define OCCLUSION_HAS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define OCCLUSION_AVX2_TARGET
+#else
+#define OCCLUSION_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
 
 // --- 全局配置 ---
 const unsigned int SCREEN_WIDTH = 1600;
@@ -20,20 +50,47 @@ const unsigned int MAX_ELEMENTS = 1000000; // 最大支持一百万个元素
 // --- 渲染模式 ---
 enum RenderMode {
     MICRO_BATCH_INDIRECT = 0,
-    INSTANCED_INDIRECT = 1
+    INSTANCED_INDIRECT = 1,
+    DIRECT_DRAWS = 2,   // 基线: CPU剔除, 每个可见实例一次glDrawElementsInstancedBaseInstance
+    CPU_MDI = 3,        // 基线: CPU剔除, CPU往持久映射的缓冲里写指令再MDI
+    VS_CULL = 4,        // 没有计算pass: 一次实例化绘制画全部, 不可见的在VS里退化掉
+    TF_CULL = 5,        // GL 3.3退路: 顶点pass剔除, 变换反馈写可见id
+    RENDER_MODE_COUNT
 };
+const char* render_mode_cli_names[RENDER_MODE_COUNT] = { "micro", "instanced", "direct", "cpu_mdi", "vs_cull", "tf" };
 
-// --- GLSL着色器源码 ---
+// --- 绘制时取实例数据的方式 (实例化间接模式) ---
+enum FetchBackend {
+    FETCH_SSBO = 0,      // instances[visible_ids[gl_InstanceID]] (原始做法)
+    FETCH_TBO = 1,       // 可见id和实例数据都走samplerBuffer
+    FETCH_UBO = 2,       // 先收集成压缩副本, 按UBO大小分块, 每块一次绘制
+    FETCH_ATTRIBUTE = 3, // 先收集成压缩副本, 当作divisor为1的实例属性
+    FETCH_COUNT
+};
+const char* fetch_backend_names[FETCH_COUNT] = { "SSBO", "TBO (samplerBuffer)", "UBO chunks", "Vertex Attributes (divisor 1)" };
+const char* fetch_backend_cli_names[FETCH_COUNT] = { "ssbo", "tbo", "ubo", "attrib" };
 
-// 用于生成 "微批次" 指令的计算着色器 (模拟你的现状)
-const char* cull_microbatch_cs_source = R"(
-#version 450 core
-layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+// --- 剔除测试 ---
+enum CullTest {
+    CULL_TEST_POINT_2D = 0,    // 只测中心点xy (原始做法)
+    CULL_TEST_SPHERE_3D = 1    // 包围球对6个视锥平面
+};
 
+// --- GLSL着色器源码 ---
+
+// 所有着色器共用的声明, 由build_shader_source插在#version/#extension之后
+const char* shader_common_source = R"(
 struct InstanceData {
-    vec2 position;
+    vec4 position_radius; // xyz: 世界坐标, w: 包围球半径
     vec2 size;
-    vec4 color;
+    uint color;           // RGBA8, 用unpackUnorm4x8解包 (保持32字节)
+    uint cluster_id;      // 所属簇, 同一簇的实例在缓冲里连续
+};
+
+// 一个簇在instance_ssbo里的连续区间
+struct ClusterRange {
+    uint first;
+    uint count;
 };
 
 struct DrawElementsIndirectCommand {
@@ -44,6 +101,143 @@ struct DrawElementsIndirectCommand {
     uint baseInstance;
 };
 
+struct DispatchIndirectCommand {
+    uint num_groups_x;
+    uint num_groups_y;
+    uint num_groups_z;
+};
+
+// GPU驱动的多阶段管线: 每个阶段把下一阶段的dispatch参数写在这里, CPU只管glDispatchComputeIndirect
+#define CHAIN_STATE_BINDING 7
+#define CHAIN_STATE_DECL \
+layout(std430, binding = CHAIN_STATE_BINDING) buffer ChainState { \
+    DispatchIndirectCommand instance_dispatch; /* 簇阶段写: 每个近处簇一个工作组 */ \
+    DispatchIndirectCommand finalize_dispatch; /* 实例阶段写 */ \
+    uint chain_visible_count; \
+    uint lanes_busy;     /* 实际测试的实例数 */ \
+    uint lanes_issued;   /* 发出的批次 * 256, 两者之比就是lane利用率 */ \
+    uint queue_head;     /* 常驻线程的工作队列: 下一个要取的条目 */ \
+    uint queue_pushed;   /* 推回队列的条目数 */ \
+    uint queue_finished; /* 做完的条目数 */ \
+    uint near_clusters[]; \
+};
+
+// GPU槽位分配器: 空闲栈 + 存活位图, 刷出/销毁都在计算着色器里做
+#define SLOT_ALLOCATOR_BINDING 8
+#define ALIVE_MASK_BINDING 9
+#define SLOT_ALLOCATOR_DECL \
+layout(std430, binding = SLOT_ALLOCATOR_BINDING) buffer SlotAllocator { \
+    int free_top;        /* 空闲栈栈顶, 出栈时可能暂时为负, 由fixup钳回0 */ \
+    uint high_water;     /* 用过的最高槽位+1 */ \
+    uint alive_count; \
+    uint failed_spawns; \
+    DispatchIndirectCommand cull_dispatch; /* ceil(high_water / 256) */ \
+    uint allocator_pad; \
+    uint free_slots[]; \
+};
+
+// 融合收集: 剔除时直接把可见实例的数据连续写出来, 绘制按gl_InstanceID顺序读, 不再经过visible_ids
+#define COMPACT_INSTANCE_BINDING 14
+#define COMPACT_INSTANCE_DECL \
+layout(std430, binding = COMPACT_INSTANCE_BINDING) writeonly buffer CompactInstanceBuffer { \
+    InstanceData compact_instances[]; \
+};
+
+// LBVH (Karras): n个叶子按Morton码排好序; 内部节点 [0, n-1), 叶子 [n-1, 2n-1), 根是0
+struct BvhNode {
+    vec3 bounds_min;
+    uint left;       // 叶子: 实例id
+    vec3 bounds_max;
+    uint right;      // 叶子: BVH_LEAF
+};
+#define BVH_LEAF 0xFFFFFFFFu
+#define BVH_INSIDE 0x80000000u  // 遍历条目的最高位: 整个子树都在视锥/查询框里, 下面不用再测
+#define BVH_AREA_SCALE 16384.0  // 表面积按定点累加
+#define BVH_STATE_BINDING 15
+#define BVH_STATE_DECL \
+layout(std430, binding = BVH_STATE_BINDING) buffer BvhState { \
+    uint scene_min_bits[3]; /* 中心点的包围盒, 存成可排序的uint, 给Morton码归一化 */ \
+    uint scene_max_bits[3]; \
+    uint surface_area;      /* 内部节点表面积之和, refit时累加, 用来判断该不该重建; 64位定点, 这是低32位 */ \
+    uint surface_area_high; \
+    uint frontier_count;    /* 遍历上半段留给下半段的子树数 */ \
+    DispatchIndirectCommand subtree_dispatch; \
+    uint frontier_base;     /* 子树列表在frontier缓冲里的起点 (上半段乒乓用两半) */ \
+};
+
+// float <-> 保序uint: 正数翻符号位, 负数全部取反, 之后可以直接atomicMin/atomicMax
+uint bvh_order_float(float f) {
+    uint u = floatBitsToUint(f);
+    return (u & 0x80000000u) != 0u ? ~u : u | 0x80000000u;
+}
+
+float bvh_unorder_float(uint u) {
+    return uintBitsToFloat((u & 0x80000000u) != 0u ? u & 0x7FFFFFFFu : ~u);
+}
+
+// 每帧只上传一次的常量
+layout(std140, binding = 0) uniform FrameUniforms {
+    mat4 view_proj;
+    vec4 frustum_planes[6]; // xyz: 指向视锥内侧的单位法线, w: 距离
+    vec4 camera_right;      // billboard展开方向
+    vec4 camera_up;
+};
+
+// 多视图 (分屏/小地图/阴影): 每个视图一份和FrameUniforms相同布局的数据
+#define MAX_VIEWS 8
+struct ViewData {
+    mat4 view_proj;
+    vec4 frustum_planes[6];
+    vec4 camera_right;
+    vec4 camera_up;
+};
+layout(std140, binding = 1) uniform MultiViewUniforms {
+    ViewData views[MAX_VIEWS];
+    uint view_count;
+};
+
+// 簇LOD状态 (cluster_lod_cs写, 剔除读)
+#define LOD_CULLED 0u
+#define LOD_INSTANCES 1u
+#define LOD_IMPOSTOR 2u
+#define LOD_REQUESTED 3u          // 分页: 要逐个画但页不在池里, 先画占位
+#define PAGE_NOT_RESIDENT 0xFFFFFFFFu // 分页: 不在池里的页的ClusterRange.first
+
+bool sphere_in_frustum(vec4 center_radius, vec4 planes[6]) {
+    vec4 center = vec4(center_radius.xyz, 1.0);
+    for (int i = 0; i < 6; ++i) {
+        if (dot(planes[i], center) < -center_radius.w) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool is_visible(InstanceData inst, mat4 vp, vec4 planes[6]) {
+#ifdef CULL_SPHERE_FRUSTUM
+    return sphere_in_frustum(inst.position_radius, planes);
+#else
+    // 简单的视锥剔除: 只看中心点, 不管z和尺寸
+    vec4 clip_pos = vp * vec4(inst.position_radius.xyz, 1.0);
+    return (clip_pos.x >= -clip_pos.w && clip_pos.x <= clip_pos.w &&
+            clip_pos.y >= -clip_pos.w && clip_pos.y <= clip_pos.w);
+#endif
+}
+
+bool is_instance_visible(InstanceData inst) {
+    return is_visible(inst, view_proj, frustum_planes);
+}
+
+bool is_instance_visible_in_view(InstanceData inst, uint v) {
+    return is_visible(inst, views[v].view_proj, views[v].frustum_planes);
+}
+)";
+
+// 用于生成 "微批次" 指令的计算着色器 (模拟你的现状)
+const char* cull_microbatch_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
 layout(std430, binding = 0) readonly buffer InstanceBuffer {
     InstanceData instances[];
 };
@@ -55,7 +249,6 @@ layout(std430, binding = 1) writeonly buffer DrawCommandBuffer {
 layout(binding = 2, offset = 0) uniform atomic_uint visible_count;
 
 uniform uint total_element_count;
-uniform mat4 projection; // 用于简单剔除
 
 void main() {
     uint gid = gl_GlobalInvocationID.x;
@@ -64,13 +257,8 @@ void main() {
     }
 
     InstanceData inst = instances[gid];
-    
-    // 简单的视锥剔除
-    vec4 clip_pos = projection * vec4(inst.position, 0.0, 1.0);
-    bool is_visible = (clip_pos.x >= -clip_pos.w && clip_pos.x <= clip_pos.w &&
-                       clip_pos.y >= -clip_pos.w && clip_pos.y <= clip_pos.w);
 
-    if (is_visible) {
+    if (is_instance_visible(inst)) {
         uint index = atomicCounterIncrement(visible_count);
         // 为每个可见元素生成一个独立的DrawCommand
         commands[index].count = 6; // Quad有6个索引
@@ -88,20 +276,6 @@ const char* cull_instanced_cs_source = R"(
 #version 450 core
 layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
 
-struct InstanceData {
-    vec2 position;
-    vec2 size;
-    vec4 color;
-};
-
-struct DrawElementsIndirectCommand {
-    uint count;
-    uint instanceCount;
-    uint firstIndex;
-    uint baseVertex;
-    uint baseInstance;
-};
-
 layout(std430, binding = 0) readonly buffer InstanceBuffer {
     InstanceData instances[];
 };
@@ -117,8 +291,44 @@ layout(std430, binding = 2) writeonly buffer DrawCommandBuffer {
 
 layout(binding = 3, offset = 0) uniform atomic_uint visible_count;
 
+#ifdef WRITE_COMPACT
+COMPACT_INSTANCE_DECL
+#endif
+
+#ifdef USE_CLUSTER_LOD
+// cluster_lod_cs的结果: 只有LOD_INSTANCES的簇才逐个实例画
+layout(std430, binding = 4) readonly buffer ClusterLodBuffer {
+    uint cluster_lod[];
+};
+#endif
+
+#ifdef USE_ALIVE_MASK
+// 动态实例: 死槽位只看位图就跳过, 不去读32字节的InstanceData
+layout(std430, binding = ALIVE_MASK_BINDING) readonly buffer AliveMaskBuffer {
+    uint alive_mask[];
+};
+#endif
+
+#ifdef USE_VISIBILITY_MASK
+// 每实例1位的可见性: 上一帧的结果只读, 这一帧的结果由本pass写出 (两块交替)
+layout(std430, binding = 10) readonly buffer PrevVisibleMaskBuffer {
+    uint prev_visible_mask[];
+};
+layout(std430, binding = 11) buffer VisibleMaskBuffer {
+    uint visible_mask[];
+};
+// 实际读了多少字节: 记录数 * 32 + 位图字数 * 4
+layout(std430, binding = 12) buffer CullLoadStats {
+    uint records_loaded;
+    uint mask_words_loaded;
+};
+uniform bool temporal_reuse; // 相机和场景都没变: 只需要重测上一帧可见的
+
+shared uint s_records_loaded;
+shared uint s_mask_words_loaded;
+#endif
+
 uniform uint total_element_count;
-uniform mat4 projection;
 
 void main() {
     // 在第一次调用时，由第一个线程来重置指令
@@ -131,276 +341,7133 @@ void main() {
     }
 
     uint gid = gl_GlobalInvocationID.x;
+
+#ifdef USE_VISIBILITY_MASK
+    // 中间有barrier, 不能提前return
+    if (gl_LocalInvocationIndex == 0u) {
+        s_records_loaded = 0u;
+        s_mask_words_loaded = 0u;
+    }
+    barrier();
+
+    // 32个线程共用一个字: 先读标志, 整字为0时这32个线程都不碰InstanceData
+    uint word_index = gid >> 5;
+    uint bit = 1u << (gid & 31u);
+    uint candidates = 0u;
+    if (gid < total_element_count) {
+        candidates = 0xFFFFFFFFu;
+        uint words_read = 0u;
+#ifdef USE_ALIVE_MASK
+        candidates &= alive_mask[word_index];
+        words_read++;
+#endif
+        if (temporal_reuse) {
+            candidates &= prev_visible_mask[word_index];
+            words_read++;
+        }
+        if ((gid & 31u) == 0u) {
+            atomicAdd(s_mask_words_loaded, words_read);
+        }
+    }
+
+    if ((candidates & bit) != 0u) {
+        atomicAdd(s_records_loaded, 1u);
+        InstanceData inst = instances[gid];
+        bool visible = is_instance_visible(inst);
+#ifdef USE_CLUSTER_LOD
+        visible = visible && cluster_lod[inst.cluster_id] == LOD_INSTANCES;
+#endif
+        if (visible) {
+            uint index = atomicCounterIncrement(visible_count);
+#ifdef WRITE_COMPACT
+            compact_instances[index] = inst;
+#else
+            visible_ids[index] = gid;
+#endif
+            atomicOr(visible_mask[word_index], bit);
+        }
+    }
+
+    barrier();
+    if (gl_LocalInvocationIndex == 0u) {
+        atomicAdd(records_loaded, s_records_loaded);
+        atomicAdd(mask_words_loaded, s_mask_words_loaded);
+    }
+#else
     if (gid >= total_element_count) {
         return;
     }
 
+#ifdef USE_ALIVE_MASK
+    if ((alive_mask[gid >> 5] & (1u << (gid & 31u))) == 0u) {
+        return;
+    }
+#endif
+
     InstanceData inst = instances[gid];
-    vec4 clip_pos = projection * vec4(inst.position, 0.0, 1.0);
-    bool is_visible = (clip_pos.x >= -clip_pos.w && clip_pos.x <= clip_pos.w &&
-                       clip_pos.y >= -clip_pos.w && clip_pos.y <= clip_pos.w);
 
-    if (is_visible) {
+#ifdef USE_CLUSTER_LOD
+    if (cluster_lod[inst.cluster_id] != LOD_INSTANCES) {
+        return;
+    }
+#endif
+
+    if (is_instance_visible(inst)) {
         uint index = atomicCounterIncrement(visible_count);
+#ifdef WRITE_COMPACT
+        compact_instances[index] = inst;
+#else
         visible_ids[index] = gid;
+#endif
     }
+#endif
 }
 )";
 
-
-// 顶点着色器
-const char* render_vs_source = R"(
+// 16位可见id: 按65536个元素分段, 每段一条DrawCommand, baseInstance = 段号 * 65536,
+// 同时也是这一段在id缓冲里的起点 (以16位为单位); id只存段内偏移, 两个凑一个uint.
+// 工作组 (256个元素, 不会跨段) 先在共享内存里压缩, 预留数向上取偶,
+// 奇数时多出来的一格重复组内最后一个id: 同一个quad连着画两次, 结果不变
+const char* cull_packed_ids_cs_source = R"(
 #version 450 core
-layout (location = 0) in vec2 a_pos; // 基础Quad的顶点位置 (-0.5 to 0.5)
-
-struct InstanceData {
-    vec2 position;
-    vec2 size;
-    vec4 color;
-};
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
 
 layout(std430, binding = 0) readonly buffer InstanceBuffer {
     InstanceData instances[];
 };
 
-// 仅在实例化模式下使用
-layout(std430, binding = 1) readonly buffer VisibleIDBuffer {
-    uint visible_ids[];
+layout(std430, binding = 1) writeonly buffer PackedIDBuffer {
+    uint packed_ids[]; // 低16位在前
 };
 
-uniform mat4 projection;
-uniform bool is_instanced_mode;
+// 每段一条, instanceCount (含补齐) 当原子计数器
+layout(std430, binding = 2) buffer SegmentCommandBuffer {
+    DrawElementsIndirectCommand segment_commands[];
+};
 
-out vec4 v_color;
+// 真实可见数 (不含补齐), 和其他路径一样写在原子计数器缓冲里
+layout(std430, binding = 3) buffer VisibleCountBuffer {
+    uint visible_total;
+};
+
+#ifdef USE_CLUSTER_LOD
+layout(std430, binding = 4) readonly buffer ClusterLodBuffer {
+    uint cluster_lod[];
+};
+#endif
+
+#ifdef USE_ALIVE_MASK
+layout(std430, binding = ALIVE_MASK_BINDING) readonly buffer AliveMaskBuffer {
+    uint alive_mask[];
+};
+#endif
+
+uniform uint total_element_count;
+
+shared uint s_local[256];
+shared uint s_count;
+shared uint s_base;
 
 void main() {
-    uint instance_id;
-    if (is_instanced_mode) {
-        // 实例化模式: 通过gl_InstanceID间接查找真正的元素ID
-        instance_id = visible_ids[gl_InstanceID];
-    } else {
-        // 微批次模式: 直接从baseInstance获取元素ID
-        instance_id = gl_BaseInstance;
+    uint gid = gl_GlobalInvocationID.x;
+    uint lid = gl_LocalInvocationID.x;
+    uint segment = gl_WorkGroupID.x >> 8;
+    if (lid == 0u) {
+        s_count = 0u;
     }
-    
-    InstanceData inst = instances[instance_id];
-    
-    v_color = inst.color;
-    
-    vec2 final_pos = a_pos * inst.size + inst.position;
-    gl_Position = projection * vec4(final_pos, 0.0, 1.0);
-}
-)";
+    barrier();
 
-// 片元着色器
-const char* render_fs_source = R"(
-#version 450 core
-in vec4 v_color;
-out vec4 FragColor;
+    // 中间有barrier, 不能提前return
+    bool visible = gid < total_element_count;
+#ifdef USE_ALIVE_MASK
+    visible = visible && (alive_mask[gid >> 5] & (1u << (gid & 31u))) != 0u;
+#endif
+    if (visible) {
+        InstanceData inst = instances[gid];
+        visible = is_instance_visible(inst);
+#ifdef USE_CLUSTER_LOD
+        visible = visible && cluster_lod[inst.cluster_id] == LOD_INSTANCES;
+#endif
+    }
+    if (visible) {
+        s_local[atomicAdd(s_count, 1u)] = gid & 0xFFFFu;
+    }
+    barrier();
 
-void main() {
-    FragColor = v_color;
+    uint count = s_count;
+    if (lid == 0u && count > 0u) {
+        s_base = atomicAdd(segment_commands[segment].instanceCount, (count + 1u) & ~1u);
+        atomicAdd(visible_total, count);
+    }
+    barrier();
+
+    if (2u * lid < count) {
+        uint lo = s_local[2u * lid];
+        uint hi = 2u * lid + 1u < count ? s_local[2u * lid + 1u] : lo;
+        packed_ids[(segment * 65536u + s_base) / 2u + lid] = lo | (hi << 16);
+    }
 }
 )";
 
+// 多视图剔除: 每个实例只从instance_ssbo读一次, 然后依次对各视图的视锥测试.
+// 每个视图一条DrawCommand, instanceCount直接当原子计数器, baseInstance是该视图id段的起点.
+// first_view/view_loop_count让同一个shader也能跑 "每视图一次dispatch" 的对照组.
+const char* cull_multiview_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
 
-// --- 主函数 ---
-int main() {
-    // ... (GLFW, GLAD, ImGui 初始化代码)
-    // --- Boilerplate: Window, OpenGL, ImGui initialization ---
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    GLFWwindow* window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Draw Call Performance Demo", NULL, NULL);
-    if (window == NULL) { /*...*/ return -1; }
-    glfwMakeContextCurrent(window);
-    glfwSwapInterval(0); // VSync Off for performance measurement
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
 
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) { return -1; }
+layout(std430, binding = 1) writeonly buffer VisibleIDBuffer {
+    uint visible_ids[];
+};
 
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGuiIO& io = ImGui::GetIO(); (void)io;
-    ImGui::StyleColorsDark();
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init("#version 450");
-    
-    // --- 数据准备 ---
-    std::vector<glm::vec4> instance_positions_sizes;
-    std::vector<glm::vec4> instance_colors;
-    
-    std::mt19937 rng(std::random_device{}());
-    std::uniform_real_distribution<float> pos_dist(-1.0f, 1.0f);
-    std::uniform_real_distribution<float> size_dist(0.002f, 0.008f);
-    std::uniform_real_distribution<float> color_dist(0.1f, 1.0f);
+layout(std430, binding = 2) buffer DrawCommandBuffer {
+    DrawElementsIndirectCommand commands[]; // 每个视图一条, CPU每帧清零instanceCount
+};
 
-    struct InstanceData {
-        glm::vec2 position;
-        glm::vec2 size;
-        glm::vec4 color;
-    };
-    std::vector<InstanceData> instance_cpu_data;
-    instance_cpu_data.resize(MAX_ELEMENTS);
-    for (int i = 0; i < MAX_ELEMENTS; ++i) {
-        instance_cpu_data[i] = {
-            {pos_dist(rng), pos_dist(rng)},
-            {size_dist(rng), size_dist(rng)},
-            {color_dist(rng), color_dist(rng), color_dist(rng), 1.0f}
-        };
+uniform uint total_element_count;
+uniform uint first_view;
+uniform uint view_loop_count;
+
+void main() {
+    uint gid = gl_GlobalInvocationID.x;
+    if (gid >= total_element_count) {
+        return;
     }
 
-    // --- OpenGL Buffer 设置 ---
-    // 基础Quad VBO/EBO
-    float quad_vertices[] = { -0.5f, -0.5f, 0.5f, -0.5f, 0.5f, 0.5f, -0.5f, 0.5f };
-    unsigned int quad_indices[] = { 0, 1, 2, 2, 3, 0 };
-    GLuint quadVAO, quadVBO, quadEBO;
-    glGenVertexArrays(1, &quadVAO);
-    glGenBuffers(1, &quadVBO);
-    glGenBuffers(1, &quadEBO);
-    glBindVertexArray(quadVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), quad_vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quad_indices), quad_indices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glBindVertexArray(0);
+    InstanceData inst = instances[gid];
 
-    // SSBOs
-    GLuint instance_ssbo, visible_id_ssbo, command_buffer, counter_buffer;
-    glGenBuffers(1, &instance_ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, instance_ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_ELEMENTS * sizeof(InstanceData), instance_cpu_data.data(), GL_DYNAMIC_DRAW);
-
-    glGenBuffers(1, &visible_id_ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, visible_id_ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_ELEMENTS * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
-    
-    glGenBuffers(1, &command_buffer);
-    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
-    glBufferData(GL_DRAW_INDIRECT_BUFFER, MAX_ELEMENTS * sizeof(GLuint) * 5, nullptr, GL_DYNAMIC_DRAW);
+    for (uint v = first_view; v < first_view + view_loop_count; ++v) {
+        if (is_instance_visible_in_view(inst, v)) {
+            uint index = atomicAdd(commands[v].instanceCount, 1u);
+            visible_ids[commands[v].baseInstance + index] = gid;
+        }
+    }
+}
+)";
 
-    glGenBuffers(1, &counter_buffer);
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counter_buffer);
-    glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+// --- 簇LOD ---
+// 缩得很小时成千上万个实例落在同一片像素里, 逐个画纯属浪费.
+// 远处的簇整体换成一个预先聚合好的impostor quad, 近处的簇照常逐个画.
 
-    // --- Shader编译 ---
-    auto create_shader_program = [](const char* vs, const char* fs) {
-        // ... (standard shader compilation code)
-        GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER); glShaderSource(vertexShader, 1, &vs, NULL); glCompileShader(vertexShader);
-        GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER); glShaderSource(fragmentShader, 1, &fs, NULL); glCompileShader(fragmentShader);
-        GLuint shaderProgram = glCreateProgram(); glAttachShader(shaderProgram, vertexShader); glAttachShader(shaderProgram, fragmentShader); glLinkProgram(shaderProgram);
-        glDeleteShader(vertexShader); glDeleteShader(fragmentShader); return shaderProgram;
-    };
-    auto create_compute_program = [](const char* cs) {
-        // ... (standard compute shader compilation code)
-        GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER); glShaderSource(computeShader, 1, &cs, NULL); glCompileShader(computeShader);
-        GLuint shaderProgram = glCreateProgram(); glAttachShader(shaderProgram, computeShader); glLinkProgram(shaderProgram);
-        glDeleteShader(computeShader); return shaderProgram;
-    };
-    
-    GLuint cull_microbatch_program = create_compute_program(cull_microbatch_cs_source);
-    GLuint cull_instanced_program = create_compute_program(cull_instanced_cs_source);
-    GLuint render_program = create_shader_program(render_vs_source, render_fs_source);
+// 归约: 每个工作组负责一个簇, 求包围盒和按面积加权的平均颜色, 生成impostor
+const char* cluster_reduce_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
 
-    // --- 主循环 ---
-    RenderMode current_mode = MICRO_BATCH_INDIRECT;
-    int element_count = 100000;
-    float frame_time = 0.0f;
-    unsigned int gpu_draw_calls = 0;
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
 
-    while (!glfwWindowShouldClose(window)) {
-        double current_time = glfwGetTime();
+layout(std430, binding = 1) readonly buffer ClusterRangeBuffer {
+    ClusterRange cluster_ranges[];
+};
 
-        glfwPollEvents();
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
+layout(std430, binding = 2) writeonly buffer ClusterBoundsBuffer {
+    vec4 cluster_bounds[]; // xyz: 中心, w: 包围球半径
+};
 
-        // --- UI ---
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
-        ImGui::Begin("Performance Demo");
-        ImGui::Text("Render Mode:");
-        ImGui::RadioButton("Micro-Batch Indirect (现状)", (int*)&current_mode, MICRO_BATCH_INDIRECT);
-        ImGui::RadioButton("Instanced Indirect (优化)", (int*)&current_mode, INSTANCED_INDIRECT);
-        ImGui::SliderInt("Element Count", &element_count, 1000, MAX_ELEMENTS);
-        ImGui::Separator();
-        ImGui::Text("--- Stats ---");
-        ImGui::Text("FPS: %.1f", 1.0f / frame_time);
-        ImGui::Text("Frame Time: %.3f ms", frame_time * 1000.0f);
-        ImGui::Text("GPU Draw Commands: %u", gpu_draw_calls);
-        ImGui::End();
+layout(std430, binding = 3) writeonly buffer ImpostorBuffer {
+    InstanceData impostors[];
+};
 
-        // --- 剔除与指令生成 ---
-        GLuint zero = 0;
-        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counter_buffer);
-        glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &zero);
+shared vec3 s_min[256];
+shared vec3 s_max[256];
+shared vec4 s_color_area[256]; // rgb: 面积加权颜色和, a: 面积和
 
-        glm::mat4 projection = glm::ortho(-1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f);
+void main() {
+    uint cluster = gl_WorkGroupID.x;
+    uint lid = gl_LocalInvocationID.x;
+    ClusterRange range = cluster_ranges[cluster];
 
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
-        glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, (current_mode == MICRO_BATCH_INDIRECT ? 2 : 3), counter_buffer);
-        
-        unsigned int num_groups = (element_count + 255) / 256;
-
-        if (current_mode == MICRO_BATCH_INDIRECT) {
-            glUseProgram(cull_microbatch_program);
-            glUniform1i(glGetUniformLocation(cull_microbatch_program, "total_element_count"), element_count);
-            glUniformMatrix4fv(glGetUniformLocation(cull_microbatch_program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, command_buffer);
-            glDispatchCompute(num_groups, 1, 1);
-        } else { // INSTANCED_INDIRECT
-            glUseProgram(cull_instanced_program);
-            glUniform1i(glGetUniformLocation(cull_instanced_program, "total_element_count"), element_count);
-            glUniformMatrix4fv(glGetUniformLocation(cull_instanced_program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visible_id_ssbo);
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, command_buffer);
-            glDispatchCompute(num_groups, 1, 1);
-        }
-        
-        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT);
-        
-        // --- 渲染 ---
-        glUseProgram(render_program);
-        glUniformMatrix4fv(glGetUniformLocation(render_program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glBindVertexArray(quadVAO);
-
-        if (current_mode == MICRO_BATCH_INDIRECT) {
-            glUniform1i(glGetUniformLocation(render_program, "is_instanced_mode"), 0);
-            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
-            // 读取可见数量
-            glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counter_buffer);
-            GLuint* count_ptr = (GLuint*)glMapBufferRange(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT);
-            gpu_draw_calls = count_ptr[0];
-            glUnmapBuffer(GL_ATOMIC_COUNTER_BUFFER);
+    vec3 bmin = vec3(1e30), bmax = vec3(-1e30);
+    vec4 color_area = vec4(0.0);
+    for (uint i = lid; i < range.count; i += 256u) {
+        InstanceData inst = instances[range.first + i];
+        vec3 r = vec3(inst.position_radius.w);
+        bmin = min(bmin, inst.position_radius.xyz - r);
+        bmax = max(bmax, inst.position_radius.xyz + r);
+        float area = inst.size.x * inst.size.y;
+        color_area += vec4(unpackUnorm4x8(inst.color).rgb * area, area);
+    }
+    s_min[lid] = bmin;
+    s_max[lid] = bmax;
+    s_color_area[lid] = color_area;
+    barrier();
 
-            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, gpu_draw_calls, 0);
-        } else { // INSTANCED_INDIRECT
-            glUniform1i(glGetUniformLocation(render_program, "is__instanced_mode"), 1);
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visible_id_ssbo);
+    for (uint stride = 128u; stride > 0u; stride >>= 1) {
+        if (lid < stride) {
+            s_min[lid] = min(s_min[lid], s_min[lid + stride]);
+            s_max[lid] = max(s_max[lid], s_max[lid + stride]);
+            s_color_area[lid] += s_color_area[lid + stride];
+        }
+        barrier();
+    }
 
-            // 关键：将原子计数器的值，写入到我们生成的唯一一个DrawCommand的instanceCount字段中
-            // 这通常在CS的结尾做，或者用一个小的专用CS，这里为了简单直接用glCopyBufferSubData
-            glBindBuffer(GL_COPY_READ_BUFFER, counter_buffer);
-            glBindBuffer(GL_COPY_WRITE_BUFFER, command_buffer);
-            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, sizeof(GLuint), sizeof(GLuint)); // a bit of a hack for demo
+    if (lid == 0u) {
+        vec3 center = 0.5 * (s_min[0] + s_max[0]);
+        vec3 extent = s_max[0] - s_min[0];
+        float radius = 0.5 * length(extent);
+        cluster_bounds[cluster] = vec4(center, radius);
 
-            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
-            glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0);
-            gpu_draw_calls = 1; // 只有一个间接绘制调用
-        }
+        // 覆盖率当alpha: 稀疏的簇画成半透明, 远看和逐个画的平均亮度接近
+        vec4 sum = s_color_area[0];
+        vec3 avg_color = sum.a > 0.0 ? sum.rgb / sum.a : vec3(0.0);
+        float coverage = clamp(sum.a / max(extent.x * extent.y, 1e-12), 0.0, 1.0);
 
-        // --- 渲染UI和交换缓冲 ---
-        ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        glfwSwapBuffers(window);
+        InstanceData imp;
+        imp.position_radius = vec4(center, radius);
+        imp.size = extent.xy;
+        imp.color = packUnorm4x8(vec4(avg_color, coverage));
+        imp.cluster_id = cluster;
+        impostors[cluster] = imp;
+    }
+}
+)";
 
-        frame_time = glfwGetTime() - current_time;
+// 每帧按簇选LOD: 视锥外的直接丢; 投影直径小于误差上限(像素)的换成impostor
+const char* cluster_lod_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 2) readonly buffer ClusterBoundsBuffer {
+    vec4 cluster_bounds[];
+};
+
+layout(std430, binding = 4) writeonly buffer ClusterLodBuffer {
+    uint cluster_lod[];
+};
+
+layout(std430, binding = 5) writeonly buffer ImpostorIDBuffer {
+    uint impostor_ids[];
+};
+
+layout(std430, binding = 6) buffer ImpostorCommandBuffer {
+    DrawElementsIndirectCommand impostor_command; // instanceCount由CPU每帧清零, 这里原子累加
+    uint merged_instance_count;                   // 被impostor代替掉的实例数, 只做统计
+};
+
+layout(std430, binding = 1) readonly buffer ClusterRangeBuffer {
+    ClusterRange cluster_ranges[];
+};
+
+#ifdef CHAIN_OUTPUT
+CHAIN_STATE_DECL
+#endif
+
+uniform uint cluster_count;
+uniform float projection_scale; // proj[1][1] * 视口高度 / 2, 世界尺寸 / w -> 像素
+uniform float lod_error_px;
+
+void main() {
+    uint cluster = gl_GlobalInvocationID.x;
+#ifdef CHAIN_OUTPUT
+    // 收尾阶段与数量无关, 但同样由上游写参数, 没有近处簇时也要跑
+    if (cluster == 0u) {
+        finalize_dispatch = DispatchIndirectCommand(1u, 1u, 1u);
+    }
+#endif
+    if (cluster >= cluster_count) {
+        return;
+    }
+
+    vec4 bounds = cluster_bounds[cluster];
+    if (!sphere_in_frustum(bounds, frustum_planes)) {
+        cluster_lod[cluster] = LOD_CULLED;
+        return;
+    }
+
+    // 簇内任何实例的位置误差都不会超过簇的投影直径
+    float w = (view_proj * vec4(bounds.xyz, 1.0)).w;
+    float diameter_px = w > 1e-4 ? 2.0 * bounds.w * projection_scale / w : 1e30;
+    if (diameter_px < lod_error_px) {
+        cluster_lod[cluster] = LOD_IMPOSTOR;
+        uint index = atomicAdd(impostor_command.instanceCount, 1u);
+        impostor_ids[index] = cluster;
+        atomicAdd(merged_instance_count, cluster_ranges[cluster].count);
+    } else {
+#ifdef PAGED
+        // 页还没读进来: 占位impostor顶上, CPU回读到LOD_REQUESTED后去读盘
+        if (cluster_ranges[cluster].first == PAGE_NOT_RESIDENT) {
+            cluster_lod[cluster] = LOD_REQUESTED;
+            uint index = atomicAdd(impostor_command.instanceCount, 1u);
+            impostor_ids[index] = cluster;
+            return;
+        }
+#endif
+        cluster_lod[cluster] = LOD_INSTANCES;
+#ifdef CHAIN_OUTPUT
+        // 近处簇直接排进下一阶段: 工作组数就是近处簇的个数
+        uint slot = atomicAdd(instance_dispatch.num_groups_x, 1u);
+        near_clusters[slot] = cluster;
+#endif
+    }
+}
+)";
+
+// 链式管线第二阶段: 间接dispatch, 每个工作组剔除一个近处簇.
+// 先在共享内存里压缩, 每批只做一次全局原子加, 同一个簇的幸存者在visible_ids里是连续的
+const char* cull_cluster_instances_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 1) readonly buffer ClusterRangeBuffer {
+    ClusterRange cluster_ranges[];
+};
+
+layout(std430, binding = 3) writeonly buffer VisibleIDBuffer {
+    uint visible_ids[];
+};
+
+#ifdef WRITE_COMPACT
+COMPACT_INSTANCE_DECL
+#endif
+
+CHAIN_STATE_DECL
+
+shared uint s_count;
+shared uint s_base;
+
+void main() {
+    uint cluster = near_clusters[gl_WorkGroupID.x];
+    uint lid = gl_LocalInvocationID.x;
+    ClusterRange range = cluster_ranges[cluster];
+
+    for (uint batch = 0u; batch < range.count; batch += 256u) {
+        if (lid == 0u) {
+            s_count = 0u;
+        }
+        barrier();
+
+        uint i = batch + lid;
+        bool visible = i < range.count && is_instance_visible(instances[range.first + i]);
+        uint local_index = visible ? atomicAdd(s_count, 1u) : 0u;
+        barrier();
+
+        if (lid == 0u) {
+            s_base = atomicAdd(chain_visible_count, s_count);
+            atomicAdd(lanes_busy, min(range.count - batch, 256u));
+            atomicAdd(lanes_issued, 256u);
+        }
+        barrier();
+
+        if (visible) {
+#ifdef WRITE_COMPACT
+            compact_instances[s_base + local_index] = instances[range.first + i];
+#else
+            visible_ids[s_base + local_index] = range.first + i;
+#endif
+        }
+    }
+}
+)";
+
+// 常驻线程版本: 固定数量的工作组反复从全局队列取活, 直到队列空且没人还在推活.
+// 队列前near_count个条目就是簇阶段写好的近处簇, 之后的是推回的条目 (work_items).
+// 每一批由lane 0从队列里连续取若干个簇拼满256个实例; 装不下的那个簇只取一部分,
+// 剩下的推回队列由别的工作组接着做. 小簇不再各占一整个工作组.
+const char* cull_persistent_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 1) readonly buffer ClusterRangeBuffer {
+    ClusterRange cluster_ranges[];
+};
+
+layout(std430, binding = 3) writeonly buffer VisibleIDBuffer {
+    uint visible_ids[];
+};
+
+#ifdef WRITE_COMPACT
+COMPACT_INSTANCE_DECL
+#endif
+
+CHAIN_STATE_DECL
+
+// 推回的条目, count为0表示还没写好 (CPU每帧清零)
+struct WorkItem {
+    uint first;
+    uint count;
+};
+layout(std430, binding = 13) coherent buffer WorkQueueBuffer {
+    WorkItem work_items[];
+};
+
+#define MAX_SEGMENTS 128u
+#define NO_RESERVATION 0xFFFFFFFFu
+
+shared uint s_segment_first[MAX_SEGMENTS];
+shared uint s_segment_offset[MAX_SEGMENTS]; // 段在这一批里的起始lane
+shared uint s_segment_count;
+shared uint s_filled;
+shared uint s_items;
+shared bool s_done;
+shared uint s_count;
+shared uint s_base;
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+    uint near_count = instance_dispatch.num_groups_x;
+    uint reserved = NO_RESERVATION; // 只有lane 0用: 已经占了位置但条目还没写好, 下一轮接着等
+
+    for (;;) {
+        if (lid == 0u) {
+            uint filled = 0u;
+            uint segments = 0u;
+            uint items = 0u;
+            bool done = false;
+            while (filled < 256u && segments < MAX_SEGMENTS) {
+                if (reserved == NO_RESERVATION) {
+                    reserved = atomicAdd(queue_head, 1u);
+                }
+                uint first;
+                uint count;
+                if (reserved < near_count) {
+                    ClusterRange range = cluster_ranges[near_clusters[reserved]];
+                    first = range.first;
+                    count = range.count;
+                } else {
+                    uint slot = reserved - near_count;
+                    count = atomicAdd(work_items[slot].count, 0u);
+                    if (count == 0u) {
+                        // 手里有活就先做, 否则等条目写好或确认全部完成.
+                        // 先读finished再读pushed: 推活总发生在推活者完成之前, 相等就说明不会再有新条目
+                        if (filled > 0u) {
+                            break;
+                        }
+                        uint finished = atomicAdd(queue_finished, 0u);
+                        uint pushed = atomicAdd(queue_pushed, 0u);
+                        if (finished == near_count + pushed) {
+                            done = true;
+                            break;
+                        }
+                        continue;
+                    }
+                    first = work_items[slot].first;
+                }
+                reserved = NO_RESERVATION;
+                items++;
+
+                uint room = 256u - filled;
+                if (count > room) {
+                    uint slot = atomicAdd(queue_pushed, 1u);
+                    work_items[slot].first = first + room;
+                    memoryBarrierBuffer();
+                    atomicExchange(work_items[slot].count, count - room);
+                    count = room;
+                }
+                if (count > 0u) {
+                    s_segment_first[segments] = first;
+                    s_segment_offset[segments] = filled;
+                    segments++;
+                    filled += count;
+                }
+            }
+            s_segment_count = segments;
+            s_filled = filled;
+            s_items = items;
+            s_done = done;
+            s_count = 0u;
+        }
+        barrier();
+        if (s_done) {
+            break;
+        }
+
+        // 二分找到本lane所在的段
+        bool visible = false;
+        uint id = 0u;
+        if (lid < s_filled) {
+            uint lo = 0u;
+            uint hi = s_segment_count - 1u;
+            while (lo < hi) {
+                uint mid = (lo + hi + 1u) >> 1;
+                if (s_segment_offset[mid] <= lid) lo = mid; else hi = mid - 1u;
+            }
+            id = s_segment_first[lo] + (lid - s_segment_offset[lo]);
+            visible = is_instance_visible(instances[id]);
+        }
+        uint local_index = visible ? atomicAdd(s_count, 1u) : 0u;
+        barrier();
+
+        if (lid == 0u) {
+            s_base = atomicAdd(chain_visible_count, s_count);
+            atomicAdd(lanes_busy, s_filled);
+            atomicAdd(lanes_issued, 256u);
+        }
+        barrier();
+
+        if (visible) {
+#ifdef WRITE_COMPACT
+            compact_instances[s_base + local_index] = instances[id];
+#else
+            visible_ids[s_base + local_index] = id;
+#endif
+        }
+        if (lid == 0u) {
+            atomicAdd(queue_finished, s_items);
+        }
+        barrier();
+    }
+}
+)";
+
+// 链式管线最后一阶段: 把可见数写进DrawCommand (取代glCopyBufferSubData那个hack)
+const char* chain_finalize_cs_source = R"(
+#version 450 core
+layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 2) writeonly buffer DrawCommandBuffer {
+    DrawElementsIndirectCommand command;
+};
+
+CHAIN_STATE_DECL
+
+void main() {
+    command = DrawElementsIndirectCommand(6u, chain_visible_count, 0u, 0u, 0u);
+}
+)";
+
+// --- GPU槽位分配器 ---
+// 每帧顺序: kill (入栈) -> spawn (出栈) -> fixup. 入栈和出栈分在不同的pass, 栈不会交错读写.
+
+// 销毁: atomicAnd清存活位, 只有原来确实活着的槽位才入栈, 重复kill或kill空槽位都是no-op
+const char* slot_kill_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer KillRequestBuffer {
+    uint kill_slots[];
+};
+
+layout(std430, binding = ALIVE_MASK_BINDING) buffer AliveMaskBuffer {
+    uint alive_mask[];
+};
+
+SLOT_ALLOCATOR_DECL
+
+uniform uint kill_count;
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= kill_count) {
+        return;
+    }
+    uint slot = kill_slots[i];
+    if (slot >= high_water) {
+        return;
+    }
+    uint bit = 1u << (slot & 31u);
+    uint previous = atomicAnd(alive_mask[slot >> 5], ~bit);
+    if ((previous & bit) != 0u) {
+        int top = atomicAdd(free_top, 1);
+        free_slots[top] = slot;
+        atomicAdd(alive_count, 0xFFFFFFFFu);
+    }
+}
+)";
+
+// 刷出: 先从空闲栈弹, 栈空了再从high_water往后分配
+const char* slot_spawn_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer SpawnRequestBuffer {
+    InstanceData spawn_requests[];
+};
+
+layout(std430, binding = 1) writeonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = ALIVE_MASK_BINDING) buffer AliveMaskBuffer {
+    uint alive_mask[];
+};
+
+SLOT_ALLOCATOR_DECL
+
+uniform uint spawn_count;
+uniform uint slot_capacity;
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= spawn_count) {
+        return;
+    }
+    // 每个线程拿到互不相同的旧栈顶: 非负的对应一个空闲槽位, 负的说明栈已经空了
+    int top = atomicAdd(free_top, -1) - 1;
+    uint slot;
+    if (top >= 0) {
+        slot = free_slots[top];
+    } else {
+        slot = atomicAdd(high_water, 1u);
+        if (slot >= slot_capacity) {
+            atomicAdd(failed_spawns, 1u);
+            return;
+        }
+    }
+    instances[slot] = spawn_requests[i];
+    atomicOr(alive_mask[slot >> 5], 1u << (slot & 31u));
+    atomicAdd(alive_count, 1u);
+}
+)";
+
+// 收尾: 栈顶钳回0, high_water钳到容量, 并写好剔除的dispatch参数.
+// DEFRAG_RESET变体在整理完之后跑: 活着的都挪到了前面, 空闲栈作废
+const char* slot_fixup_cs_source = R"(
+#version 450 core
+layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
+
+SLOT_ALLOCATOR_DECL
+
+uniform uint slot_capacity;
+
+void main() {
+#ifdef DEFRAG_RESET
+    free_top = 0;
+    high_water = alive_count;
+#endif
+    free_top = max(free_top, 0);
+    high_water = min(high_water, slot_capacity);
+    cull_dispatch = DispatchIndirectCommand((high_water + 255u) / 256u, 1u, 1u);
+}
+)";
+
+// 整理碎片: 碎片率超过阈值时偶尔跑一次. 先对每个位图字做前缀和,
+// 再把活着的实例按顺序搬到scratch, 最后搬回来并重写位图, 空闲栈清空.
+const char* defrag_scan_cs_source = R"(
+#version 450 core
+layout(local_size_x = 1024, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = ALIVE_MASK_BINDING) readonly buffer AliveMaskBuffer {
+    uint alive_mask[];
+};
+
+layout(std430, binding = 2) writeonly buffer WordOffsetBuffer {
+    uint word_offsets[]; // 每个位图字之前的存活数 (exclusive)
+};
+
+SLOT_ALLOCATOR_DECL
+
+shared uint s_sums[1024];
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+    uint word_count = (high_water + 31u) / 32u;
+    uint per_thread = (word_count + 1023u) / 1024u;
+    uint begin = lid * per_thread;
+    uint end = min(begin + per_thread, word_count);
+
+    uint sum = 0u;
+    for (uint w = begin; w < end; ++w) {
+        sum += bitCount(alive_mask[w]);
+    }
+    s_sums[lid] = sum;
+    barrier();
+
+    // Hillis-Steele inclusive scan
+    for (uint offset = 1u; offset < 1024u; offset <<= 1) {
+        uint add = lid >= offset ? s_sums[lid - offset] : 0u;
+        barrier();
+        s_sums[lid] += add;
+        barrier();
+    }
+
+    uint running = s_sums[lid] - sum;
+    for (uint w = begin; w < end; ++w) {
+        word_offsets[w] = running;
+        running += bitCount(alive_mask[w]);
+    }
+    if (lid == 1023u) {
+        alive_count = s_sums[1023];
+    }
+}
+)";
+
+const char* defrag_scatter_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 1) writeonly buffer ScratchBuffer {
+    InstanceData scratch[];
+};
+
+layout(std430, binding = 2) readonly buffer WordOffsetBuffer {
+    uint word_offsets[];
+};
+
+layout(std430, binding = ALIVE_MASK_BINDING) readonly buffer AliveMaskBuffer {
+    uint alive_mask[];
+};
+
+SLOT_ALLOCATOR_DECL
+
+void main() {
+    uint slot = gl_GlobalInvocationID.x;
+    if (slot >= high_water) {
+        return;
+    }
+    uint word = alive_mask[slot >> 5];
+    uint bit = slot & 31u;
+    if ((word & (1u << bit)) == 0u) {
+        return;
+    }
+    uint below = bit == 0u ? 0u : bitCount(word & ((1u << bit) - 1u));
+    scratch[word_offsets[slot >> 5] + below] = instances[slot];
+}
+)";
+
+const char* defrag_commit_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) writeonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 1) readonly buffer ScratchBuffer {
+    InstanceData scratch[];
+};
+
+layout(std430, binding = ALIVE_MASK_BINDING) writeonly buffer AliveMaskBuffer {
+    uint alive_mask[];
+};
+
+SLOT_ALLOCATOR_DECL
+
+void main() {
+    uint slot = gl_GlobalInvocationID.x;
+    if (slot >= high_water) {
+        return;
+    }
+    if (slot < alive_count) {
+        instances[slot] = scratch[slot];
+    }
+    // 每个字由它的第一个线程重写: 前alive_count位置1, 其余清0
+    if ((slot & 31u) == 0u) {
+        uint word_begin = slot;
+        uint bits = alive_count <= word_begin ? 0u
+                  : (alive_count - word_begin >= 32u ? 0xFFFFFFFFu : ((1u << (alive_count - word_begin)) - 1u));
+        alive_mask[slot >> 5] = bits;
+    }
+}
+)";
+
+
+// 收集: 按可见id把实例数据拷成连续的压缩副本, 给UBO分块/顶点属性两种取数方式用.
+// 可见数来自DrawCommand的instanceCount (各条剔除路径最后都写到那里)
+const char* gather_instances_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 1) readonly buffer VisibleIDBuffer {
+    uint visible_ids[];
+};
+
+layout(std430, binding = 2) writeonly buffer CompactInstanceBuffer {
+    InstanceData compact_instances[];
+};
+
+layout(std430, binding = 3) readonly buffer DrawCommandBuffer {
+    DrawElementsIndirectCommand draw_command;
+};
+
+#ifdef UBO_CHUNKS
+// 每块一条DrawCommand, 块数由CPU按上界给出, 多余的块instanceCount为0.
+// CHUNK_COMMANDS_ONLY: 融合收集时副本已由剔除写好, 只剩分块指令要写
+layout(std430, binding = 4) writeonly buffer ChunkCommandBuffer {
+    DrawElementsIndirectCommand chunk_commands[];
+};
+
+uniform uint chunk_size;
+uniform uint chunk_count;
+#endif
+
+void main() {
+    uint gid = gl_GlobalInvocationID.x;
+    uint visible = draw_command.instanceCount;
+#ifdef UBO_CHUNKS
+    if (gid < chunk_count) {
+        uint first = gid * chunk_size;
+        uint count = visible > first ? min(visible - first, chunk_size) : 0u;
+        chunk_commands[gid] = DrawElementsIndirectCommand(6u, count, 0u, 0u, 0u);
+    }
+#endif
+#ifndef CHUNK_COMMANDS_ONLY
+    if (gid < visible) {
+        compact_instances[gid] = instances[visible_ids[gid]];
+    }
+#endif
+}
+)";
+
+// --- LBVH ---
+// 均匀的簇网格遇到密度差很大的分布就不合适. 这里每次重建都在GPU上走一遍:
+// 场景包围盒 -> Morton码 -> 基数排序 -> Karras建层级 -> 自底向上refit; 实例在动时每帧只refit.
+
+// 中心点包围盒: 组内归约, 再对保序uint做atomicMin/atomicMax
+const char* bvh_scene_bounds_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+BVH_STATE_DECL
+
+uniform uint leaf_count;
+
+shared vec3 s_min[256];
+shared vec3 s_max[256];
+
+void main() {
+    uint gid = gl_GlobalInvocationID.x;
+    uint lid = gl_LocalInvocationID.x;
+    vec3 p = gid < leaf_count ? instances[gid].position_radius.xyz : vec3(0.0);
+    s_min[lid] = gid < leaf_count ? p : vec3(3.4e38);
+    s_max[lid] = gid < leaf_count ? p : vec3(-3.4e38);
+    for (uint stride = 128u; stride > 0u; stride >>= 1u) {
+        barrier();
+        if (lid < stride) {
+            s_min[lid] = min(s_min[lid], s_min[lid + stride]);
+            s_max[lid] = max(s_max[lid], s_max[lid + stride]);
+        }
+    }
+    if (lid == 0u && gl_WorkGroupID.x * 256u < leaf_count) {
+        for (int a = 0; a < 3; ++a) {
+            atomicMin(scene_min_bits[a], bvh_order_float(s_min[0][a]));
+            atomicMax(scene_max_bits[a], bvh_order_float(s_max[0][a]));
+        }
+    }
+}
+)";
+
+// 每轴10位, 交错成30位Morton码; 值是实例下标
+const char* bvh_morton_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 1) writeonly buffer KeyBuffer {
+    uint keys[];
+};
+
+layout(std430, binding = 2) writeonly buffer ValueBuffer {
+    uint values[];
+};
+
+BVH_STATE_DECL
+
+uniform uint leaf_count;
+
+// 10位 -> 每位之间插两个0
+uint expand_bits(uint v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+void main() {
+    uint gid = gl_GlobalInvocationID.x;
+    if (gid >= leaf_count) {
+        return;
+    }
+    vec3 lo = vec3(bvh_unorder_float(scene_min_bits[0]), bvh_unorder_float(scene_min_bits[1]), bvh_unorder_float(scene_min_bits[2]));
+    vec3 hi = vec3(bvh_unorder_float(scene_max_bits[0]), bvh_unorder_float(scene_max_bits[1]), bvh_unorder_float(scene_max_bits[2]));
+    vec3 q = clamp((instances[gid].position_radius.xyz - lo) / max(hi - lo, vec3(1e-6)) * 1024.0, vec3(0.0), vec3(1023.0));
+    uvec3 b = uvec3(q);
+    keys[gid] = (expand_bits(b.x) << 2) | (expand_bits(b.y) << 1) | expand_bits(b.z);
+    values[gid] = gid;
+}
+)";
+
+// LSD基数排序, 每趟8位. 一个工作组负责RADIX_TILE个键, 三个阶段用宏区分:
+// RADIX_HISTOGRAM: 每组每个数字的个数, 按 [数字][组] 存, 这样整张表的排他前缀和就是每组每个数字的写入起点
+// RADIX_SCAN: 一个工作组, 每个线程管一个数字
+// RADIX_SCATTER: 组内每256个键用9轮1位split做稳定排序 (第9位标出越界的键), 再按数字写到全局位置
+const char* radix_sort_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+#define RADIX_ITEMS 16u
+#define RADIX_TILE (256u * RADIX_ITEMS)
+
+layout(std430, binding = 1) readonly buffer KeyInBuffer {
+    uint keys_in[];
+};
+
+layout(std430, binding = 2) readonly buffer ValueInBuffer {
+    uint values_in[];
+};
+
+layout(std430, binding = 3) buffer HistogramBuffer {
+    uint histogram[];
+};
+
+layout(std430, binding = 4) writeonly buffer KeyOutBuffer {
+    uint keys_out[];
+};
+
+layout(std430, binding = 5) writeonly buffer ValueOutBuffer {
+    uint values_out[];
+};
+
+uniform uint element_count;
+uniform uint shift;
+uniform uint group_count;
+
+shared uint s_scan[256];
+
+// 256项的包含式前缀和 (Hillis-Steele), 整个工作组一起调用
+uint workgroup_inclusive_scan(uint v) {
+    uint lid = gl_LocalInvocationID.x;
+    s_scan[lid] = v;
+    barrier();
+    for (uint offset = 1u; offset < 256u; offset <<= 1u) {
+        uint add = lid >= offset ? s_scan[lid - offset] : 0u;
+        barrier();
+        s_scan[lid] += add;
+        barrier();
+    }
+    return s_scan[lid];
+}
+
+#ifdef RADIX_HISTOGRAM
+shared uint s_counts[256];
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+    s_counts[lid] = 0u;
+    barrier();
+    uint base = gl_WorkGroupID.x * RADIX_TILE;
+    for (uint k = 0u; k < RADIX_ITEMS; ++k) {
+        uint idx = base + k * 256u + lid;
+        if (idx < element_count) {
+            atomicAdd(s_counts[(keys_in[idx] >> shift) & 255u], 1u);
+        }
+    }
+    barrier();
+    histogram[lid * group_count + gl_WorkGroupID.x] = s_counts[lid];
+}
+#endif
+
+#ifdef RADIX_SCAN
+void main() {
+    uint digit = gl_LocalInvocationID.x;
+    uint sum = 0u;
+    for (uint g = 0u; g < group_count; ++g) {
+        uint v = histogram[digit * group_count + g];
+        histogram[digit * group_count + g] = sum;
+        sum += v;
+    }
+    uint base = workgroup_inclusive_scan(sum) - sum;
+    for (uint g = 0u; g < group_count; ++g) {
+        histogram[digit * group_count + g] += base;
+    }
+}
+#endif
+
+#ifdef RADIX_SCATTER
+shared uint s_sort_key[256];
+shared uint s_key[256];
+shared uint s_value[256];
+shared uint s_digit_start[256];
+shared uint s_digit_base[256]; // 本组每个数字的下一个写入位置
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+    s_digit_base[lid] = histogram[lid * group_count + gl_WorkGroupID.x];
+    uint base = gl_WorkGroupID.x * RADIX_TILE;
+    for (uint k = 0u; k < RADIX_ITEMS; ++k) {
+        uint idx = base + k * 256u + lid;
+        bool valid = idx < element_count;
+        uint key = valid ? keys_in[idx] : 0u;
+        uint value = valid ? values_in[idx] : 0u;
+        uint sort_key = valid ? (key >> shift) & 255u : 256u;
+
+        // 每轮按一位稳定地分成0和1两半, 9轮之后按数字有序, 同数字内保持原顺序
+        for (uint bit = 0u; bit < 9u; ++bit) {
+            uint zero = 1u - ((sort_key >> bit) & 1u);
+            uint zeros_inclusive = workgroup_inclusive_scan(zero);
+            uint total_zeros = s_scan[255];
+            uint zeros_before = zeros_inclusive - zero;
+            uint dst = zero != 0u ? zeros_before : total_zeros + lid - zeros_before;
+            barrier();
+            s_sort_key[dst] = sort_key;
+            s_key[dst] = key;
+            s_value[dst] = value;
+            barrier();
+            sort_key = s_sort_key[lid];
+            key = s_key[lid];
+            value = s_value[lid];
+        }
+
+        if (sort_key < 256u && (lid == 0u || s_sort_key[lid - 1u] != sort_key)) {
+            s_digit_start[sort_key] = lid;
+        }
+        barrier();
+        if (sort_key < 256u) {
+            uint dst = s_digit_base[sort_key] + lid - s_digit_start[sort_key];
+            keys_out[dst] = key;
+            values_out[dst] = value;
+        }
+        barrier();
+        // 每段数字的最后一个线程把本轮的个数加到写入位置上
+        if (sort_key < 256u && (lid == 255u || s_sort_key[lid + 1u] != sort_key)) {
+            s_digit_base[sort_key] += lid - s_digit_start[sort_key] + 1u;
+        }
+        barrier();
+    }
+}
+#endif
+)";
+
+// Karras 2012: 每个内部节点独立算出自己覆盖的叶子区间和分割点, 不需要自顶向下.
+// 相同的Morton码用下标补位, 所以路径上的公共前缀长度严格递增: 深度不超过30 + 20 (一百万个叶子)
+const char* bvh_hierarchy_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 1) readonly buffer SortedKeyBuffer {
+    uint keys[];
+};
+
+layout(std430, binding = 2) readonly buffer SortedValueBuffer {
+    uint values[];
+};
+
+layout(std430, binding = 3) writeonly buffer BvhNodeBuffer {
+    BvhNode nodes[];
+};
+
+layout(std430, binding = 4) writeonly buffer BvhParentBuffer {
+    uint parents[];
+};
+
+uniform uint leaf_count;
+
+// 排序后第i和第j个键的公共前缀长度, 越界为-1
+int common_prefix(int i, int j) {
+    if (j < 0 || j >= int(leaf_count)) {
+        return -1;
+    }
+    uint a = keys[i], b = keys[j];
+    if (a == b) {
+        return 32 + 31 - findMSB(uint(i ^ j));
+    }
+    return 31 - findMSB(a ^ b);
+}
+
+void main() {
+    int i = int(gl_GlobalInvocationID.x);
+    int n = int(leaf_count);
+    if (i < n) {
+        nodes[n - 1 + i].left = values[i];
+        nodes[n - 1 + i].right = BVH_LEAF;
+    }
+    if (i == 0) {
+        parents[0] = BVH_LEAF;
+    }
+    if (i >= n - 1) {
+        return;
+    }
+
+    // 区间朝哪边延伸: 和前缀更长的那个邻居在同一边
+    int d = common_prefix(i, i + 1) - common_prefix(i, i - 1) >= 0 ? 1 : -1;
+    int min_prefix = common_prefix(i, i - d);
+    int max_length = 2;
+    while (common_prefix(i, i + max_length * d) > min_prefix) {
+        max_length *= 2;
+    }
+    int length = 0;
+    for (int t = max_length / 2; t >= 1; t /= 2) {
+        if (common_prefix(i, i + (length + t) * d) > min_prefix) {
+            length += t;
+        }
+    }
+    int j = i + length * d;
+
+    // 分割点: 区间内和i的公共前缀比整个区间更长的最远位置
+    int node_prefix = common_prefix(i, j);
+    int split = 0;
+    int divisor = 2;
+    for (int t = (length + 1) / 2; ; t = (length + divisor - 1) / divisor) {
+        if (common_prefix(i, i + (split + t) * d) > node_prefix) {
+            split += t;
+        }
+        if (t <= 1) {
+            break;
+        }
+        divisor *= 2;
+    }
+    int gamma = i + split * d + min(d, 0);
+
+    uint left = uint(min(i, j) == gamma ? n - 1 + gamma : gamma);
+    uint right = uint(max(i, j) == gamma + 1 ? n - 1 + gamma + 1 : gamma + 1);
+    nodes[i].left = left;
+    nodes[i].right = right;
+    parents[left] = uint(i);
+    parents[right] = uint(i);
+}
+)";
+
+// 自底向上refit: 每个叶子一个线程往上走, 每个内部节点第二个到达的线程才合并两个孩子
+const char* bvh_refit_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 3) coherent buffer BvhNodeBuffer {
+    BvhNode nodes[];
+};
+
+layout(std430, binding = 4) readonly buffer BvhParentBuffer {
+    uint parents[];
+};
+
+// 每个内部节点被访问的次数, 每次refit前清零
+layout(std430, binding = 5) buffer RefitVisitBuffer {
+    uint refit_visits[];
+};
+
+BVH_STATE_DECL
+
+uniform uint leaf_count;
+
+void main() {
+    uint k = gl_GlobalInvocationID.x;
+    if (k >= leaf_count) {
+        return;
+    }
+    // 叶子用包围球的AABB, 两种剔除测试都是保守的
+    uint leaf = leaf_count - 1u + k;
+    vec4 sphere = instances[nodes[leaf].left].position_radius;
+    nodes[leaf].bounds_min = sphere.xyz - sphere.w;
+    nodes[leaf].bounds_max = sphere.xyz + sphere.w;
+    memoryBarrierBuffer();
+
+    uint node = parents[leaf];
+    while (node != BVH_LEAF) {
+        if (atomicAdd(refit_visits[node], 1u) == 0u) {
+            return; // 另一个孩子还没好, 交给它来合并
+        }
+        memoryBarrierBuffer();
+        BvhNode a = nodes[nodes[node].left];
+        BvhNode b = nodes[nodes[node].right];
+        vec3 lo = min(a.bounds_min, b.bounds_min);
+        vec3 hi = max(a.bounds_max, b.bounds_max);
+        nodes[node].bounds_min = lo;
+        nodes[node].bounds_max = hi;
+        vec3 e = hi - lo;
+        // 一百万个实例漂乱了以后32位放不下, 低位溢出就往高位进一
+        uint area = uint(2.0 * (e.x * e.y + e.y * e.z + e.z * e.x) * BVH_AREA_SCALE);
+        if (atomicAdd(surface_area, area) > ~area) {
+            atomicAdd(surface_area_high, 1u);
+        }
+        memoryBarrierBuffer();
+        node = parents[node];
+    }
+}
+)";
+
+// 遍历分两段. BVH_TOP: 一个工作组从根开始按层展开, 直到待处理的子树够多, 列表在frontier缓冲的两半之间乒乓;
+// 否则: 每个线程拿一棵子树, 用栈做深度优先遍历. 节点整个在里面时打上BVH_INSIDE, 下面的叶子不再测试.
+// 输出和平铺剔除一样 (visible_ids + 原子计数器), 后面的绘制不用改
+const char* bvh_traverse_cs_source = R"(
+#version 450 core
+#ifdef BVH_TOP
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+#else
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+#endif
+
+#define FRONTIER_CAPACITY 8192u // 每一半的容量
+#define FRONTIER_TARGET 4096u   // 展开到这么多棵子树就交给下半段
+#define BVH_STACK_SIZE 52       // 最大深度50, 见bvh_hierarchy_cs
+#define BVH_SKIP 1u
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 1) writeonly buffer OutputIDBuffer {
+    uint out_ids[];
+};
+
+layout(std430, binding = 4) readonly buffer BvhNodeBuffer {
+    BvhNode nodes[];
+};
+
+layout(std430, binding = 5) coherent buffer FrontierBuffer {
+    uint frontier[];
+};
+
+BVH_STATE_DECL
+
+uniform uint leaf_count;
+
+layout(std430, binding = 2) writeonly buffer DrawCommandBuffer {
+    DrawElementsIndirectCommand command;
+};
+
+layout(binding = 3, offset = 0) uniform atomic_uint visible_count;
+
+#ifdef WRITE_COMPACT
+COMPACT_INSTANCE_DECL
+#endif
+
+#ifdef CULL_SPHERE_FRUSTUM
+#define BVH_PLANE_COUNT 6
+#else
+#define BVH_PLANE_COUNT 4 // 中心点测试只看左右上下四个面
+#endif
+
+// 和叶子上的精确测试用同一组平面; 留一点余量, 让节点的结论不会比叶子更严
+uint classify(vec3 lo, vec3 hi) {
+    uint result = 2u;
+    for (int i = 0; i < BVH_PLANE_COUNT; ++i) {
+        vec4 plane = frustum_planes[i];
+        bvec3 positive = greaterThanEqual(plane.xyz, vec3(0.0));
+        if (dot(plane.xyz, mix(lo, hi, positive)) + plane.w < -1e-5) {
+            return 0u;
+        }
+        if (dot(plane.xyz, mix(hi, lo, positive)) + plane.w < 1e-5) {
+            result = 1u;
+        }
+    }
+    return result;
+}
+
+void emit(uint id, InstanceData inst) {
+    uint index = atomicCounterIncrement(visible_count);
+    out_ids[index] = id;
+#ifdef WRITE_COMPACT
+    compact_instances[index] = inst;
+#endif
+}
+
+// 访问一个条目: 叶子就地测试并输出; 内部节点返回孩子要带的标志 (0或BVH_INSIDE), BVH_SKIP表示整棵子树都不要
+uint visit(uint entry) {
+    uint node = entry & ~BVH_INSIDE;
+    bool inside = (entry & BVH_INSIDE) != 0u;
+    if (node >= leaf_count - 1u) {
+        BvhNode leaf = nodes[node];
+        InstanceData inst = instances[leaf.left];
+        if (inside || is_instance_visible(inst)) {
+            emit(leaf.left, inst);
+        }
+        return BVH_SKIP;
+    }
+    if (inside) {
+        return BVH_INSIDE;
+    }
+    uint c = classify(nodes[node].bounds_min, nodes[node].bounds_max);
+    return c == 0u ? BVH_SKIP : (c == 2u ? BVH_INSIDE : 0u);
+}
+
+#ifdef BVH_TOP
+shared uint s_count[2];
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+    if (lid == 0u) {
+        command = DrawElementsIndirectCommand(6u, 0u, 0u, 0u, 0u);
+    }
+    if (lid == 0u) {
+        frontier[0] = 0u;
+        s_count[0] = 1u;
+    }
+    uint current = 0u;
+    for (;;) {
+        memoryBarrierBuffer();
+        barrier();
+        uint count = s_count[current];
+        if (count == 0u || count >= FRONTIER_TARGET) {
+            break;
+        }
+        barrier();
+        if (lid == 0u) {
+            s_count[current ^ 1u] = 0u;
+        }
+        barrier();
+        for (uint i = lid; i < count; i += 256u) {
+            uint entry = frontier[current * FRONTIER_CAPACITY + i];
+            uint flag = visit(entry);
+            if (flag != BVH_SKIP) {
+                uint node = entry & ~BVH_INSIDE;
+                uint slot = (current ^ 1u) * FRONTIER_CAPACITY + atomicAdd(s_count[current ^ 1u], 2u);
+                frontier[slot] = nodes[node].left | flag;
+                frontier[slot + 1u] = nodes[node].right | flag;
+            }
+        }
+        current ^= 1u;
+    }
+    if (lid == 0u) {
+        uint count = s_count[current];
+        frontier_count = count;
+        frontier_base = current * FRONTIER_CAPACITY;
+        subtree_dispatch = DispatchIndirectCommand((count + 63u) / 64u, 1u, 1u);
+    }
+}
+#else
+void main() {
+    uint gid = gl_GlobalInvocationID.x;
+    if (gid >= frontier_count) {
+        return;
+    }
+    uint stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = frontier[frontier_base + gid];
+    while (top > 0) {
+        uint entry = stack[--top];
+        uint flag = visit(entry);
+        if (flag != BVH_SKIP) {
+            uint node = entry & ~BVH_INSIDE;
+            stack[top++] = nodes[node].right | flag;
+            stack[top++] = nodes[node].left | flag;
+        }
+    }
+}
+#endif
+)";
+
+// 实例漂移: 给BVH的refit一个会动的场景. 方向由id哈希得到, 出了[-1,1]从另一侧绕回来
+const char* drift_instances_cs_source = R"(
+#version 450 core
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+layout(std430, binding = 0) buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+uniform uint element_count;
+uniform float step_length;
+
+void main() {
+    uint gid = gl_GlobalInvocationID.x;
+    if (gid >= element_count) {
+        return;
+    }
+    uvec3 h = uvec3(gid * 2654435761u, gid * 1597334677u + 12345u, gid * 3812015801u + 67890u);
+    h = (h ^ (h >> 15u)) * 2246822519u;
+    vec3 direction = vec3(h >> 8u) / 16777216.0 * 2.0 - 1.0;
+    vec3 p = instances[gid].position_radius.xyz + direction * step_length;
+    instances[gid].position_radius.xyz = mod(p + 1.0, 2.0) - 1.0;
+}
+)";
+
+// --- 分页: 压缩页解码 ---
+// 格式见encode_packed_page. 一个工作组解一块: 每个线程读出自己对前一个实例的坐标差分,
+// 组内前缀和加上块的锚点就是量化坐标; 尺寸和颜色按下标直接读. 结果写进池里这一页的槽
+const char* page_decode_cs_source = R"(
+#version 450 core
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+#define PACKED_BLOCK_SIZE 64u // 与C++一致
+
+layout(std430, binding = 0) writeonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 1) readonly buffer PackedPageBuffer {
+    uint packed_words[];
+};
+
+uniform uint page_base;    // 页头在packed_words里的位置
+uniform uint output_first; // 池里这一页的槽的起点
+uniform uint page_id;
+
+shared ivec3 s_offset[PACKED_BLOCK_SIZE];
+
+// 从base字开始的比特流 (LSB优先) 里读bit位起的count位, count <= 32
+uint read_bits(uint base, uint bit, uint count) {
+    if (count == 0u) {
+        return 0u;
+    }
+    uint word = base + (bit >> 5u);
+    uint shift = bit & 31u;
+    uint value = packed_words[word] >> shift;
+    if (shift + count > 32u) {
+        value |= packed_words[word + 1u] << (32u - shift);
+    }
+    return count == 32u ? value : value & ((1u << count) - 1u);
+}
+
+void main() {
+    uint lid = gl_LocalInvocationID.x;
+    uint index = gl_WorkGroupID.x * PACKED_BLOCK_SIZE + lid;
+    uint count = packed_words[page_base + 12u];
+    uint block = page_base + packed_words[page_base + 14u] + gl_WorkGroupID.x * 4u;
+    uvec3 anchor = uvec3(packed_words[block] & 0xFFFFu, packed_words[block] >> 16u, packed_words[block + 1u] & 0xFFFFu);
+    uvec3 bits = uvec3(packed_words[block + 1u] >> 16u, packed_words[block + 1u] >> 21u, packed_words[block + 1u] >> 26u) & 31u;
+
+    ivec3 delta = ivec3(0);
+    if (index < count) {
+        uint base = page_base + packed_words[page_base + 15u];
+        uint bit = packed_words[block + 2u] + lid * (bits.x + bits.y + bits.z);
+        uvec3 zigzag = uvec3(read_bits(base, bit, bits.x), read_bits(base, bit + bits.x, bits.y),
+                             read_bits(base, bit + bits.x + bits.y, bits.z));
+        delta = ivec3(zigzag >> 1u) ^ -ivec3(zigzag & 1u);
+    }
+    // 组内包含式前缀和
+    s_offset[lid] = delta;
+    for (uint stride = 1u; stride < PACKED_BLOCK_SIZE; stride <<= 1u) {
+        barrier();
+        ivec3 add = lid >= stride ? s_offset[lid - stride] : ivec3(0);
+        barrier();
+        s_offset[lid] += add;
+    }
+    if (index >= count) {
+        return;
+    }
+
+    vec3 origin = uintBitsToFloat(uvec3(packed_words[page_base], packed_words[page_base + 1u], packed_words[page_base + 2u]));
+    vec3 step = uintBitsToFloat(uvec3(packed_words[page_base + 4u], packed_words[page_base + 5u], packed_words[page_base + 6u]));
+    vec4 size_min_step = uintBitsToFloat(uvec4(packed_words[page_base + 8u], packed_words[page_base + 9u],
+                                               packed_words[page_base + 10u], packed_words[page_base + 11u]));
+    vec3 position = origin + vec3(ivec3(anchor) + s_offset[lid]) * step;
+
+    uint size_bits = read_bits(page_base + packed_words[page_base + 16u], index * 16u, 16u);
+    vec2 size = size_min_step.xy + vec2(size_bits & 0xFFu, size_bits >> 8u) * size_min_step.zw;
+
+    uint palette_bits = packed_words[page_base + 13u];
+    uint color_index = read_bits(page_base + packed_words[page_base + 17u], index * palette_bits, palette_bits);
+    uint color = packed_words[page_base + packed_words[page_base + 18u] + color_index];
+
+    instances[output_first + index] = InstanceData(vec4(position, 0.5 * length(size)), size, color, page_id);
+}
+)";
+
+// --- 空间查询 ---
+// 一批矩形/点查询: 当前相机下的NDC矩形, 点就是零面积的矩形. billboard平行于像平面, 投影后还是轴对齐矩形,
+// 所以2D和3D下都是精确的. 没有BVH时每个线程一个实例, 挨个比这一批查询; 有BVH时每个线程一个查询, 用栈遍历
+const char* spatial_query_cs_source = R"(
+#version 450 core
+#ifdef USE_BVH
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+#else
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+#endif
+
+#define MAX_SPATIAL_QUERIES 16u // 与C++一致
+#define MAX_QUERY_HITS 256u     // 每个查询最多带回这么多id, 计数不受限
+#define BVH_STACK_SIZE 52
+
+struct SpatialQuery {
+    vec4 rect;      // NDC: min.xy, max.xy
+    vec4 planes[6]; // 矩形对应的子视锥: 左右下上近远
+};
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 1) readonly buffer QueryBuffer {
+    SpatialQuery queries[];
+};
+
+layout(std430, binding = 2) buffer QueryResultBuffer {
+    uint hit_counts[MAX_SPATIAL_QUERIES];
+    uint hit_ids[]; // [查询 * MAX_QUERY_HITS + i]
+};
+
+#ifdef USE_BVH
+layout(std430, binding = 4) readonly buffer BvhNodeBuffer {
+    BvhNode nodes[];
+};
+#endif
+
+uniform uint element_count;
+uniform uint query_count;
+
+bool instance_hit(InstanceData inst, vec4 rect) {
+    vec4 center = view_proj * vec4(inst.position_radius.xyz, 1.0);
+    if (center.w <= 0.0 || abs(center.z) > center.w) {
+        return false;
+    }
+    vec3 corner_offset = camera_right.xyz * (0.5 * inst.size.x) + camera_up.xyz * (0.5 * inst.size.y);
+    vec4 corner = view_proj * vec4(inst.position_radius.xyz + corner_offset, 1.0);
+    vec2 c = center.xy / center.w;
+    vec2 extent = abs(corner.xy / corner.w - c);
+    return all(lessThanEqual(c - extent, rect.zw)) && all(greaterThanEqual(c + extent, rect.xy));
+}
+
+void record(uint query, uint id) {
+    uint index = atomicAdd(hit_counts[query], 1u);
+    if (index < MAX_QUERY_HITS) {
+        hit_ids[query * MAX_QUERY_HITS + index] = id;
+    }
+}
+
+#ifdef USE_BVH
+// 0: 在子视锥外, 1: 相交, 2: 整个在里面
+uint classify(vec3 lo, vec3 hi, uint query) {
+    uint result = 2u;
+    for (int i = 0; i < 6; ++i) {
+        vec4 plane = queries[query].planes[i];
+        bvec3 positive = greaterThanEqual(plane.xyz, vec3(0.0));
+        if (dot(plane.xyz, mix(lo, hi, positive)) + plane.w < -1e-5) {
+            return 0u;
+        }
+        if (dot(plane.xyz, mix(hi, lo, positive)) + plane.w < 1e-5) {
+            result = 1u;
+        }
+    }
+    return result;
+}
+
+void main() {
+    uint query = gl_GlobalInvocationID.x;
+    if (query >= query_count) {
+        return;
+    }
+    vec4 rect = queries[query].rect;
+    uint first_leaf = element_count - 1u;
+    uint stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0u;
+    while (top > 0) {
+        uint node = stack[--top];
+        if (node >= first_leaf) {
+            uint id = nodes[node].left;
+            if (instance_hit(instances[id], rect)) {
+                record(query, id);
+            }
+            continue;
+        }
+        uint c = classify(nodes[node].bounds_min, nodes[node].bounds_max, query);
+        if (c == 0u) {
+            continue;
+        }
+        if (c == 2u) {
+            // 整个在里面: 节点盖住的是排序后连续的一段叶子, 沿最左/最右的孩子下去拿到区间, 不用再测
+            uint lo = node, hi = node;
+            while (lo < first_leaf) lo = nodes[lo].left;
+            while (hi < first_leaf) hi = nodes[hi].right;
+            uint base = atomicAdd(hit_counts[query], hi - lo + 1u);
+            for (uint leaf = lo; leaf <= hi && base + (leaf - lo) < MAX_QUERY_HITS; ++leaf) {
+                hit_ids[query * MAX_QUERY_HITS + base + (leaf - lo)] = nodes[leaf].left;
+            }
+            continue;
+        }
+        stack[top++] = nodes[node].right;
+        stack[top++] = nodes[node].left;
+    }
+}
+#else
+void main() {
+    uint id = gl_GlobalInvocationID.x;
+    if (id >= element_count) {
+        return;
+    }
+    InstanceData inst = instances[id];
+    for (uint q = 0u; q < query_count; ++q) {
+        if (instance_hit(inst, queries[q].rect)) {
+            record(q, id);
+        }
+    }
+}
+#endif
+)";
+
+// 命中实例的描边 (画在场景上面, 不进帧捕获). 每个实例一个4顶点的line loop, 往外扩几个像素, 小实例也看得见;
+// RECT_OUTLINE: 拖拽框选时画出NDC矩形
+const char* highlight_vs_source = R"(
+#version 450 core
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 1) readonly buffer HighlightIDBuffer {
+    uint highlight_ids[];
+};
+
+uniform uint id_offset;
+uniform vec2 margin; // NDC
+uniform vec4 ndc_rect;
+uniform vec4 color;
+
+out vec4 v_color;
+
+void main() {
+    // line loop顺序: (-,-) (+,-) (+,+) (-,+)
+    vec2 corner = vec2(gl_VertexID == 1 || gl_VertexID == 2 ? 0.5 : -0.5, gl_VertexID >= 2 ? 0.5 : -0.5);
+    v_color = color;
+#ifdef RECT_OUTLINE
+    gl_Position = vec4(mix(ndc_rect.xy, ndc_rect.zw, corner + 0.5), 0.0, 1.0);
+#else
+    InstanceData inst = instances[highlight_ids[id_offset + gl_InstanceID]];
+    vec4 center = view_proj * vec4(inst.position_radius.xyz, 1.0);
+    if (center.w <= 0.0) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+    vec3 corner_offset = camera_right.xyz * (0.5 * inst.size.x) + camera_up.xyz * (0.5 * inst.size.y);
+    vec4 edge = view_proj * vec4(inst.position_radius.xyz + corner_offset, 1.0);
+    vec2 c = center.xy / center.w;
+    vec2 half_extent = abs(edge.xy / edge.w - c) + margin;
+    gl_Position = vec4(c + corner * 2.0 * half_extent, 0.0, 1.0);
+#endif
+}
+)";
+
+// 顶点着色器
+const char* render_vs_source = R"(
+#version 450 core
+#extension GL_ARB_shader_draw_parameters : require
+layout (location = 0) in vec2 a_pos; // 基础Quad的顶点位置 (-0.5 to 0.5)
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+// 仅在实例化模式下使用
+layout(std430, binding = 1) readonly buffer VisibleIDBuffer {
+    uint visible_ids[];
+};
+
+#if defined(FETCH_TBO)
+uniform usamplerBuffer instance_texels;   // 每个实例两个RGBA32UI texel
+uniform usamplerBuffer visible_id_texels;
+#elif defined(FETCH_UBO)
+// 压缩副本的一块, glBindBufferRange换块; std140下InstanceData同样是32字节
+layout(std140, binding = 2) uniform InstanceChunk {
+    InstanceData chunk_instances[UBO_CHUNK_INSTANCES];
+};
+#elif defined(FETCH_ATTRIBUTE)
+layout (location = 1) in vec4 a_position_radius;
+layout (location = 2) in vec2 a_size;
+layout (location = 3) in uint a_color;
+#endif
+
+uniform bool is_instanced_mode;
+
+out vec4 v_color;
+
+void main() {
+#if defined(FETCH_TBO)
+#ifdef FETCH_COMPACT
+    int texel = gl_InstanceID * 2; // 纹理缓冲建在压缩副本上, 没有间接
+#else
+    int texel = int(texelFetch(visible_id_texels, gl_InstanceID).x) * 2;
+#endif
+    uvec4 t0 = texelFetch(instance_texels, texel);
+    uvec4 t1 = texelFetch(instance_texels, texel + 1);
+    InstanceData inst;
+    inst.position_radius = uintBitsToFloat(t0);
+    inst.size = uintBitsToFloat(t1.xy);
+    inst.color = t1.z;
+#elif defined(FETCH_UBO)
+    InstanceData inst = chunk_instances[gl_InstanceID];
+#elif defined(FETCH_ATTRIBUTE)
+    InstanceData inst;
+    inst.position_radius = a_position_radius;
+    inst.size = a_size;
+    inst.color = a_color;
+#else
+    uint instance_id;
+#if defined(VS_CULL) || defined(FETCH_COMPACT)
+    // VS剔除模式: 全部实例都画, gl_InstanceID就是元素ID
+    // 融合收集: binding 0绑的是压缩副本, 按gl_InstanceID顺序读
+    instance_id = gl_InstanceID;
+#elif defined(PACKED_IDS)
+    // 16位id: 每段一次绘制, baseInstance既是段的起始元素也是段在id缓冲里的起点
+    uint slot = gl_BaseInstanceARB + gl_InstanceID;
+    instance_id = gl_BaseInstanceARB + ((visible_ids[slot >> 1] >> ((slot & 1u) * 16u)) & 0xFFFFu);
+#else
+    if (is_instanced_mode) {
+        // 实例化模式: 通过gl_InstanceID间接查找真正的元素ID
+        instance_id = visible_ids[gl_InstanceID];
+    } else {
+        // 微批次模式: 直接从baseInstance获取元素ID (4.5核心里没有gl_BaseInstance, 走ARB扩展)
+        instance_id = gl_BaseInstanceARB;
+    }
+#endif
+    
+    InstanceData inst = instances[instance_id];
+#endif
+
+#ifdef VS_CULL
+    // 不可见: 4个顶点都放到裁剪体外同一点, 三角形退化, 光栅化前就被丢掉
+    if (!is_instance_visible(inst)) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        v_color = vec4(0.0);
+        return;
+    }
+#endif
+    
+    v_color = unpackUnorm4x8(inst.color);
+    
+    // billboard: 沿相机的right/up展开, 正交2D相机下就是原来的xy平面
+    vec3 world_pos = inst.position_radius.xyz
+                   + camera_right.xyz * (a_pos.x * inst.size.x)
+                   + camera_up.xyz * (a_pos.y * inst.size.y);
+    gl_Position = view_proj * vec4(world_pos, 1.0);
+}
+)";
+
+// 多视图顶点着色器: 支持ARB_shader_viewport_layer_array时, 一次MDI画完所有视图,
+// 由gl_DrawID选视图并写gl_ViewportIndex; 否则每个视图单独一次间接绘制, 视图号走uniform
+const char* render_multiview_vs_source = R"(
+#version 450 core
+#extension GL_ARB_shader_draw_parameters : require
+#extension GL_ARB_shader_viewport_layer_array : enable
+layout (location = 0) in vec2 a_pos;
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    InstanceData instances[];
+};
+
+layout(std430, binding = 1) readonly buffer VisibleIDBuffer {
+    uint visible_ids[];
+};
+
+uniform uint view_index;
+
+out vec4 v_color;
+
+void main() {
+#ifdef VIEWPORT_FROM_DRAW_ID
+    uint view = uint(gl_DrawIDARB);
+    gl_ViewportIndex = int(view);
+#else
+    uint view = view_index;
+#endif
+    // baseInstance = 该视图id段的起点, gl_InstanceID不包含baseInstance
+    InstanceData inst = instances[visible_ids[gl_BaseInstanceARB + gl_InstanceID]];
+
+    v_color = unpackUnorm4x8(inst.color);
+
+    vec3 world_pos = inst.position_radius.xyz
+                   + views[view].camera_right.xyz * (a_pos.x * inst.size.x)
+                   + views[view].camera_up.xyz * (a_pos.y * inst.size.y);
+    gl_Position = views[view].view_proj * vec4(world_pos, 1.0);
+}
+)";
+
+// 片元着色器
+const char* render_fs_source = R"(
+#version 450 core
+in vec4 v_color;
+out vec4 FragColor;
+
+void main() {
+    FragColor = v_color;
+}
+)";
+
+// --- GL 3.3退路: 变换反馈剔除 ---
+// 3.3没有SSBO/计算着色器/binding限定符, 这几个着色器用自己的公共声明:
+// 实例数据走纹理缓冲 (每个实例两个RGBA32UI texel), FrameUniforms的绑定点由glUniformBlockBinding设
+const char* shader_common_gl33_source = R"(
+struct InstanceData {
+    vec4 position_radius;
+    vec2 size;
+    uint color;
+    uint cluster_id;
+};
+
+uniform usamplerBuffer instance_texels;
+
+InstanceData fetch_instance(int id) {
+    uvec4 t0 = texelFetch(instance_texels, id * 2);
+    uvec4 t1 = texelFetch(instance_texels, id * 2 + 1);
+    InstanceData inst;
+    inst.position_radius = uintBitsToFloat(t0);
+    inst.size = uintBitsToFloat(t1.xy);
+    inst.color = t1.z;
+    inst.cluster_id = t1.w;
+    return inst;
+}
+
+// unpackUnorm4x8要GLSL 4.00
+vec4 unpack_color(uint c) {
+    return vec4(uvec4(c, c >> 8, c >> 16, c >> 24) & 0xFFu) / 255.0;
+}
+
+layout(std140) uniform FrameUniforms {
+    mat4 view_proj;
+    vec4 frustum_planes[6];
+    vec4 camera_right;
+    vec4 camera_up;
+};
+
+bool is_instance_visible(InstanceData inst) {
+#ifdef CULL_SPHERE_FRUSTUM
+    vec4 center = vec4(inst.position_radius.xyz, 1.0);
+    for (int i = 0; i < 6; ++i) {
+        if (dot(frustum_planes[i], center) < -inst.position_radius.w) {
+            return false;
+        }
+    }
+    return true;
+#else
+    vec4 clip_pos = view_proj * vec4(inst.position_radius.xyz, 1.0);
+    return (clip_pos.x >= -clip_pos.w && clip_pos.x <= clip_pos.w &&
+            clip_pos.y >= -clip_pos.w && clip_pos.y <= clip_pos.w);
+#endif
+}
+
+vec4 billboard_position(InstanceData inst, vec2 corner) {
+    vec3 world_pos = inst.position_radius.xyz
+                   + camera_right.xyz * (corner.x * inst.size.x)
+                   + camera_up.xyz * (corner.y * inst.size.y);
+    return view_proj * vec4(world_pos, 1.0);
+}
+)";
+
+// 剔除pass: 每个元素一个点, 开着GL_RASTERIZER_DISCARD, VS做测试, GS只把可见的点放出去
+const char* tf_cull_vs_source = R"(
+#version 330 core
+flat out uint v_instance_id;
+flat out uint v_visible;
+
+void main() {
+    v_instance_id = uint(gl_VertexID);
+    v_visible = is_instance_visible(fetch_instance(gl_VertexID)) ? 1u : 0u;
+}
+)";
+
+const char* tf_cull_gs_source = R"(
+#version 330 core
+layout(points) in;
+layout(points, max_vertices = 1) out;
+
+flat in uint v_instance_id[];
+flat in uint v_visible[];
+
+flat out uint visible_id; // 变换反馈只捕获这一个输出
+
+void main() {
+    if (v_visible[0] != 0u) {
+        visible_id = v_instance_id[0];
+        EmitVertex();
+        EndPrimitive();
+    }
+}
+)";
+
+// 绘制: 可见id作为顶点属性读回来.
+// EXPAND_IN_GS: glDrawTransformFeedback按捕获的点数画点, GS展开成quad;
+// 否则id是每实例属性 (divisor 1), 按查询到的个数实例化绘制
+const char* tf_render_vs_source = R"(
+#version 330 core
+layout (location = 0) in vec2 a_pos;
+layout (location = 1) in uint a_instance_id;
+
+#ifdef EXPAND_IN_GS
+flat out uint g_instance_id;
+
+void main() {
+    g_instance_id = a_instance_id;
+    gl_Position = vec4(0.0);
+}
+#else
+out vec4 v_color;
+
+void main() {
+    InstanceData inst = fetch_instance(int(a_instance_id));
+    v_color = unpack_color(inst.color);
+    gl_Position = billboard_position(inst, a_pos);
+}
+#endif
+)";
+
+const char* tf_render_gs_source = R"(
+#version 330 core
+layout(points) in;
+layout(triangle_strip, max_vertices = 4) out;
+
+flat in uint g_instance_id[];
+out vec4 v_color;
+
+void main() {
+    InstanceData inst = fetch_instance(int(g_instance_id[0]));
+    vec4 color = unpack_color(inst.color);
+    // 对角线和quad索引缓冲的一致 (0-2)
+    const vec2 corners[4] = vec2[4](vec2(0.5, -0.5), vec2(0.5, 0.5), vec2(-0.5, -0.5), vec2(-0.5, 0.5));
+    for (int i = 0; i < 4; ++i) {
+        v_color = color;
+        gl_Position = billboard_position(inst, corners[i]);
+        EmitVertex();
+    }
+    EndPrimitive();
+}
+)";
+
+const char* tf_render_fs_source = R"(
+#version 330 core
+in vec4 v_color;
+out vec4 FragColor;
+
+void main() {
+    FragColor = v_color;
+}
+)";
+
+// 把宏定义和公共声明插到开头的#version/#extension之后 (#version 330的用shader_common_gl33_source)
+std::string build_shader_source(const char* body, const std::string& defines = "") {
+    std::string src = body;
+    size_t insert_at = 0;
+    size_t line_start = 0;
+    while (line_start < src.size()) {
+        size_t line_end = src.find('\n', line_start);
+        if (line_end == std::string::npos) line_end = src.size();
+        std::string line = src.substr(line_start, line_end - line_start);
+        bool is_header = line.rfind("#version", 0) == 0 || line.rfind("#extension", 0) == 0;
+        if (!is_header && !line.empty()) break;
+        if (is_header) insert_at = line_end + 1;
+        line_start = line_end + 1;
+    }
+    bool gl33 = src.substr(0, insert_at).find("#version 330") != std::string::npos;
+    return src.substr(0, insert_at) + defines + (gl33 ? shader_common_gl33_source : shader_common_source) + src.substr(insert_at);
+}
+
+// --- 实例数据 (与GLSL的InstanceData一致, std430下32字节) ---
+struct InstanceData {
+    glm::vec4 position_radius;
+    glm::vec2 size;
+    uint32_t color;
+    uint32_t cluster_id;
+};
+static_assert(sizeof(InstanceData) == 32, "InstanceData must match the std430 layout");
+
+// --- 每帧常量 (与GLSL的FrameUniforms一致, std140) ---
+struct FrameUniforms {
+    glm::mat4 view_proj;
+    glm::vec4 frustum_planes[6];
+    glm::vec4 camera_right;
+    glm::vec4 camera_up;
+};
+
+// Gribb/Hartmann: 从view_proj的行组合出6个平面, 法线朝内并归一化
+void extract_frustum_planes(const glm::mat4& m, glm::vec4 planes[6]) {
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    planes[0] = row3 + row0; // left
+    planes[1] = row3 - row0; // right
+    planes[2] = row3 + row1; // bottom
+    planes[3] = row3 - row1; // top
+    planes[4] = row3 + row2; // near
+    planes[5] = row3 - row2; // far
+    for (int i = 0; i < 6; ++i) {
+        planes[i] = planes[i] / glm::length(glm::vec3(planes[i].x, planes[i].y, planes[i].z));
+    }
+}
+
+// CPU版的is_visible, 和GLSL里的两种测试逐条对应
+inline bool cpu_is_visible(const InstanceData& inst, const FrameUniforms& frame, CullTest test) {
+    if (test == CULL_TEST_SPHERE_3D) {
+        glm::vec4 center(inst.position_radius.x, inst.position_radius.y, inst.position_radius.z, 1.0f);
+        for (int i = 0; i < 6; ++i) {
+            if (glm::dot(frame.frustum_planes[i], center) < -inst.position_radius.w) return false;
+        }
+        return true;
+    }
+    glm::vec4 clip = frame.view_proj * glm::vec4(inst.position_radius.x, inst.position_radius.y, inst.position_radius.z, 1.0f);
+    return clip.x >= -clip.w && clip.x <= clip.w && clip.y >= -clip.w && clip.y <= clip.w;
+}
+
+// --- 相机 ---
+// 2D: 原来的正交[-1,1], 可以平移缩放; 3D: 透视相机, 右键拖动转向, WASD/QE移动
+const float CAMERA_NEAR = 0.01f;
+
+struct Camera {
+    bool perspective = false;
+
+    glm::vec2 ortho_center = glm::vec2(0.0f, 0.0f);
+    float ortho_zoom = 1.0f;
+
+    glm::vec3 position = glm::vec3(0.0f, 0.0f, 3.0f);
+    float yaw = -90.0f;   // 度
+    float pitch = 0.0f;
+    float fov_y = 60.0f;
+    float move_speed = 1.0f;
+
+    double last_cursor_x = 0.0, last_cursor_y = 0.0;
+
+    glm::vec3 forward() const {
+        float cy = cosf(glm::radians(yaw)), sy = sinf(glm::radians(yaw));
+        float cp = cosf(glm::radians(pitch)), sp = sinf(glm::radians(pitch));
+        return glm::vec3(cy * cp, sp, sy * cp);
+    }
+    glm::vec3 right() const { return perspective ? glm::normalize(glm::cross(forward(), glm::vec3(0, 1, 0))) : glm::vec3(1, 0, 0); }
+    glm::vec3 up() const { return perspective ? glm::cross(right(), forward()) : glm::vec3(0, 1, 0); }
+
+    void update(GLFWwindow* window, float dt, bool mouse_captured, bool keyboard_captured) {
+        double cursor_x, cursor_y;
+        glfwGetCursorPos(window, &cursor_x, &cursor_y);
+        if (perspective && !mouse_captured && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS) {
+            yaw += (float)(cursor_x - last_cursor_x) * 0.2f;
+            pitch = glm::clamp(pitch - (float)(cursor_y - last_cursor_y) * 0.2f, -89.0f, 89.0f);
+        }
+        last_cursor_x = cursor_x;
+        last_cursor_y = cursor_y;
+
+        if (keyboard_captured) return;
+        auto key = [&](int k) { return glfwGetKey(window, k) == GLFW_PRESS ? 1.0f : 0.0f; };
+        float step = move_speed * dt;
+        if (perspective) {
+            position += forward() * (step * (key(GLFW_KEY_W) - key(GLFW_KEY_S)));
+            position += right() * (step * (key(GLFW_KEY_D) - key(GLFW_KEY_A)));
+            position += glm::vec3(0, 1, 0) * (step * (key(GLFW_KEY_E) - key(GLFW_KEY_Q)));
+        } else {
+            ortho_center += glm::vec2(key(GLFW_KEY_D) - key(GLFW_KEY_A), key(GLFW_KEY_W) - key(GLFW_KEY_S)) * (step / ortho_zoom);
+            ortho_zoom = glm::clamp(ortho_zoom * (1.0f + dt * (key(GLFW_KEY_E) - key(GLFW_KEY_Q))), 0.05f, 100.0f);
+        }
+    }
+
+    glm::mat4 view_proj(float aspect) const {
+        if (!perspective) {
+            float half = 1.0f / ortho_zoom;
+            return glm::ortho(ortho_center.x - half, ortho_center.x + half, ortho_center.y - half, ortho_center.y + half, -1.0f, 1.0f);
+        }
+        glm::mat4 proj = glm::perspective(glm::radians(fov_y), aspect, CAMERA_NEAR, 100.0f);
+        glm::mat4 view = glm::lookAt(position, position + forward(), glm::vec3(0, 1, 0));
+        return proj * view;
+    }
+
+    // proj[1][1] * 视口高度 / 2: 世界尺寸 / clip.w -> 像素
+    float projection_scale(int viewport_height) const {
+        float p11 = perspective ? 1.0f / tanf(glm::radians(fov_y) * 0.5f) : ortho_zoom;
+        return p11 * viewport_height * 0.5f;
+    }
+
+    FrameUniforms frame_uniforms(float aspect) const {
+        FrameUniforms u;
+        u.view_proj = view_proj(aspect);
+        extract_frustum_planes(u.view_proj, u.frustum_planes);
+        u.camera_right = glm::vec4(right(), 0.0f);
+        u.camera_up = glm::vec4(up(), 0.0f);
+        return u;
+    }
+};
+
+// --- 多视图 ---
+const int MAX_VIEWS = 8;
+
+struct MultiViewUniforms {
+    FrameUniforms views[MAX_VIEWS]; // 布局与GLSL的ViewData相同
+    uint32_t view_count;
+    uint32_t pad[3];
+};
+
+struct ViewRect { int x, y, width, height; };
+
+// 由view和proj矩阵得到一个视图的常量, billboard轴取view矩阵的前两行
+FrameUniforms make_view_uniforms(const glm::mat4& view, const glm::mat4& proj) {
+    FrameUniforms u;
+    u.view_proj = proj * view;
+    extract_frustum_planes(u.view_proj, u.frustum_planes);
+    u.camera_right = glm::vec4(view[0][0], view[1][0], view[2][0], 0.0f);
+    u.camera_up = glm::vec4(view[0][1], view[1][1], view[2][1], 0.0f);
+    return u;
+}
+
+// 视图0: 主相机; 1: 俯视小地图; 2: 光源方向的阴影视图; 3以后: 绕场景一圈的分屏相机.
+// 视口按网格平铺在窗口里.
+void build_views(const Camera& camera, int view_count, int fb_width, int fb_height, MultiViewUniforms& out, ViewRect rects[MAX_VIEWS]) {
+    int cols = view_count <= 2 ? view_count : (view_count <= 4 ? 2 : 4);
+    int rows = (view_count + cols - 1) / cols;
+    int tile_w = fb_width / cols, tile_h = fb_height / rows;
+    float tile_aspect = tile_h > 0 ? (float)tile_w / tile_h : 1.0f;
+
+    for (int v = 0; v < view_count; ++v) {
+        rects[v] = { (v % cols) * tile_w, (rows - 1 - v / cols) * tile_h, tile_w, tile_h };
+        if (v == 0) {
+            out.views[v] = camera.frame_uniforms(tile_aspect);
+        } else if (v == 1) {
+            glm::mat4 view = glm::lookAt(glm::vec3(0, 0, 2), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+            out.views[v] = make_view_uniforms(view, glm::ortho(-1.1f * tile_aspect, 1.1f * tile_aspect, -1.1f, 1.1f, 0.1f, 4.0f));
+        } else if (v == 2) {
+            glm::vec3 light_dir = glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f));
+            glm::mat4 view = glm::lookAt(light_dir * 3.0f, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+            out.views[v] = make_view_uniforms(view, glm::ortho(-1.8f, 1.8f, -1.8f, 1.8f, 0.1f, 6.0f));
+        } else {
+            float angle = (v - 3) * 6.2831853f / (MAX_VIEWS - 3);
+            glm::vec3 eye(3.0f * sinf(angle), 0.8f, 3.0f * cosf(angle));
+            glm::mat4 view = glm::lookAt(eye, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+            out.views[v] = make_view_uniforms(view, glm::perspective(glm::radians(50.0f), tile_aspect, CAMERA_NEAR, 100.0f));
+        }
+    }
+    out.view_count = view_count;
+}
+
+bool has_gl_extension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0) return true;
+    }
+    return false;
+}
+
+// --- 显存登记 ---
+// 每个缓冲/纹理/程序在创建处登记大小和用途, 按子系统汇总给UI和基准JSON.
+// 程序的大小取GL_PROGRAM_BINARY_LENGTH, 只是驱动内部占用的近似; 纹理缓冲只是视图, 记0字节.
+// 有GL_NVX_gpu_memory_info / GL_ATI_meminfo时再附上驱动报告的剩余显存
+#define GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX 0x9048
+#define GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#define VBO_FREE_MEMORY_ATI 0x87FB
+
+struct GpuMemoryRegistry {
+    enum Kind { BUFFER, TEXTURE, PROGRAM, KIND_COUNT };
+    struct Entry {
+        Kind kind;
+        GLuint id;
+        const char* subsystem;
+        std::string purpose;
+        int64_t bytes;
+    };
+    std::vector<Entry> entries;
+    bool has_nvx = false, has_ati = false;
+    bool has_program_binary = false; // GL_PROGRAM_BINARY_LENGTH要4.1或GL_ARB_get_program_binary, 3.3上没有就记0
+
+    void init(bool program_binary) {
+        has_program_binary = program_binary;
+        has_nvx = has_gl_extension("GL_NVX_gpu_memory_info");
+        has_ati = has_gl_extension("GL_ATI_meminfo");
+    }
+
+    // 同一个对象再登记就是改大小/用途 (比如重新分配过)
+    void track(Kind kind, GLuint id, const char* subsystem, const std::string& purpose, int64_t bytes) {
+        for (Entry& e : entries) {
+            if (e.kind == kind && e.id == id) {
+                e.subsystem = subsystem;
+                e.purpose = purpose;
+                e.bytes = bytes;
+                return;
+            }
+        }
+        entries.push_back({ kind, id, subsystem, purpose, bytes });
+    }
+
+    void resize(Kind kind, GLuint id, int64_t bytes) {
+        for (Entry& e : entries) {
+            if (e.kind == kind && e.id == id) e.bytes = bytes;
+        }
+    }
+
+    void forget(Kind kind, GLuint id) {
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+            [&](const Entry& e) { return e.kind == kind && e.id == id; }), entries.end());
+    }
+
+    // 分配并登记一个缓冲, 绑在target上返回
+    GLuint create_buffer(GLenum target, GLsizeiptr bytes, const void* data, GLenum usage, const char* subsystem, const char* purpose) {
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(target, buffer);
+        glBufferData(target, bytes, data, usage);
+        track(BUFFER, buffer, subsystem, purpose, bytes);
+        return buffer;
+    }
+
+    // 用途记成 "源码名 [宏]", 同一份源码的各个变体分得开
+    void track_program(GLuint program, const char* subsystem, const char* name, const std::string& defines) {
+        GLint length = 0;
+        if (has_program_binary) glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        std::string purpose = name;
+        std::string macros;
+        std::istringstream lines(defines);
+        for (std::string line; std::getline(lines, line);) {
+            if (line.compare(0, 8, "#define ") == 0) line = line.substr(8);
+            if (!line.empty()) macros += (macros.empty() ? "" : " ") + line;
+        }
+        if (!macros.empty()) purpose += " [" + macros + "]";
+        track(PROGRAM, program, subsystem, purpose, length);
+    }
+
+    // 子系统按第一次登记的顺序; 每项是 [缓冲, 纹理, 程序] 字节数
+    std::vector<std::pair<const char*, std::array<int64_t, KIND_COUNT>>> totals() const {
+        std::vector<std::pair<const char*, std::array<int64_t, KIND_COUNT>>> out;
+        for (const Entry& e : entries) {
+            auto it = std::find_if(out.begin(), out.end(), [&](const auto& t) { return !strcmp(t.first, e.subsystem); });
+            if (it == out.end()) it = out.insert(out.end(), { e.subsystem, {} });
+            it->second[e.kind] += e.bytes;
+        }
+        return out;
+    }
+
+    int64_t total_bytes() const {
+        int64_t sum = 0;
+        for (const Entry& e : entries) sum += e.bytes;
+        return sum;
+    }
+
+    // 驱动报告的剩余显存 (KB); 两个扩展都没有时返回-1
+    int64_t driver_free_kb() const {
+        if (has_nvx) {
+            GLint kb = 0;
+            glGetIntegerv(GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &kb);
+            return kb;
+        }
+        if (has_ati) {
+            GLint info[4] = {}; // [0]: VBO池剩余总量
+            glGetIntegerv(VBO_FREE_MEMORY_ATI, info);
+            return info[0];
+        }
+        return -1;
+    }
+
+    int64_t driver_total_kb() const {
+        GLint kb = -1;
+        if (has_nvx) glGetIntegerv(GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX, &kb);
+        return kb;
+    }
+};
+GpuMemoryRegistry gpu_memory;
+
+// --- 簇 ---
+// 只有前element_count个实例参与渲染. 这部分按均匀网格分簇并重排后再上传,
+// 这样每个簇在instance_ssbo里是一段连续区间; 集合本身不变, 只是换了顺序.
+const int CLUSTER_GRID_XY = 32;
+const int CLUSTER_GRID_Z = 16; // 格子接近立方体, 包围球才不会被z方向撑大
+const int MAX_CLUSTERS = CLUSTER_GRID_XY * CLUSTER_GRID_XY * CLUSTER_GRID_Z;
+
+struct ClusterRange {
+    uint32_t first;
+    uint32_t count;
+};
+
+struct ClusteredInstances {
+    std::vector<InstanceData> instances; // 与instance_ssbo的前count个一致
+    std::vector<ClusterRange> clusters;  // 只保留非空簇
+    int count = -1;
+};
+
+// 计数排序, O(N)
+void build_clusters(const std::vector<InstanceData>& source, int count, ClusteredInstances& out) {
+    glm::vec3 bmin(1e30f), bmax(-1e30f);
+    for (int i = 0; i < count; ++i) {
+        glm::vec3 p(source[i].position_radius.x, source[i].position_radius.y, source[i].position_radius.z);
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+    glm::vec3 extent = glm::max(bmax - bmin, glm::vec3(1e-6f));
+    const glm::vec3 dims((float)CLUSTER_GRID_XY, (float)CLUSTER_GRID_XY, (float)CLUSTER_GRID_Z);
+
+    std::vector<uint32_t> cell_of(count);
+    std::vector<uint32_t> cell_start(MAX_CLUSTERS + 1, 0);
+    for (int i = 0; i < count; ++i) {
+        glm::vec3 p(source[i].position_radius.x, source[i].position_radius.y, source[i].position_radius.z);
+        glm::vec3 g = (p - bmin) / extent * dims;
+        int x = std::min((int)g.x, CLUSTER_GRID_XY - 1);
+        int y = std::min((int)g.y, CLUSTER_GRID_XY - 1);
+        int z = std::min((int)g.z, CLUSTER_GRID_Z - 1);
+        cell_of[i] = (z * CLUSTER_GRID_XY + y) * CLUSTER_GRID_XY + x;
+        cell_start[cell_of[i] + 1]++;
+    }
+    for (int c = 0; c < MAX_CLUSTERS; ++c) cell_start[c + 1] += cell_start[c];
+
+    // 非空的格子依次编号成簇
+    std::vector<uint32_t> cluster_of_cell(MAX_CLUSTERS, 0);
+    out.clusters.clear();
+    for (int c = 0; c < MAX_CLUSTERS; ++c) {
+        uint32_t n = cell_start[c + 1] - cell_start[c];
+        if (n == 0) continue;
+        cluster_of_cell[c] = (uint32_t)out.clusters.size();
+        out.clusters.push_back({ cell_start[c], n });
+    }
+
+    out.instances.resize(count);
+    std::vector<uint32_t> cursor(cell_start.begin(), cell_start.end() - 1);
+    for (int i = 0; i < count; ++i) {
+        InstanceData inst = source[i];
+        inst.cluster_id = cluster_of_cell[cell_of[i]];
+        out.instances[cursor[cell_of[i]]++] = inst;
+    }
+    out.count = count;
+}
+
+// --- 统计回读 ---
+// 几个GPU计数器每帧拷进一个小buffer, 隔几帧再映射读取, 和帧捕获一样不等GPU
+struct StatsReadback {
+    static const int RING_SIZE = 4;
+    static const int MAX_VALUES = 16;
+    GLuint buffers[RING_SIZE] = {};
+    GLsync fences[RING_SIZE] = {};
+    int head = 0;
+    uint32_t values[MAX_VALUES] = {};
+
+    void init() {
+        for (GLuint& b : buffers) {
+            b = gpu_memory.create_buffer(GL_COPY_WRITE_BUFFER, MAX_VALUES * sizeof(uint32_t), nullptr, GL_STREAM_READ, "Stats", "readback ring");
+        }
+    }
+
+    // 帧开始: 取回RING_SIZE帧之前那一格的结果
+    void begin_frame() {
+        if (!fences[head]) return;
+        glClientWaitSync(fences[head], GL_SYNC_FLUSH_COMMANDS_BIT, ~0ull);
+        glDeleteSync(fences[head]);
+        fences[head] = nullptr;
+        glBindBuffer(GL_COPY_READ_BUFFER, buffers[head]);
+        void* ptr = glMapBufferRange(GL_COPY_READ_BUFFER, 0, MAX_VALUES * sizeof(uint32_t), GL_MAP_READ_BIT);
+        if (ptr) {
+            memcpy(values, ptr, sizeof(values));
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+        }
+    }
+
+    void copy(GLuint src, GLintptr src_offset, int index) {
+        glBindBuffer(GL_COPY_READ_BUFFER, src);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[head]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src_offset, index * sizeof(uint32_t), sizeof(uint32_t));
+    }
+
+    void end_frame() {
+        fences[head] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        head = (head + 1) % RING_SIZE;
+    }
+};
+
+// 统计槽位
+enum StatsSlot {
+    STAT_VISIBLE_INSTANCES = 0,
+    STAT_IMPOSTORS = 1,
+    STAT_MERGED_INSTANCES = 2,
+    STAT_NEAR_CLUSTERS = 3,
+    STAT_ALIVE_SLOTS = 4,
+    STAT_HIGH_WATER = 5,
+    STAT_FREE_SLOTS = 6,
+    STAT_FAILED_SPAWNS = 7,
+    STAT_RECORDS_LOADED = 8,
+    STAT_MASK_WORDS_LOADED = 9,
+    STAT_LANES_BUSY = 10,
+    STAT_LANES_ISSUED = 11,
+    STAT_BVH_SURFACE_AREA = 12,
+    STAT_BVH_SURFACE_AREA_HIGH = 13,
+};
+
+// 与GLSL的SlotAllocator头部一致
+struct SlotAllocatorHeader {
+    GLint free_top;
+    GLuint high_water;
+    GLuint alive_count;
+    GLuint failed_spawns;
+    GLuint cull_dispatch[3];
+    GLuint pad;
+};
+const int MAX_SLOT_COMMANDS = 65536; // 每帧最多的spawn/kill请求数
+
+// 与GLSL的ChainState头部一致
+struct ChainStateHeader {
+    GLuint instance_dispatch[3];
+    GLuint finalize_dispatch[3];
+    GLuint visible_count;
+    GLuint lanes_busy;
+    GLuint lanes_issued;
+    GLuint queue_head;
+    GLuint queue_pushed;
+    GLuint queue_finished;
+};
+const int MAX_WORK_ITEMS = MAX_ELEMENTS / 256 + MAX_CLUSTERS; // 推回队列的上限: 每256个实例最多推一次
+// 常驻线程的工作组数上限. 每个工作组的lane 0最多占着一个还没写好的位置等, 所以取到的位置
+// 最多越过推回的条目persistent_groups个; 队列多留这么多, 这部分每帧也要清零
+const int MAX_PERSISTENT_GROUPS = 1024;
+
+// 与GLSL的BvhState一致
+struct BvhStateHeader {
+    GLuint scene_min_bits[3];
+    GLuint scene_max_bits[3];
+    GLuint surface_area;
+    GLuint surface_area_high;
+    GLuint frontier_count;
+    GLuint subtree_dispatch[3];
+    GLuint frontier_base;
+};
+const int BVH_RADIX_TILE = 4096;         // 与radix_sort_cs的RADIX_TILE一致
+const int BVH_FRONTIER_CAPACITY = 8192;  // 与bvh_traverse_cs一致, 缓冲是它的两倍
+
+// --- 空间查询 ---
+// 攒一批矩形/点查询, 一次compute跑完; 结果拷进回读环, 等fence到了再取, 不阻塞渲染线程
+const int MAX_SPATIAL_QUERIES = 16; // 与spatial_query_cs一致
+const int MAX_QUERY_HITS = 256;
+
+// 与GLSL的SpatialQuery一致
+struct SpatialQueryGpu {
+    glm::vec4 rect;
+    glm::vec4 planes[6];
+};
+
+struct SpatialQueryResult {
+    uint32_t ticket;
+    int tag;                   // 调用方自己区分查询用途
+    uint32_t hit_count;        // 总命中数, 可能比ids多
+    std::vector<uint32_t> ids; // 最多MAX_QUERY_HITS个
+};
+
+// NDC矩形 [ndc_min, ndc_max] 对应的子视锥平面, 和extract_frustum_planes的顺序一样; 点查询时左右/上下两个面重合
+void extract_rect_planes(const glm::mat4& m, glm::vec2 ndc_min, glm::vec2 ndc_max, glm::vec4 planes[6]) {
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    planes[0] = row0 - row3 * ndc_min.x;
+    planes[1] = row3 * ndc_max.x - row0;
+    planes[2] = row1 - row3 * ndc_min.y;
+    planes[3] = row3 * ndc_max.y - row1;
+    planes[4] = row3 + row2;
+    planes[5] = row3 - row2;
+    for (int i = 0; i < 6; ++i) {
+        planes[i] = planes[i] / glm::length(glm::vec3(planes[i].x, planes[i].y, planes[i].z));
+    }
+}
+
+struct SpatialQueries {
+    static const int RING_SIZE = 4;
+    static const size_t RESULT_BYTES = (MAX_SPATIAL_QUERIES + MAX_SPATIAL_QUERIES * MAX_QUERY_HITS) * sizeof(uint32_t);
+
+    struct Batch {
+        GLuint readback = 0;
+        GLsync fence = nullptr;
+        uint32_t first_ticket = 0;
+        int submit_frame = 0;
+        std::vector<int> tags;
+    };
+
+    GLuint linear_program = 0, bvh_program = 0;
+    GLuint query_buffer = 0, result_buffer = 0;
+    Batch batches[RING_SIZE];
+    int head = 0;
+    std::vector<SpatialQueryGpu> pending;
+    std::vector<int> pending_tags;
+    std::vector<SpatialQueryResult> ready;
+    uint32_t next_ticket = 1;
+    int last_latency_frames = 0;
+    bool last_used_bvh = false;
+
+    void init(GLuint linear, GLuint bvh) {
+        linear_program = linear;
+        bvh_program = bvh;
+        query_buffer = gpu_memory.create_buffer(GL_SHADER_STORAGE_BUFFER, MAX_SPATIAL_QUERIES * sizeof(SpatialQueryGpu), nullptr,
+            GL_DYNAMIC_DRAW, "Spatial Query", "query batch");
+        result_buffer = gpu_memory.create_buffer(GL_SHADER_STORAGE_BUFFER, RESULT_BYTES, nullptr, GL_DYNAMIC_COPY, "Spatial Query", "results");
+        for (Batch& b : batches) {
+            b.readback = gpu_memory.create_buffer(GL_COPY_WRITE_BUFFER, RESULT_BYTES, nullptr, GL_STREAM_READ, "Spatial Query", "readback ring");
+        }
+    }
+
+    // 返回票号; 这一批满了返回0
+    uint32_t add_rect(glm::vec2 ndc_min, glm::vec2 ndc_max, const glm::mat4& view_proj, int tag) {
+        if (pending.size() >= MAX_SPATIAL_QUERIES) return 0;
+        SpatialQueryGpu q;
+        q.rect = glm::vec4(glm::min(ndc_min, ndc_max), glm::max(ndc_min, ndc_max));
+        extract_rect_planes(view_proj, glm::vec2(q.rect.x, q.rect.y), glm::vec2(q.rect.z, q.rect.w), q.planes);
+        pending.push_back(q);
+        pending_tags.push_back(tag);
+        return next_ticket + (uint32_t)pending.size() - 1;
+    }
+
+    uint32_t add_point(glm::vec2 ndc, const glm::mat4& view_proj, int tag) {
+        return add_rect(ndc, ndc, view_proj, tag);
+    }
+
+    // 跑这一批. bvh_node_ssbo非0时按BVH遍历 (它必须是instance_ssbo前element_count个实例上建的)
+    void submit(GLuint instance_ssbo, GLuint bvh_node_ssbo, int element_count, int frame_index) {
+        if (pending.empty() || element_count <= 0) return;
+        Batch& batch = batches[head];
+        if (batch.fence) harvest(batch, frame_index, ~0ull); // 环满了: 最老的一批只能等
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, query_buffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, pending.size() * sizeof(SpatialQueryGpu), pending.data());
+        GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, result_buffer);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, MAX_SPATIAL_QUERIES * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+        last_used_bvh = bvh_node_ssbo != 0;
+        GLuint program = last_used_bvh ? bvh_program : linear_program;
+        glUseProgram(program);
+        glUniform1ui(glGetUniformLocation(program, "element_count"), element_count);
+        glUniform1ui(glGetUniformLocation(program, "query_count"), (GLuint)pending.size());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, query_buffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, result_buffer);
+        if (last_used_bvh) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bvh_node_ssbo);
+            glDispatchCompute(((GLuint)pending.size() + 63) / 64, 1, 1);
+        } else {
+            glDispatchCompute((element_count + 255) / 256, 1, 1);
+        }
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        // 只拷用到的: 计数 + 前几个查询的id段
+        glBindBuffer(GL_COPY_READ_BUFFER, result_buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, batch.readback);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+            (MAX_SPATIAL_QUERIES + pending.size() * MAX_QUERY_HITS) * sizeof(uint32_t));
+        batch.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        batch.first_ticket = next_ticket;
+        batch.submit_frame = frame_index;
+        batch.tags.swap(pending_tags);
+        next_ticket += (uint32_t)pending.size();
+        pending.clear();
+        pending_tags.clear();
+        head = (head + 1) % RING_SIZE;
+    }
+
+    // 取回已经完成的批次, 按提交顺序追加到out; 不等待
+    void poll(int frame_index, std::vector<SpatialQueryResult>& out) {
+        for (int i = 0; i < RING_SIZE; ++i) {
+            Batch& batch = batches[(head + i) % RING_SIZE];
+            if (batch.fence) harvest(batch, frame_index, 0);
+        }
+        for (SpatialQueryResult& r : ready) out.push_back(std::move(r));
+        ready.clear();
+    }
+
+private:
+    void harvest(Batch& batch, int frame_index, GLuint64 timeout) {
+        GLenum status = glClientWaitSync(batch.fence, timeout ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, timeout);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return;
+        glDeleteSync(batch.fence);
+        batch.fence = nullptr;
+        last_latency_frames = frame_index - batch.submit_frame;
+        int count = (int)batch.tags.size();
+        glBindBuffer(GL_COPY_READ_BUFFER, batch.readback);
+        const uint32_t* data = (const uint32_t*)glMapBufferRange(GL_COPY_READ_BUFFER, 0,
+            (MAX_SPATIAL_QUERIES + count * MAX_QUERY_HITS) * sizeof(uint32_t), GL_MAP_READ_BIT);
+        if (!data) return;
+        for (int q = 0; q < count; ++q) {
+            SpatialQueryResult r;
+            r.ticket = batch.first_ticket + q;
+            r.tag = batch.tags[q];
+            r.hit_count = data[q];
+            const uint32_t* ids = data + MAX_SPATIAL_QUERIES + q * MAX_QUERY_HITS;
+            r.ids.assign(ids, ids + std::min<uint32_t>(r.hit_count, MAX_QUERY_HITS));
+            ready.push_back(std::move(r));
+        }
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+    }
+};
+
+// --- CPU写的MDI指令 ---
+// 持久映射的指令缓冲分成RING_SIZE段, 每帧写一段; 每段带一个fence, GPU用完之前不会被覆盖
+struct PersistentCommandRing {
+    static const int RING_SIZE = 3;
+    static const GLsizeiptr SEGMENT_COMMANDS = MAX_ELEMENTS;
+    GLuint buffer = 0;
+    GLuint* mapped = nullptr;
+    GLsync fences[RING_SIZE] = {};
+    int head = 0;
+    int stalls = 0; // 段还在被GPU用, CPU只能等的次数
+
+    void init() {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        const GLsizeiptr bytes = RING_SIZE * SEGMENT_COMMANDS * 5 * sizeof(GLuint);
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+        glBufferStorage(GL_DRAW_INDIRECT_BUFFER, bytes, nullptr, flags);
+        gpu_memory.track(GpuMemoryRegistry::BUFFER, buffer, "CPU MDI", "persistent command ring", bytes);
+        mapped = (GLuint*)glMapBufferRange(GL_DRAW_INDIRECT_BUFFER, 0, bytes, flags);
+    }
+
+    // 返回本帧可写的那一段
+    GLuint* begin_segment() {
+        if (fences[head]) {
+            if (glClientWaitSync(fences[head], 0, 0) == GL_TIMEOUT_EXPIRED) {
+                stalls++;
+                glClientWaitSync(fences[head], GL_SYNC_FLUSH_COMMANDS_BIT, ~0ull);
+            }
+            glDeleteSync(fences[head]);
+            fences[head] = nullptr;
+        }
+        return mapped + head * SEGMENT_COMMANDS * 5;
+    }
+
+    GLintptr segment_offset() const { return head * SEGMENT_COMMANDS * 5 * sizeof(GLuint); }
+
+    void end_segment() {
+        fences[head] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        head = (head + 1) % RING_SIZE;
+    }
+};
+
+// --- CPU遮挡剔除 (masked occlusion) ---
+// 低分辨率遮挡缓冲, 32x8像素一块: 256位覆盖掩码 + 两层最远深度 (Hasselgren等的masked occlusion).
+// billboard和成像平面平行, 投影是深度处处等于clip.w的轴对齐矩形, 所以光栅化只是按行列拼掩码.
+// 遮挡体只算完整盖住的像素, 候选算碰到的所有像素, 所以是保守的: 剔掉的实例一个像素都不会画出来.
+const int OCCLUSION_WIDTH = 512;
+const int OCCLUSION_HEIGHT = 288;
+const int OCCLUSION_TILES_X = OCCLUSION_WIDTH / 32;
+const int OCCLUSION_TILES_Y = OCCLUSION_HEIGHT / 8;
+
+struct alignas(32) OcclusionTile {
+    uint32_t rows[8]; // 工作层的覆盖位, 每行32个像素
+    float z0;         // 参考层: 整块的保守最远深度
+    float z1;         // 工作层: 掩码内像素的最远深度, 掩码为空时是0
+    float pad[6];
+};
+
+struct OcclusionRect {
+    int x0, y0, x1, y1; // 遮挡缓冲像素 [x0,x1) x [y0,y1)
+    float depth;        // clip.w
+};
+
+inline bool cpu_supports_avx2() {
+#if defined(OCCLUSION_HAS_X86) && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return os_saves_ymm && (info[1] & (1 << 5));
+#elif defined(OCCLUSION_HAS_X86)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+inline uint32_t occlusion_column_bits(int lo, int hi) {
+    return (uint32_t)(((1ull << hi) - 1) & ~((1ull << lo) - 1));
+}
+
+struct MaskedOcclusionBuffer {
+    struct Occluder {
+        float area;
+        OcclusionRect rect;
+    };
+    std::vector<OcclusionTile> tiles;
+    std::vector<Occluder> occluders;
+    bool avx2_supported = false;
+    // 上一次cull的结果
+    int occluder_count = 0;
+    int tested = 0, rejected = 0;
+    float raster_ms = 0.0f, test_ms = 0.0f;
+
+    void init() {
+        tiles.resize(OCCLUSION_TILES_X * OCCLUSION_TILES_Y);
+        avx2_supported = cpu_supports_avx2();
+    }
+
+    void clear() {
+        for (OcclusionTile& t : tiles) {
+            memset(t.rows, 0, sizeof(t.rows));
+            t.z0 = FLT_MAX;
+            t.z1 = 0.0f;
+        }
+    }
+
+    // 投影到遮挡缓冲的像素坐标; 中心在近平面前面时返回false.
+    // right_clip/up_clip: view_proj * camera_right/up, 每帧算一次 (方向向量, w分量为0)
+    static bool project(const InstanceData& inst, const glm::mat4& view_proj, const glm::vec4& right_clip, const glm::vec4& up_clip,
+                        glm::vec4& bounds, float& depth) {
+        glm::vec4 clip = view_proj * glm::vec4(inst.position_radius.x, inst.position_radius.y, inst.position_radius.z, 1.0f);
+        if (clip.z < -clip.w || clip.w < CAMERA_NEAR) return false;
+        glm::vec2 right = glm::abs(glm::vec2(right_clip.x, right_clip.y)) * (0.5f * inst.size.x);
+        glm::vec2 up = glm::abs(glm::vec2(up_clip.x, up_clip.y)) * (0.5f * inst.size.y);
+        glm::vec2 half = (right + up) / clip.w;
+        glm::vec2 center = glm::vec2(clip.x, clip.y) / clip.w;
+        glm::vec2 scale(0.5f * OCCLUSION_WIDTH, 0.5f * OCCLUSION_HEIGHT);
+        glm::vec2 lo = (center - half + 1.0f) * scale, hi = (center + half + 1.0f) * scale;
+        bounds = glm::vec4(lo, hi);
+        depth = clip.w;
+        return true;
+    }
+
+    // 包围球碰到近平面: 投影出来的矩形不可信, 既不能当遮挡体也不能被剔除
+    static bool straddles_near(const InstanceData& inst, const glm::vec4& near_plane) {
+        float dist = glm::dot(glm::vec3(near_plane), glm::vec3(inst.position_radius)) + near_plane.w;
+        return dist < inst.position_radius.w;
+    }
+
+    // 覆盖位已经或进去了 (比参考层远的调用方已跳过): 深度合并进工作层, 工作层盖满整块就变成新的参考层
+    static void update_tile(OcclusionTile& t, bool full, float z) {
+        t.z1 = std::max(t.z1, z);
+        if (full) {
+            t.z0 = t.z1;
+            t.z1 = 0.0f;
+            memset(t.rows, 0, sizeof(t.rows));
+        }
+    }
+
+    void rasterize_scalar(const OcclusionRect& r) {
+        for (int ty = r.y0 / 8; ty <= (r.y1 - 1) / 8; ++ty) {
+            int row_lo = std::max(r.y0 - ty * 8, 0), row_hi = std::min(r.y1 - ty * 8, 8);
+            for (int tx = r.x0 / 32; tx <= (r.x1 - 1) / 32; ++tx) {
+                OcclusionTile& t = tiles[ty * OCCLUSION_TILES_X + tx];
+                if (r.depth >= t.z0) continue;
+                uint32_t bits = occlusion_column_bits(std::max(r.x0 - tx * 32, 0), std::min(r.x1 - tx * 32, 32));
+                uint32_t all = ~0u;
+                for (int row = 0; row < 8; ++row) {
+                    if (row >= row_lo && row < row_hi) t.rows[row] |= bits;
+                    all &= t.rows[row];
+                }
+                update_tile(t, all == ~0u, r.depth);
+            }
+        }
+    }
+
+    bool test_scalar(const OcclusionRect& r) const {
+        for (int ty = r.y0 / 8; ty <= (r.y1 - 1) / 8; ++ty) {
+            int row_lo = std::max(r.y0 - ty * 8, 0), row_hi = std::min(r.y1 - ty * 8, 8);
+            for (int tx = r.x0 / 32; tx <= (r.x1 - 1) / 32; ++tx) {
+                const OcclusionTile& t = tiles[ty * OCCLUSION_TILES_X + tx];
+                if (r.depth > t.z0) continue;
+                if (r.depth <= t.z1) return true;
+                uint32_t bits = occlusion_column_bits(std::max(r.x0 - tx * 32, 0), std::min(r.x1 - tx * 32, 32));
+                for (int row = row_lo; row < row_hi; ++row) {
+                    if (bits & ~t.rows[row]) return true; // 落在掩码外, 只被参考层挡着, 而参考层更远
+                }
+            }
+        }
+        return false;
+    }
+
+#if defined(OCCLUSION_HAS_X86)
+    // 一块的8行正好一个__m256i: 行范围用比较生成, 列范围广播
+    OCCLUSION_AVX2_TARGET static __m256i tile_coverage(int row_lo, int row_hi, uint32_t bits) {
+        __m256i row = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i in_rows = _mm256_and_si256(_mm256_cmpgt_epi32(row, _mm256_set1_epi32(row_lo - 1)),
+                                           _mm256_cmpgt_epi32(_mm256_set1_epi32(row_hi), row));
+        return _mm256_and_si256(in_rows, _mm256_set1_epi32((int)bits));
+    }
+
+    OCCLUSION_AVX2_TARGET void rasterize_avx2(const OcclusionRect& r) {
+        const __m256i ones = _mm256_set1_epi32(-1);
+        for (int ty = r.y0 / 8; ty <= (r.y1 - 1) / 8; ++ty) {
+            int row_lo = std::max(r.y0 - ty * 8, 0), row_hi = std::min(r.y1 - ty * 8, 8);
+            for (int tx = r.x0 / 32; tx <= (r.x1 - 1) / 32; ++tx) {
+                OcclusionTile& t = tiles[ty * OCCLUSION_TILES_X + tx];
+                if (r.depth >= t.z0) continue;
+                __m256i cover = tile_coverage(row_lo, row_hi, occlusion_column_bits(std::max(r.x0 - tx * 32, 0), std::min(r.x1 - tx * 32, 32)));
+                __m256i rows = _mm256_or_si256(_mm256_load_si256((const __m256i*)t.rows), cover);
+                _mm256_store_si256((__m256i*)t.rows, rows);
+                update_tile(t, _mm256_testc_si256(rows, ones) != 0, r.depth);
+            }
+        }
+    }
+
+    OCCLUSION_AVX2_TARGET bool test_avx2(const OcclusionRect& r) const {
+        for (int ty = r.y0 / 8; ty <= (r.y1 - 1) / 8; ++ty) {
+            int row_lo = std::max(r.y0 - ty * 8, 0), row_hi = std::min(r.y1 - ty * 8, 8);
+            for (int tx = r.x0 / 32; tx <= (r.x1 - 1) / 32; ++tx) {
+                const OcclusionTile& t = tiles[ty * OCCLUSION_TILES_X + tx];
+                if (r.depth > t.z0) continue;
+                if (r.depth <= t.z1) return true;
+                __m256i cover = tile_coverage(row_lo, row_hi, occlusion_column_bits(std::max(r.x0 - tx * 32, 0), std::min(r.x1 - tx * 32, 32)));
+                __m256i outside = _mm256_andnot_si256(_mm256_load_si256((const __m256i*)t.rows), cover);
+                if (!_mm256_testz_si256(outside, outside)) return true;
+            }
+        }
+        return false;
+    }
+#endif
+
+    // ids: 视锥剔除后的可见id, 原地去掉被挡住的.
+    // 遮挡体 = 投影面积不小于min_area_px的实例, 最多max_occluders个 (取最大的), 从近到远光栅化
+    void cull(const std::vector<InstanceData>& instances, const FrameUniforms& frame, std::vector<GLuint>& ids,
+              float min_area_px, int max_occluders, bool use_avx2) {
+        use_avx2 = use_avx2 && avx2_supported;
+        double start = glfwGetTime();
+        const glm::vec4 right_clip = frame.view_proj * frame.camera_right, up_clip = frame.view_proj * frame.camera_up;
+        occluders.clear();
+        const glm::vec4& near_plane = frame.frustum_planes[4];
+        for (GLuint id : ids) {
+            glm::vec4 b;
+            float depth;
+            if (straddles_near(instances[id], near_plane)) continue;
+            if (!project(instances[id], frame.view_proj, right_clip, up_clip, b, depth)) continue;
+            // 整个像素都在矩形内才算盖住
+            OcclusionRect r = { std::max((int)std::ceil(b.x), 0), std::max((int)std::ceil(b.y), 0),
+                                std::min((int)std::floor(b.z), OCCLUSION_WIDTH), std::min((int)std::floor(b.w), OCCLUSION_HEIGHT), depth };
+            float area = (float)(r.x1 - r.x0) * (float)(r.y1 - r.y0);
+            if (r.x1 > r.x0 && r.y1 > r.y0 && area >= min_area_px) occluders.push_back({ area, r });
+        }
+        if ((int)occluders.size() > max_occluders) {
+            std::nth_element(occluders.begin(), occluders.begin() + max_occluders, occluders.end(),
+                [](const Occluder& a, const Occluder& b) { return a.area > b.area; });
+            occluders.resize(max_occluders);
+        }
+        // 近的先画: 后面远的遮挡体在已经盖满的块上直接跳过
+        std::sort(occluders.begin(), occluders.end(), [](const Occluder& a, const Occluder& b) { return a.rect.depth < b.rect.depth; });
+        clear();
+        for (const Occluder& o : occluders) {
+#if defined(OCCLUSION_HAS_X86)
+            if (use_avx2) { rasterize_avx2(o.rect); continue; }
+#endif
+            rasterize_scalar(o.rect);
+        }
+        double raster_end = glfwGetTime();
+
+        size_t kept = 0;
+        for (GLuint id : ids) {
+            glm::vec4 b;
+            float depth;
+            bool visible = true;
+            if (!straddles_near(instances[id], near_plane) && project(instances[id], frame.view_proj, right_clip, up_clip, b, depth)) {
+                // 碰到的像素都算
+                OcclusionRect r = { std::max((int)std::floor(b.x), 0), std::max((int)std::floor(b.y), 0),
+                                    std::min((int)std::ceil(b.z), OCCLUSION_WIDTH), std::min((int)std::ceil(b.w), OCCLUSION_HEIGHT), depth };
+                if (r.x1 > r.x0 && r.y1 > r.y0) {
+#if defined(OCCLUSION_HAS_X86)
+                    visible = use_avx2 ? test_avx2(r) : test_scalar(r);
+#else
+                    visible = test_scalar(r);
+#endif
+                }
+            }
+            if (visible) ids[kept++] = id;
+        }
+        occluder_count = (int)occluders.size();
+        tested = (int)ids.size();
+        rejected = (int)(ids.size() - kept);
+        ids.resize(kept);
+        raster_ms = (float)((raster_end - start) * 1000.0);
+        test_ms = (float)((glfwGetTime() - raster_end) * 1000.0);
+    }
+};
+
+// --- 单生产者单消费者环 ---
+// 无锁: head只由生产者写, tail只由消费者写; 最多放N-1个, 满了push返回false
+template <typename T, size_t N>
+struct SpscRing {
+    T items[N];
+    std::atomic<size_t> head{ 0 }, tail{ 0 };
+
+    bool push(const T& value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t next = (h + 1) % N;
+        if (next == tail.load(std::memory_order_acquire)) return false;
+        items[h] = value;
+        head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& out) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        out = items[t];
+        tail.store((t + 1) % N, std::memory_order_release);
+        return true;
+    }
+};
+
+// --- 流水线CPU剔除 ---
+// CPU剔除的两种基线模式里, 视锥+遮挡剔除交给一个工作线程, 渲染线程只管提交.
+// 第N帧提交剔除请求后取回第N-1帧的结果来画, 工作线程剔除第N帧时渲染线程在提交GL指令,
+// 代价是可见集合落后一帧 (相机移动时屏幕边缘会晚一帧出现).
+// 包在固定的几个槽里循环使用, 两个无锁环只传槽号; 在途的包最多MAX_LATENCY + 1个
+struct CullPipeline {
+    static const int MAX_LATENCY = 1;
+    static const int SLOT_COUNT = MAX_LATENCY + 2;
+    struct Packet {
+        // 输入 (渲染线程写)
+        int frame_index = 0;
+        const std::vector<InstanceData>* instances = nullptr;
+        int element_count = 0;
+        FrameUniforms uniforms = {};
+        CullTest cull_test = CULL_TEST_POINT_2D;
+        bool occlusion = false;
+        float occluder_min_px = 0.0f;
+        int max_occluders = 0;
+        bool avx2 = false;
+        // 输出 (工作线程写)
+        std::vector<GLuint> visible_ids;
+        float cull_ms = 0.0f;
+        int occluder_count = 0, tested = 0, rejected = 0;
+        float raster_ms = 0.0f, test_ms = 0.0f;
+    };
+    Packet slots[SLOT_COUNT];
+    SpscRing<int, SLOT_COUNT + 1> requests, results;
+    MaskedOcclusionBuffer occlusion; // 工作线程自己的遮挡缓冲, 不和同步路径共用
+    std::thread worker;
+    std::atomic<bool> quitting{ false };
+    int next_slot = 0;
+    int in_flight = 0;
+    int current = -1; // 正在画的结果所在的槽, 下次取到新结果之前不会被重用
+    int last_submitted_frame = -2;
+    float wait_ms = 0.0f; // 本帧渲染线程等结果等了多久, 流水线充分重叠时接近0
+    int latency = 0;      // 本帧画的是几帧前的剔除结果
+
+    void init() {
+        occlusion.init();
+        worker = std::thread([this] { worker_loop(); });
+    }
+
+    // 丢掉所有在途的结果. 重新分簇前必须调用: 工作线程读的是clustered.instances
+    void flush() {
+        int slot;
+        while (in_flight > 0) {
+            if (results.pop(slot)) in_flight--;
+            else std::this_thread::yield();
+        }
+        current = -1;
+    }
+
+    // 提交第frame_index帧的请求, 返回这一帧要画的结果 (最多落后MAX_LATENCY帧)
+    Packet& submit_and_receive(int frame_index, const std::vector<InstanceData>& instances, int element_count,
+                               const FrameUniforms& uniforms, CullTest cull_test, bool use_occlusion,
+                               float occluder_min_px, int max_occluders, bool avx2) {
+        // 中间断过 (切过模式/重新分簇), 旧结果对不上了
+        if (last_submitted_frame != frame_index - 1) flush();
+        last_submitted_frame = frame_index;
+
+        Packet& p = slots[next_slot];
+        p.frame_index = frame_index;
+        p.instances = &instances;
+        p.element_count = element_count;
+        p.uniforms = uniforms;
+        p.cull_test = cull_test;
+        p.occlusion = use_occlusion;
+        p.occluder_min_px = occluder_min_px;
+        p.max_occluders = max_occluders;
+        p.avx2 = avx2;
+        // 槽数 = 在途上限 + 正在画的一个 + 刚提交的一个, 这里不会满, 也不会写到正在画的槽
+        requests.push(next_slot);
+        next_slot = (next_slot + 1) % SLOT_COUNT;
+        in_flight++;
+
+        // 稳态: 在途超过上限才等, 取最早的结果 (结果按提交顺序回来), 本帧的请求留在工作线程上.
+        // 冷启动 (第一帧或flush之后) 手上没有结果, 只能等本帧的; 下一帧再画一次它, 之后就落后一帧
+        double wait_start = glfwGetTime();
+        int slot;
+        while (in_flight > MAX_LATENCY || current < 0) {
+            if (results.pop(slot)) {
+                current = slot;
+                in_flight--;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        wait_ms = (float)((glfwGetTime() - wait_start) * 1000.0);
+        latency = frame_index - slots[current].frame_index;
+        return slots[current];
+    }
+
+    void shutdown() {
+        quitting.store(true, std::memory_order_release);
+        if (worker.joinable()) worker.join();
+    }
+
+private:
+    void worker_loop() {
+        int idle_spins = 0;
+        while (!quitting.load(std::memory_order_acquire)) {
+            int slot;
+            if (!requests.pop(slot)) {
+                // 空闲时先让出几轮, 久了再睡, 不在非CPU剔除模式下白占一个核
+                if (++idle_spins < 1000) std::this_thread::yield();
+                else std::this_thread::sleep_for(std::chrono::microseconds(200));
+                continue;
+            }
+            idle_spins = 0;
+            Packet& p = slots[slot];
+            double start = glfwGetTime();
+            p.visible_ids.clear();
+            for (int i = 0; i < p.element_count; ++i) {
+                if (cpu_is_visible((*p.instances)[i], p.uniforms, p.cull_test)) p.visible_ids.push_back(i);
+            }
+            if (p.occlusion) {
+                occlusion.cull(*p.instances, p.uniforms, p.visible_ids, p.occluder_min_px, p.max_occluders, p.avx2);
+                p.occluder_count = occlusion.occluder_count;
+                p.tested = occlusion.tested;
+                p.rejected = occlusion.rejected;
+                p.raster_ms = occlusion.raster_ms;
+                p.test_ms = occlusion.test_ms;
+            }
+            p.cull_ms = (float)((glfwGetTime() - start) * 1000.0);
+            results.push(slot);
+        }
+    }
+};
+
+// --- GPU计时 ---
+// GL_TIME_ELAPSED查询放在一个环里, 几帧之后再取结果, 不让CPU等GPU
+struct GpuTimer {
+    static const int RING_SIZE = 4;
+    GLuint queries[RING_SIZE] = {};
+    bool issued[RING_SIZE] = {};
+    int head = 0;
+    float last_ms = 0.0f;
+    float smoothed_ms = 0.0f;
+
+    void init() { glGenQueries(RING_SIZE, queries); }
+
+    void begin() {
+        if (issued[head]) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(queries[head], GL_QUERY_RESULT, &ns);
+            last_ms = (float)(ns / 1.0e6);
+            smoothed_ms = smoothed_ms == 0.0f ? last_ms : smoothed_ms * 0.95f + last_ms * 0.05f;
+            issued[head] = false;
+        }
+        glBeginQuery(GL_TIME_ELAPSED, queries[head]);
+    }
+
+    void end() {
+        glEndQuery(GL_TIME_ELAPSED);
+        issued[head] = true;
+        head = (head + 1) % RING_SIZE;
+    }
+};
+
+// 变换反馈写出的图元数 (= 可见实例数). 和GpuTimer一样, 查询隔RING_SIZE帧再读, 不等GPU
+struct FeedbackCounter {
+    static const int RING_SIZE = GpuTimer::RING_SIZE;
+    GLuint queries[RING_SIZE] = {};
+    bool issued[RING_SIZE] = {};
+    int head = 0;
+    GLuint last_count = 0;
+
+    void init() { glGenQueries(RING_SIZE, queries); }
+
+    void begin() {
+        if (issued[head]) {
+            glGetQueryObjectuiv(queries[head], GL_QUERY_RESULT, &last_count);
+            issued[head] = false;
+        }
+        glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, queries[head]);
+    }
+
+    void end() {
+        glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+        issued[head] = true;
+        head = (head + 1) % RING_SIZE;
+    }
+
+    // 没有glDrawTransformFeedback时, 绘制要用本帧的个数: 只能等GPU把剔除做完
+    GLuint wait_latest() {
+        int latest = (head + RING_SIZE - 1) % RING_SIZE;
+        glGetQueryObjectuiv(queries[latest], GL_QUERY_RESULT, &last_count);
+        issued[latest] = false;
+        return last_count;
+    }
+};
+
+inline uint32_t pack_unorm4x8(const glm::vec4& c) {
+    auto to_u8 = [](float v) { return (uint32_t)(glm::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f); };
+    return to_u8(c.x) | (to_u8(c.y) << 8) | (to_u8(c.z) << 16) | (to_u8(c.w) << 24);
+}
+
+// --- 实例分布 ---
+// 全均匀分布对原子操作和缓存最友好, 和真实数据差得远. 这几种分布都由种子决定, 方便对比各种策略.
+enum InstanceDistribution {
+    DIST_UNIFORM = 0,
+    DIST_GAUSSIAN_CLUSTERS = 1, // 少数几个重簇 + 很多轻簇
+    DIST_POWER_LAW_SIZES = 2,   // 位置均匀, 尺寸长尾 (少量很大的元素)
+    DIST_GRID_TILES = 3,        // 地图瓦片: 网格对齐, 分若干层
+    DIST_TEXT_RUNS = 4,         // 一行行紧挨着的小字形, 每行同色
+    DIST_COUNT
+};
+const char* distribution_names[DIST_COUNT] = { "Uniform", "Gaussian Clusters", "Power-Law Sizes", "Grid Tiles", "Text Runs" };
+const char* distribution_cli_names[DIST_COUNT] = { "uniform", "gaussian", "powerlaw", "grid", "text" };
+
+inline InstanceData make_instance(const glm::vec3& position, const glm::vec2& size, const glm::vec4& color) {
+    return InstanceData{
+        glm::vec4(position, 0.5f * glm::length(size)), // 包围球半径 = 半对角线
+        size,
+        pack_unorm4x8(color),
+        0
+    };
+}
+
+void generate_instances(InstanceDistribution dist, uint32_t seed, std::vector<InstanceData>& out) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_real_distribution<float> pos_dist(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> size_dist(0.002f, 0.008f);
+    std::uniform_real_distribution<float> color_dist(0.1f, 1.0f);
+    auto random_color = [&]() { return glm::vec4(color_dist(rng), color_dist(rng), color_dist(rng), 1.0f); };
+    const int count = (int)out.size();
+
+    switch (dist) {
+    case DIST_UNIFORM:
+    default:
+        for (auto& inst : out) {
+            glm::vec3 position(pos_dist(rng), pos_dist(rng), pos_dist(rng));
+            glm::vec2 size(size_dist(rng), size_dist(rng));
+            inst = make_instance(position, size, random_color());
+        }
+        break;
+
+    case DIST_GAUSSIAN_CLUSTERS: {
+        // 簇权重按1/k^1.5衰减: 头几个簇吃掉大部分实例
+        const int cluster_count = 64;
+        std::vector<glm::vec3> centers(cluster_count);
+        std::vector<float> sigmas(cluster_count), weights(cluster_count);
+        for (int k = 0; k < cluster_count; ++k) {
+            centers[k] = glm::vec3(pos_dist(rng), pos_dist(rng), pos_dist(rng)) * 0.9f;
+            sigmas[k] = 0.01f + 0.09f * unit(rng);
+            weights[k] = 1.0f / std::pow((float)(k + 1), 1.5f);
+        }
+        std::discrete_distribution<int> pick(weights.begin(), weights.end());
+        std::normal_distribution<float> normal(0.0f, 1.0f);
+        for (auto& inst : out) {
+            int k = pick(rng);
+            glm::vec3 position = glm::clamp(centers[k] + glm::vec3(normal(rng), normal(rng), normal(rng)) * sigmas[k], -1.0f, 1.0f);
+            glm::vec2 size(size_dist(rng), size_dist(rng));
+            inst = make_instance(position, size, random_color());
+        }
+        break;
+    }
+
+    case DIST_POWER_LAW_SIZES:
+        // Pareto(alpha = 2.5), 最小0.002, 截断到0.2
+        for (auto& inst : out) {
+            glm::vec3 position(pos_dist(rng), pos_dist(rng), pos_dist(rng));
+            float scale = std::min(0.002f * std::pow(1.0f - unit(rng), -1.0f / 2.5f), 0.2f);
+            glm::vec2 size = scale * glm::vec2(0.5f + unit(rng), 0.5f + unit(rng));
+            inst = make_instance(position, size, random_color());
+        }
+        break;
+
+    case DIST_GRID_TILES: {
+        // 每层一个正方形网格, 按行优先铺满再铺下一层
+        const int layers = 8;
+        int side = std::max(1, (int)std::ceil(std::sqrt((float)count / layers)));
+        float cell = 2.0f / side;
+        for (int i = 0; i < count; ++i) {
+            int layer = i / (side * side);
+            int cell_index = i % (side * side);
+            glm::vec3 position(-1.0f + (cell_index % side + 0.5f) * cell,
+                               -1.0f + (cell_index / side + 0.5f) * cell,
+                               -1.0f + (layer + 0.5f) * (2.0f / layers));
+            float shade = 0.3f + 0.7f * (float)(layer + 1) / layers;
+            out[i] = make_instance(position, glm::vec2(cell * 0.95f), glm::vec4(shade * 0.6f, shade * 0.8f, shade, 1.0f));
+        }
+        // 只画前element_count个时也要覆盖整个网格, 而不是只有最下面几行
+        std::shuffle(out.begin(), out.end(), rng);
+        break;
+    }
+
+    case DIST_TEXT_RUNS: {
+        // 段落 -> 行 -> 单词 -> 字形; 字形紧挨着排, 每行一个颜色
+        const glm::vec2 glyph(0.004f, 0.006f);
+        const float advance = glyph.x * 1.1f;
+        const float line_height = glyph.y * 1.5f;
+        std::uniform_int_distribution<int> word_length(1, 10);
+        std::uniform_int_distribution<int> words_per_line(3, 14);
+        std::uniform_int_distribution<int> lines_per_paragraph(4, 40);
+        int i = 0;
+        while (i < count) {
+            glm::vec2 origin(pos_dist(rng) * 0.9f, pos_dist(rng) * 0.9f);
+            float z = pos_dist(rng);
+            int lines = lines_per_paragraph(rng);
+            for (int line = 0; line < lines && i < count; ++line) {
+                glm::vec4 color = random_color();
+                float x = origin.x;
+                float y = origin.y - line * line_height;
+                int words = words_per_line(rng);
+                for (int w = 0; w < words && i < count; ++w) {
+                    int glyphs = word_length(rng);
+                    for (int g = 0; g < glyphs && i < count; ++g) {
+                        out[i++] = make_instance(glm::vec3(x, y, z), glyph * glm::vec2(0.8f + 0.2f * unit(rng), 1.0f), color);
+                        x += advance;
+                    }
+                    x += advance; // 空格
+                }
+            }
+        }
+        break;
+    }
+    }
+}
+
+// --- 异步帧捕获 ---
+// 同步glReadPixels会让CPU等GPU画完, 直接把要测的帧时间搞乱.
+// 这里用一个PBO环 + fence: 第N帧把像素异步拷进PBO, 到第N+3帧再映射回读,
+// 压缩/写盘丢给后台线程, 录整段视频也不影响主循环.
+
+// 极简PNG编码: 固定Huffman的deflate + 单候选哈希LZ77, 不依赖zlib.
+// 对UI和大片纯色背景压缩率足够, 目标是写盘快而不是压到最小.
+namespace png_writer {
+
+inline uint32_t crc32(const uint8_t* data, size_t len, uint32_t crc = 0) {
+    static uint32_t table[256];
+    static bool table_ready = false;
+    if (!table_ready) {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        table_ready = true;
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+struct BitWriter {
+    std::vector<uint8_t>& out;
+    uint32_t bit_buf = 0;
+    int bit_count = 0;
+    // deflate的比特流是LSB优先
+    void put_bits(uint32_t value, int count) {
+        bit_buf |= value << bit_count;
+        bit_count += count;
+        while (bit_count >= 8) { out.push_back(bit_buf & 0xFF); bit_buf >>= 8; bit_count -= 8; }
+    }
+    // Huffman码要按MSB优先写, 所以先翻转
+    void put_code(uint32_t code, int len) {
+        uint32_t rev = 0;
+        for (int i = 0; i < len; ++i) { rev = (rev << 1) | (code & 1); code >>= 1; }
+        put_bits(rev, len);
+    }
+    void flush() { if (bit_count > 0) { out.push_back(bit_buf & 0xFF); bit_buf = 0; bit_count = 0; } }
+};
+
+inline void put_literal(BitWriter& bw, int v) {
+    if (v < 144)      bw.put_code(0x30 + v, 8);
+    else if (v < 256) bw.put_code(0x190 + (v - 144), 9);
+    else if (v < 280) bw.put_code(v - 256, 7);
+    else              bw.put_code(0xC0 + (v - 280), 8);
+}
+
+inline void put_match(BitWriter& bw, int length, int distance) {
+    static const int len_base[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+    static const int len_extra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+    static const int dist_base[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+    static const int dist_extra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+    int li = 28;
+    while (len_base[li] > length) --li;
+    put_literal(bw, 257 + li);
+    bw.put_bits(length - len_base[li], len_extra[li]);
+    int di = 29;
+    while (dist_base[di] > distance) --di;
+    bw.put_code(di, 5);
+    bw.put_bits(distance - dist_base[di], dist_extra[di]);
+}
+
+inline std::vector<uint8_t> zlib_compress(const std::vector<uint8_t>& src) {
+    std::vector<uint8_t> out = { 0x78, 0x01 };
+    BitWriter bw{ out };
+    bw.put_bits(1, 1); // BFINAL
+    bw.put_bits(1, 2); // BTYPE = 01, 固定Huffman
+
+    const int HASH_BITS = 15, WINDOW = 32768, MAX_MATCH = 258;
+    std::vector<int> head(1 << HASH_BITS, -1);
+    auto hash3 = [&](size_t i) { return ((src[i] << 10) ^ (src[i + 1] << 5) ^ src[i + 2]) & ((1 << HASH_BITS) - 1); };
+
+    size_t i = 0, n = src.size();
+    while (i < n) {
+        int best_len = 0;
+        if (i + 3 <= n) {
+            int h = hash3(i);
+            int cand = head[h];
+            head[h] = (int)i;
+            if (cand >= 0 && i - cand <= WINDOW) {
+                size_t max_len = std::min<size_t>(MAX_MATCH, n - i);
+                size_t len = 0;
+                while (len < max_len && src[cand + len] == src[i + len]) ++len;
+                if (len >= 3) {
+                    best_len = (int)len;
+                    put_match(bw, best_len, (int)(i - cand));
+                    // 匹配内部也插入哈希, 长串纯色时下一次还能接上
+                    for (size_t k = i + 1; k < i + len && k + 3 <= n; ++k) head[hash3(k)] = (int)k;
+                }
+            }
+        }
+        if (best_len == 0) { put_literal(bw, src[i]); i += 1; }
+        else               { i += best_len; }
+    }
+    put_literal(bw, 256); // 块结束
+    bw.flush();
+
+    uint32_t a = 1, b = 0;
+    for (uint8_t c : src) { a = (a + c) % 65521; b = (b + a) % 65521; }
+    uint32_t adler = (b << 16) | a;
+    for (int s = 24; s >= 0; s -= 8) out.push_back((adler >> s) & 0xFF);
+    return out;
+}
+
+// rgba为GL的自下而上行序, 写出时翻转; 只保留RGB
+inline bool write_png(const std::string& path, int width, int height, const std::vector<uint8_t>& rgba) {
+    std::vector<uint8_t> filtered;
+    filtered.reserve((size_t)height * (width * 3 + 1));
+    for (int y = height - 1; y >= 0; --y) {
+        const uint8_t* row = rgba.data() + (size_t)y * width * 4;
+        filtered.push_back(1); // Sub滤波: 与左侧像素做差, 纯色区域全变0
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                uint8_t left = x > 0 ? row[(x - 1) * 4 + c] : 0;
+                filtered.push_back(row[x * 4 + c] - left);
+            }
+        }
+    }
+    std::vector<uint8_t> idat = zlib_compress(filtered);
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    auto put_u32 = [](std::vector<uint8_t>& v, uint32_t x) { for (int s = 24; s >= 0; s -= 8) v.push_back((x >> s) & 0xFF); };
+    auto write_chunk = [&](const char* type, const std::vector<uint8_t>& data) {
+        std::vector<uint8_t> chunk;
+        put_u32(chunk, (uint32_t)data.size());
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        put_u32(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+        fwrite(chunk.data(), 1, chunk.size(), f);
+    };
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(signature, 1, 8, f);
+    std::vector<uint8_t> ihdr;
+    put_u32(ihdr, width);
+    put_u32(ihdr, height);
+    ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 }); // 8bit, RGB, deflate, 无隔行
+    write_chunk("IHDR", ihdr);
+    write_chunk("IDAT", idat);
+    write_chunk("IEND", {});
+    bool ok = !ferror(f);
+    return fclose(f) == 0 && ok;
+}
+
+} // namespace png_writer
+
+struct FrameCapture {
+    enum Format { FORMAT_PNG = 0, FORMAT_PPM = 1 };
+    static const int RING_SIZE = 3;        // 第N帧发起, 第N+3帧回读
+    static const size_t MAX_QUEUED_JOBS = 32; // 写盘跟不上时直接丢帧, 不让内存无限涨
+
+    struct Slot {
+        GLuint pbo = 0;
+        GLsync fence = nullptr;
+        int width = 0, height = 0;
+        int frame_index = -1;
+        Format format = FORMAT_PNG;
+    };
+    struct Job {
+        std::vector<uint8_t> pixels;
+        int width, height, frame_index;
+        Format format;
+    };
+
+    Slot slots[RING_SIZE];
+    int ring_head = 0;
+    std::string output_prefix = "capture_";
+    Format format = FORMAT_PNG;
+    bool recording = false;
+    bool single_shot = false;
+
+    // 统计
+    std::atomic<int> frames_written{ 0 }; // 只由写盘线程修改
+    std::atomic<int> frames_failed{ 0 };  // 打不开或写不完的文件, 同上
+    int frames_dropped = 0;
+    int readback_stalls = 0;  // N+3帧时fence还没完成, 只能等
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Job> jobs;
+    bool quitting = false;
+
+    void init() {
+        for (Slot& s : slots) {
+            glGenBuffers(1, &s.pbo);
+            gpu_memory.track(GpuMemoryRegistry::BUFFER, s.pbo, "Capture", "PBO ring", 0); // 第一次抓帧时才分配
+        }
+        writer = std::thread([this] { writer_loop(); });
+    }
+
+    // 在场景画完、UI画之前调用
+    void on_frame(int frame_index, int width, int height) {
+        Slot& slot = slots[ring_head];
+        if (slot.fence) harvest(slot, true);
+
+        if (recording || single_shot) {
+            single_shot = false;
+            size_t bytes = (size_t)width * height * 4;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+            if (slot.width != width || slot.height != height) {
+                glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+                gpu_memory.resize(GpuMemoryRegistry::BUFFER, slot.pbo, bytes);
+                slot.width = width;
+                slot.height = height;
+            }
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            slot.frame_index = frame_index;
+            slot.format = format;
+        }
+        ring_head = (ring_head + 1) % RING_SIZE;
+    }
+
+    int in_flight() const {
+        int n = 0;
+        for (const Slot& s : slots) n += s.fence ? 1 : 0;
+        return n;
+    }
+
+    size_t queued() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return jobs.size();
+    }
+
+    void shutdown() {
+        for (int i = 0; i < RING_SIZE; ++i) {
+            Slot& slot = slots[(ring_head + i) % RING_SIZE];
+            if (slot.fence) harvest(slot, false);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quitting = true;
+        }
+        cv.notify_one();
+        if (writer.joinable()) writer.join();
+        for (Slot& s : slots) {
+            gpu_memory.forget(GpuMemoryRegistry::BUFFER, s.pbo);
+            glDeleteBuffers(1, &s.pbo);
+        }
+    }
+
+private:
+    void harvest(Slot& slot, bool count_stall) {
+        // 正常情况下三帧前的拷贝早就完成了, 这里只是兜底
+        GLenum status = glClientWaitSync(slot.fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            if (count_stall) readback_stalls++;
+            glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, ~0ull);
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+
+        bool drop;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            drop = jobs.size() >= MAX_QUEUED_JOBS;
+        }
+        if (drop) { frames_dropped++; return; }
+
+        Job job{ {}, slot.width, slot.height, slot.frame_index, slot.format };
+        size_t bytes = (size_t)slot.width * slot.height * 4;
+        job.pixels.resize(bytes);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        void* ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+        if (ptr) {
+            memcpy(job.pixels.data(), ptr, bytes);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!ptr) { frames_dropped++; return; }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        cv.notify_one();
+    }
+
+    void writer_loop() {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return quitting || !jobs.empty(); });
+                if (jobs.empty()) return; // quitting且已清空
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            char name[64];
+            bool ok = false;
+            if (job.format == FORMAT_PNG) {
+                snprintf(name, sizeof(name), "%06d.png", job.frame_index);
+                ok = png_writer::write_png(output_prefix + name, job.width, job.height, job.pixels);
+            } else {
+                snprintf(name, sizeof(name), "%06d.ppm", job.frame_index);
+                FILE* f = fopen((output_prefix + name).c_str(), "wb");
+                if (f) {
+                    fprintf(f, "P6\n%d %d\n255\n", job.width, job.height);
+                    std::vector<uint8_t> row(job.width * 3);
+                    for (int y = job.height - 1; y >= 0; --y) {
+                        const uint8_t* src = job.pixels.data() + (size_t)y * job.width * 4;
+                        for (int x = 0; x < job.width; ++x) {
+                            row[x * 3 + 0] = src[x * 4 + 0];
+                            row[x * 3 + 1] = src[x * 4 + 1];
+                            row[x * 3 + 2] = src[x * 4 + 2];
+                        }
+                        fwrite(row.data(), 1, row.size(), f);
+                    }
+                    ok = !ferror(f);
+                    ok = fclose(f) == 0 && ok;
+                }
+            }
+            if (ok) frames_written++;
+            else frames_failed++;
+        }
+    }
+};
+
+// --- 实例缓冲的存储 ---
+// 有GL_ARB_sparse_buffer时instance_ssbo只是一段MAX_ELEMENTS大小的虚拟地址, 实际用到的范围才按稀疏页提交:
+// 静态场景是前element_count个, 动态模式是槽位可能到的上界, 分页模式是用过的池槽. 没有扩展就整块分配.
+#ifndef GL_SPARSE_STORAGE_BIT_ARB
+#define GL_SPARSE_STORAGE_BIT_ARB 0x0400
+#define GL_SPARSE_BUFFER_PAGE_SIZE_ARB 0x82F8
+#endif
+typedef void (APIENTRYP BufferPageCommitmentProc)(GLenum target, GLintptr offset, GLsizeiptr size, GLboolean commit);
+
+struct InstanceStorage {
+    GLuint buffer = 0;
+    bool sparse = false;
+    GLsizeiptr reserved_bytes = 0;
+    GLsizeiptr page_bytes = 0;
+    std::vector<uint8_t> committed; // 每个稀疏页是否已提交
+    int committed_pages = 0;
+    int commit_calls = 0;           // 累计提交/释放调用次数
+    BufferPageCommitmentProc page_commitment = nullptr;
+
+    // 稀疏时先什么都不提交, 由调用方ensure之后再上传
+    void init(bool allow_sparse, const InstanceData* initial) {
+        glGenBuffers(1, &buffer);
+        // 实例缓冲走GL_COPY_WRITE_BUFFER分配/上传, 3.3上也合法 (那里它是纹理缓冲的存储)
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        GLint page_size = 0;
+        if (allow_sparse) {
+            page_commitment = (BufferPageCommitmentProc)glfwGetProcAddress("glBufferPageCommitmentARB");
+            glGetIntegerv(GL_SPARSE_BUFFER_PAGE_SIZE_ARB, &page_size);
+        }
+        sparse = page_commitment && page_size > 0;
+        if (!sparse) {
+            reserved_bytes = page_bytes = MAX_ELEMENTS * sizeof(InstanceData);
+            glBufferData(GL_COPY_WRITE_BUFFER, reserved_bytes, initial, GL_DYNAMIC_DRAW);
+            gpu_memory.track(GpuMemoryRegistry::BUFFER, buffer, "Scene", "instance_ssbo", reserved_bytes);
+            committed.assign(1, 1);
+            committed_pages = 1;
+            return;
+        }
+        page_bytes = page_size;
+        reserved_bytes = (MAX_ELEMENTS * sizeof(InstanceData) + page_bytes - 1) / page_bytes * page_bytes;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, reserved_bytes, nullptr, GL_SPARSE_STORAGE_BIT_ARB | GL_DYNAMIC_STORAGE_BIT);
+        gpu_memory.track(GpuMemoryRegistry::BUFFER, buffer, "Scene", "instance_ssbo (sparse, committed)", 0);
+        committed.assign(reserved_bytes / page_bytes, 0);
+    }
+
+    GLsizeiptr committed_bytes() const { return committed_pages * page_bytes; }
+
+    // 实例[first, first + count)所在的页都提交; 连续的一段未提交页一次调用
+    void ensure(GLuint first, GLuint count) {
+        if (!sparse || count == 0) return;
+        set_range(first * sizeof(InstanceData) / page_bytes,
+                  ((GLsizeiptr)(first + count) * sizeof(InstanceData) + page_bytes - 1) / page_bytes, 1);
+    }
+
+    // end之后的实例不再用: 释放完全落在后面的页
+    void release_from(GLuint end) {
+        if (!sparse) return;
+        set_range(((GLsizeiptr)end * sizeof(InstanceData) + page_bytes - 1) / page_bytes, (GLsizeiptr)committed.size(), 0);
+    }
+
+    void shutdown() {
+        gpu_memory.forget(GpuMemoryRegistry::BUFFER, buffer);
+        if (buffer) glDeleteBuffers(1, &buffer);
+    }
+
+private:
+    void set_range(GLsizeiptr first_page, GLsizeiptr end_page, uint8_t commit) {
+        end_page = std::min(end_page, (GLsizeiptr)committed.size());
+        bool bound = false;
+        for (GLsizeiptr page = first_page; page < end_page;) {
+            if (committed[page] == commit) {
+                ++page;
+                continue;
+            }
+            GLsizeiptr run_end = page;
+            while (run_end < end_page && committed[run_end] != commit) committed[run_end++] = commit;
+            if (!bound) glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            bound = true;
+            page_commitment(GL_COPY_WRITE_BUFFER, page * page_bytes, (run_end - page) * page_bytes, commit);
+            committed_pages += commit ? (int)(run_end - page) : -(int)(run_end - page);
+            commit_calls++;
+            page = run_end;
+        }
+        if (bound) gpu_memory.resize(GpuMemoryRegistry::BUFFER, buffer, committed_bytes());
+    }
+};
+
+// --- 后台上传 ---
+// 大块上传 (换场景时整份分簇后的实例) 交给一个共享上下文的工作线程: 它先在CPU上准备数据,
+// 再分块拷进持久映射的暂存环, 用glCopyBufferSubData拷到目标缓冲, 最后放一个fence并flush.
+// 渲染线程只在要用结果时用0超时查一下这个fence, 没完成就接着画, 不会在上传上卡住.
+// 暂存环的每一块带一个fence, 块被GPU用完之前工作线程自己等, 和渲染线程无关.
+// 目标缓冲不能是正在画的那个 (两个上下文之间没有顺序), 由调用方在完成后自己拷过去
+struct AsyncUploader {
+    static constexpr GLsizeiptr CHUNK_BYTES = 4 << 20;
+    static const int CHUNK_COUNT = 4;
+    // 在工作线程上调用, 返回要上传的数据和字节数; 数据要活到poll返回true
+    typedef std::function<std::pair<const void*, GLsizeiptr>()> PrepareFn;
+    struct Job {
+        int ticket;
+        PrepareFn prepare;
+        GLuint dst;
+        GLintptr dst_offset;
+        GLsync wait_before; // 写dst之前GPU上要等的fence (渲染线程最后一次读dst), 工作线程负责删除
+    };
+    struct Done {
+        int ticket;
+        GLsync fence;
+        float worker_ms;
+        GLsizeiptr bytes;
+    };
+    GLFWwindow* context_window = nullptr; // 隐藏的1x1窗口, 只为了一个共享上下文
+    GLuint staging = 0;
+    uint8_t* mapped = nullptr;
+    GLsync chunk_fences[CHUNK_COUNT] = {}; // 只由工作线程使用
+    bool active = false;
+    int next_ticket = 0;
+    // 最近完成的一次
+    float last_worker_ms = 0.0f;
+    GLsizeiptr last_bytes = 0;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Job> jobs;
+    std::deque<Done> done;
+    bool quitting = false;
+
+    // 主线程上调用 (GLFW的窗口只能在主线程创建); 需要glBufferStorage (4.4)
+    bool init(GLFWwindow* share) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        context_window = glfwCreateWindow(1, 1, "upload", NULL, share);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+        if (!context_window) return false;
+
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        const GLsizeiptr bytes = CHUNK_BYTES * CHUNK_COUNT;
+        glGenBuffers(1, &staging);
+        glBindBuffer(GL_COPY_READ_BUFFER, staging);
+        glBufferStorage(GL_COPY_READ_BUFFER, bytes, nullptr, flags);
+        gpu_memory.track(GpuMemoryRegistry::BUFFER, staging, "Upload", "persistent staging ring", bytes);
+        mapped = (uint8_t*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, bytes, flags);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        if (!mapped) return false;
+        worker = std::thread([this] { worker_loop(); });
+        active = true;
+        return true;
+    }
+
+    int submit(PrepareFn prepare, GLuint dst, GLintptr dst_offset, GLsync wait_before) {
+        int ticket = next_ticket++;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back({ ticket, std::move(prepare), dst, dst_offset, wait_before });
+        }
+        cv.notify_one();
+        return ticket;
+    }
+
+    // 渲染线程: 拷贝在GPU上执行完了才返回true, 从不阻塞
+    bool poll(int ticket) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = done.begin(); it != done.end(); ++it) {
+            if (it->ticket != ticket) continue;
+            if (glClientWaitSync(it->fence, 0, 0) == GL_TIMEOUT_EXPIRED) return false;
+            glDeleteSync(it->fence);
+            last_worker_ms = it->worker_ms;
+            last_bytes = it->bytes;
+            done.erase(it);
+            return true;
+        }
+        return false;
+    }
+
+    void shutdown() {
+        if (active) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quitting = true;
+            }
+            cv.notify_one();
+            if (worker.joinable()) worker.join();
+            for (Done& d : done) glDeleteSync(d.fence);
+            done.clear();
+        }
+        if (staging) {
+            glBindBuffer(GL_COPY_READ_BUFFER, staging);
+            if (mapped) glUnmapBuffer(GL_COPY_READ_BUFFER);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            gpu_memory.forget(GpuMemoryRegistry::BUFFER, staging);
+            glDeleteBuffers(1, &staging);
+        }
+        if (context_window) glfwDestroyWindow(context_window);
+        active = false;
+    }
+
+private:
+    void worker_loop() {
+        glfwMakeContextCurrent(context_window);
+        int chunk_head = 0;
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return quitting || !jobs.empty(); });
+                if (jobs.empty()) break; // quitting
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            double start = glfwGetTime();
+            std::pair<const void*, GLsizeiptr> source = job.prepare();
+            const uint8_t* src = (const uint8_t*)source.first;
+            if (job.wait_before) {
+                glWaitSync(job.wait_before, 0, GL_TIMEOUT_IGNORED);
+                glDeleteSync(job.wait_before);
+            }
+            glBindBuffer(GL_COPY_READ_BUFFER, staging);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, job.dst);
+            for (GLsizeiptr offset = 0; offset < source.second; offset += CHUNK_BYTES) {
+                GLsizeiptr n = std::min(CHUNK_BYTES, source.second - offset);
+                GLsync& chunk_fence = chunk_fences[chunk_head];
+                if (chunk_fence) {
+                    glClientWaitSync(chunk_fence, GL_SYNC_FLUSH_COMMANDS_BIT, ~0ull);
+                    glDeleteSync(chunk_fence);
+                }
+                memcpy(mapped + chunk_head * CHUNK_BYTES, src + offset, n);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, chunk_head * CHUNK_BYTES, job.dst_offset + offset, n);
+                chunk_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                chunk_head = (chunk_head + 1) % CHUNK_COUNT;
+            }
+            GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush(); // 别的上下文要等这个fence, 必须先提交
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.push_back({ job.ticket, fence, (float)((glfwGetTime() - start) * 1000.0), source.second });
+            }
+        }
+        for (GLsync& f : chunk_fences) {
+            if (f) glDeleteSync(f);
+            f = nullptr;
+        }
+        glfwMakeContextCurrent(NULL);
+    }
+};
+
+// --- 分页实例 (out-of-core) ---
+// 数据集比显存大时不能一次传完. 世界按xy网格切成页, 每页在磁盘上是一段连续的InstanceData (或一个压缩页);
+// instance_ssbo当页池, 按page_capacity切成槽. 页同时就是LOD簇: cluster_lod_cs发现视锥里要逐个画
+// 的页不在池里时写LOD_REQUESTED并先画占位impostor, CPU隔几帧回读这份状态当作请求,
+// 后台线程读盘, 渲染线程每帧最多上传几页, 池满了按LRU换出最久没逐个画过的页.
+const GLuint LOD_INSTANCES = 1; // 与GLSL一致
+const GLuint LOD_REQUESTED = 3; // 与GLSL一致
+const GLuint PAGE_NOT_RESIDENT = 0xFFFFFFFFu; // 与GLSL一致
+
+const char PAGE_MAGIC_RAW[8] = { 'G', 'P', 'A', 'G', 'E', 'S', '0', '1' };    // 页数据是InstanceData
+const char PAGE_MAGIC_PACKED[8] = { 'G', 'P', 'A', 'G', 'E', 'S', 'Z', '1' }; // 页数据是压缩页, 见encode_packed_page
+
+struct PageFileHeader {
+    char magic[8];          // PAGE_MAGIC_RAW / PAGE_MAGIC_PACKED
+    uint32_t grid;          // grid x grid页
+    uint32_t page_capacity; // 每页最多多少个实例
+    float page_size;        // 页的世界边长
+    uint32_t page_count;
+    uint64_t total_instances;
+};
+
+// 页表项: 页不在池里时, LOD和占位只要这些
+struct PageRecord {
+    uint64_t offset;          // 页数据在文件里的位置
+    uint32_t count;
+    uint32_t bytes;           // 页数据在文件里的字节数 (4的倍数)
+    glm::vec4 bounds;         // 包围球, 与cluster_bounds一致
+    InstanceData placeholder; // 和cluster_reduce_cs的impostor同样的算法
+};
+static_assert(sizeof(PageRecord) == 64, "PageRecord is written to disk as-is");
+
+// 页文件可能超过2GB, fseek的long在Windows上只有32位
+inline int seek_file(FILE* f, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+// --- 压缩页 ---
+// 页内实例按量化坐标的Morton序排好, 每PACKED_BLOCK_SIZE个一块. 坐标每轴量化到16位 (相对页的包围盒),
+// 块内对前一个实例做差分, zigzag后按块内最大位宽打包; 尺寸每轴8位, 颜色是页内调色板的下标.
+// page_decode_cs一个工作组解一块, 解出的InstanceData和make_instance的一样 (半径由尺寸算出).
+const int PACKED_BLOCK_SIZE = 64; // 与GLSL一致
+
+// 压缩页开头, 后面的偏移都以字计, 相对页头 (与page_decode_cs一致)
+struct PackedPageHeader {
+    glm::vec4 origin;   // xyz: 量化坐标0的位置
+    glm::vec4 step;     // xyz: 一个量化单位的长度
+    glm::vec4 size_min_step; // xy: 最小尺寸, zw: 尺寸量化步长
+    uint32_t count;
+    uint32_t palette_bits;
+    uint32_t block_offset;   // 每块4个字: 锚点xy, 锚点z + 三轴位宽, 差分流里的起始位, 0
+    uint32_t delta_offset;
+    uint32_t size_offset;
+    uint32_t color_offset;
+    uint32_t palette_offset;
+    uint32_t pad;
+};
+static_assert(sizeof(PackedPageHeader) == 80, "PackedPageHeader is read by page_decode_cs as words");
+
+inline uint64_t morton_expand_16(uint64_t v) {
+    v = (v | (v << 16)) & 0x0000FF0000FFull;
+    v = (v | (v << 8)) & 0x00F00F00F00Full;
+    v = (v | (v << 4)) & 0x0C30C30C30C3ull;
+    v = (v | (v << 2)) & 0x249249249249ull;
+    return v;
+}
+
+inline int bit_width(uint32_t v) {
+    int bits = 0;
+    while (v >> bits) ++bits;
+    return bits;
+}
+
+// 比特流按字存, 多补一个字, 着色器跨字读时不越界
+inline void append_bit_stream(std::vector<uint8_t>& bytes, std::vector<uint32_t>& out) {
+    bytes.resize((bytes.size() + 3) / 4 * 4 + 4, 0);
+    size_t first = out.size();
+    out.resize(first + bytes.size() / 4);
+    memcpy(out.data() + first, bytes.data(), bytes.size());
+}
+
+inline void encode_packed_page(const InstanceData* instances, int count, std::vector<uint32_t>& out) {
+    glm::vec3 pmin(1e30f), pmax(-1e30f);
+    glm::vec2 smin(1e30f), smax(-1e30f);
+    for (int i = 0; i < count; ++i) {
+        pmin = glm::min(pmin, glm::vec3(instances[i].position_radius));
+        pmax = glm::max(pmax, glm::vec3(instances[i].position_radius));
+        smin = glm::min(smin, instances[i].size);
+        smax = glm::max(smax, instances[i].size);
+    }
+    glm::vec3 step = glm::max(pmax - pmin, glm::vec3(1e-12f)) / 65535.0f;
+    glm::vec2 size_step = (smax - smin) / 255.0f;
+
+    std::vector<glm::uvec3> q(count);
+    std::vector<std::pair<uint64_t, int>> order(count);
+    for (int i = 0; i < count; ++i) {
+        glm::vec3 t = glm::round((glm::vec3(instances[i].position_radius) - pmin) / step);
+        q[i] = glm::uvec3(glm::clamp(t, glm::vec3(0.0f), glm::vec3(65535.0f)));
+        order[i] = { (morton_expand_16(q[i].x) << 2) | (morton_expand_16(q[i].y) << 1) | morton_expand_16(q[i].z), i };
+    }
+    std::sort(order.begin(), order.end());
+
+    // 调色板: 颜色按RGB各4位分桶, 桶内取平均; 超过256桶就改成3-3-2位, 一定放得下
+    std::vector<uint32_t> bucket_of(count);
+    std::map<uint32_t, uint32_t> palette_index;
+    for (int coarse = 0; coarse < 2; ++coarse) {
+        palette_index.clear();
+        for (int i = 0; i < count; ++i) {
+            uint32_t c = instances[i].color;
+            uint32_t r = c & 0xFF, g = (c >> 8) & 0xFF, b = (c >> 16) & 0xFF;
+            bucket_of[i] = coarse ? ((r >> 5) << 5) | ((g >> 5) << 2) | (b >> 6) : ((r >> 4) << 8) | ((g >> 4) << 4) | (b >> 4);
+            palette_index.emplace(bucket_of[i], 0);
+        }
+        if (palette_index.size() <= 256) break;
+    }
+    uint32_t next_index = 0;
+    for (auto& entry : palette_index) entry.second = next_index++;
+    std::vector<glm::dvec4> palette_sum(palette_index.size(), glm::dvec4(0.0));
+    std::vector<int> palette_count(palette_index.size(), 0);
+    for (int i = 0; i < count; ++i) {
+        uint32_t c = instances[i].color;
+        uint32_t index = palette_index[bucket_of[i]];
+        palette_sum[index] += glm::dvec4(c & 0xFF, (c >> 8) & 0xFF, (c >> 16) & 0xFF, c >> 24);
+        palette_count[index]++;
+    }
+
+    PackedPageHeader header = {};
+    header.origin = glm::vec4(pmin, 0.0f);
+    header.step = glm::vec4(step, 0.0f);
+    header.size_min_step = glm::vec4(smin, size_step);
+    header.count = count;
+    header.palette_bits = bit_width((uint32_t)palette_index.size() - 1);
+    const int block_count = (count + PACKED_BLOCK_SIZE - 1) / PACKED_BLOCK_SIZE;
+
+    // 差分: 每块第一个实例就是锚点, 差分为0
+    std::vector<uint32_t> blocks(block_count * 4, 0);
+    std::vector<uint8_t> delta_bytes, size_bytes, color_bytes;
+    png_writer::BitWriter deltas{ delta_bytes }, sizes{ size_bytes }, colors{ color_bytes };
+    uint32_t delta_bit = 0;
+    for (int block = 0; block < block_count; ++block) {
+        int first = block * PACKED_BLOCK_SIZE, last = std::min(count, first + PACKED_BLOCK_SIZE);
+        std::vector<glm::uvec3> zigzag(last - first, glm::uvec3(0));
+        glm::uvec3 widest(0);
+        for (int i = first + 1; i < last; ++i) {
+            glm::ivec3 d = glm::ivec3(q[order[i].second]) - glm::ivec3(q[order[i - 1].second]);
+            zigzag[i - first] = glm::uvec3((d << 1) ^ (d >> 31));
+            widest = glm::max(widest, zigzag[i - first]);
+        }
+        glm::uvec3 bits(bit_width(widest.x), bit_width(widest.y), bit_width(widest.z));
+        const glm::uvec3& anchor = q[order[first].second];
+        blocks[block * 4 + 0] = anchor.x | (anchor.y << 16);
+        blocks[block * 4 + 1] = anchor.z | (bits.x << 16) | (bits.y << 21) | (bits.z << 26);
+        blocks[block * 4 + 2] = delta_bit;
+        for (const glm::uvec3& z : zigzag) {
+            deltas.put_bits(z.x, bits.x);
+            deltas.put_bits(z.y, bits.y);
+            deltas.put_bits(z.z, bits.z);
+        }
+        delta_bit += (last - first) * (bits.x + bits.y + bits.z);
+    }
+    for (int i = 0; i < count; ++i) {
+        const InstanceData& inst = instances[order[i].second];
+        glm::vec2 t = size_step.x > 0.0f || size_step.y > 0.0f
+            ? glm::round((inst.size - smin) / glm::max(size_step, glm::vec2(1e-12f))) : glm::vec2(0.0f);
+        glm::uvec2 s(glm::clamp(t, glm::vec2(0.0f), glm::vec2(255.0f)));
+        sizes.put_bits(s.x | (s.y << 8), 16);
+        colors.put_bits(palette_index[bucket_of[order[i].second]], header.palette_bits);
+    }
+    deltas.flush();
+    sizes.flush();
+    colors.flush();
+
+    out.assign(sizeof(PackedPageHeader) / 4, 0);
+    header.block_offset = (uint32_t)out.size();
+    out.insert(out.end(), blocks.begin(), blocks.end());
+    header.delta_offset = (uint32_t)out.size();
+    append_bit_stream(delta_bytes, out);
+    header.size_offset = (uint32_t)out.size();
+    append_bit_stream(size_bytes, out);
+    header.color_offset = (uint32_t)out.size();
+    append_bit_stream(color_bytes, out);
+    header.palette_offset = (uint32_t)out.size();
+    for (size_t i = 0; i < palette_sum.size(); ++i) {
+        glm::uvec4 mean(glm::round(palette_sum[i] / (double)palette_count[i]));
+        out.push_back(mean.x | (mean.y << 8) | (mean.z << 16) | (mean.w << 24));
+    }
+    memcpy(out.data(), &header, sizeof(header));
+}
+
+// 逐页生成并写盘, 内存里只有一页. 每页的密度和色调由页号决定, 远看是一块块明暗不同的区域
+// packed时每页按encode_packed_page压缩后写盘
+// 任何一次写失败都删掉写了一半的文件, 免得下次被当成完整的页文件读进来
+inline bool write_page_file(const std::string& path, int grid, int page_capacity, uint32_t seed, bool packed) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    auto fail = [&] {
+        fclose(f);
+        remove(path.c_str());
+        return false;
+    };
+    const int page_count = grid * grid;
+    const float page_size = 0.25f;
+    PageFileHeader header = {};
+    memcpy(header.magic, packed ? PAGE_MAGIC_PACKED : PAGE_MAGIC_RAW, 8);
+    header.grid = grid;
+    header.page_capacity = page_capacity;
+    header.page_size = page_size;
+    header.page_count = page_count;
+    // 先占住表头和页表的位置, 数据写完再回填
+    std::vector<PageRecord> table(page_count);
+    if (fwrite(&header, sizeof(header), 1, f) != 1 || fwrite(table.data(), sizeof(PageRecord), page_count, f) != (size_t)page_count) {
+        return fail();
+    }
+    uint64_t offset = sizeof(header) + (uint64_t)page_count * sizeof(PageRecord);
+
+    std::vector<InstanceData> page(page_capacity);
+    std::vector<uint32_t> packed_page;
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int p = 0; p < page_count; ++p) {
+        std::mt19937 rng(seed * 7919u + p);
+        glm::vec2 lo(((p % grid) - 0.5f * grid) * page_size, ((p / grid) - 0.5f * grid) * page_size);
+        float density = 0.1f + 0.9f * unit(rng) * unit(rng);
+        int count = std::max(1, (int)(page_capacity * density));
+        glm::vec3 tint(0.2f + 0.8f * unit(rng), 0.2f + 0.8f * unit(rng), 0.2f + 0.8f * unit(rng));
+
+        glm::vec3 bmin(1e30f), bmax(-1e30f);
+        glm::vec4 color_area(0.0f);
+        for (int i = 0; i < count; ++i) {
+            glm::vec3 position(lo.x + unit(rng) * page_size, lo.y + unit(rng) * page_size, (unit(rng) - 0.5f) * page_size);
+            glm::vec2 size(0.002f + 0.006f * unit(rng), 0.002f + 0.006f * unit(rng));
+            glm::vec3 color = glm::clamp(tint * (0.7f + 0.6f * unit(rng)), 0.0f, 1.0f);
+            page[i] = make_instance(position, size, glm::vec4(color, 1.0f));
+            page[i].cluster_id = p;
+            glm::vec3 r(page[i].position_radius.w);
+            bmin = glm::min(bmin, position - r);
+            bmax = glm::max(bmax, position + r);
+            color_area += glm::vec4(color * (size.x * size.y), size.x * size.y);
+        }
+        glm::vec3 center = 0.5f * (bmin + bmax);
+        glm::vec3 extent = bmax - bmin;
+        float coverage = glm::clamp(color_area.w / std::max(extent.x * extent.y, 1e-12f), 0.0f, 1.0f);
+        PageRecord& record = table[p];
+        record.offset = offset;
+        record.count = count;
+        record.bounds = glm::vec4(center, 0.5f * glm::length(extent));
+        record.placeholder = { record.bounds, glm::vec2(extent), pack_unorm4x8(glm::vec4(glm::vec3(color_area) / color_area.w, coverage)), (uint32_t)p };
+
+        if (packed) encode_packed_page(page.data(), count, packed_page);
+        const void* data = packed ? (const void*)packed_page.data() : (const void*)page.data();
+        record.bytes = packed ? (uint32_t)(packed_page.size() * sizeof(uint32_t)) : (uint32_t)(count * sizeof(InstanceData));
+        if (fwrite(data, 1, record.bytes, f) != record.bytes) return fail();
+        offset += record.bytes;
+        header.total_instances += count;
+    }
+    if (fseek(f, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, f) != 1
+        || fwrite(table.data(), sizeof(PageRecord), page_count, f) != (size_t)page_count) {
+        return fail();
+    }
+    if (fclose(f) != 0) {
+        remove(path.c_str());
+        return false;
+    }
+    return true;
+}
+
+struct PageStreamer {
+    static const int FEEDBACK_RING = 4;           // 第N帧的页状态最早第N+1帧读, 不等GPU
+    static const int MAX_UPLOADS_PER_FRAME = 8;   // 请求再多, 一帧也只往池里传这么多页
+    static const size_t MAX_QUEUED_REQUESTS = 64; // 读盘线程的队列上限; 排不进的页下次回读再请求
+    enum PageState : uint8_t { PAGE_ABSENT, PAGE_REQUESTED, PAGE_RESIDENT };
+
+    struct Feedback {
+        GLuint buffer = 0;
+        GLsync fence = nullptr;
+        int frame_index = -1;
+    };
+    struct LoadedPage {
+        int page;
+        std::vector<uint32_t> data; // 文件里的页数据 (InstanceData或压缩页); 读失败时为空
+    };
+
+    PageFileHeader header = {};
+    bool packed = false;
+    std::vector<PageRecord> table; // init之后只读, 读盘线程也用
+    std::vector<uint8_t> state;
+    std::vector<int> slot_of_page; // -1: 不在池里
+    std::vector<int> last_used;    // 最后一次逐个画这页的帧 (来自回读)
+    std::vector<int> page_of_slot; // -1: 空槽
+    int newest_feedback = -1;      // 已读到的最新一份回读是哪一帧的
+
+    Feedback feedback[FEEDBACK_RING];
+    int feedback_head = 0;
+
+    // 压缩页: 一帧最多MAX_UPLOADS_PER_FRAME页放进暂存缓冲, 每页一次page_decode_cs解进池里
+    GLuint packed_ssbo = 0;
+    GLuint packed_stride = 0; // 暂存缓冲里每页占多少字 (文件里最大的页)
+    GpuTimer decode_timer;
+    uint64_t decode_bytes[GpuTimer::RING_SIZE] = {}; // 每个查询那次解出的InstanceData字节数
+
+    // 统计
+    int resident_pages = 0, requested_pages = 0;
+    int pages_loaded = 0, pages_evicted = 0, loads_dropped = 0;
+    float upload_ms = 0.0f;                // 这一帧上传进池的CPU时间
+    uint64_t data_bytes = 0;               // 文件里所有页数据的字节数
+    float decode_ms = 0.0f;                // 最近一次读到的解码GPU时间
+    double decode_gb_per_s = 0.0;          // 按解出的InstanceData字节数算
+    std::atomic<uint64_t> bytes_read{ 0 }; // 只由读盘线程修改
+    std::atomic<uint64_t> read_us{ 0 };
+
+    std::string path;
+    std::thread reader;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<int> requests;
+    std::deque<LoadedPage> loaded;
+    bool quitting = false;
+
+    // 页文件不存在时在后台线程生成 (grid x grid页, 要好几秒), 渲染线程每帧poll_generate, 不卡渲染
+    enum GenerateState { GENERATE_IDLE, GENERATE_RUNNING, GENERATE_DONE, GENERATE_FAILED };
+    std::thread generator;
+    std::atomic<int> generate_state{ GENERATE_IDLE };
+
+    void generate_async(const std::string& file_path, int grid, int page_capacity, uint32_t seed, bool packed_format) {
+        generate_state = GENERATE_RUNNING;
+        generator = std::thread([this, file_path, grid, page_capacity, seed, packed_format] {
+            generate_state = write_page_file(file_path, grid, page_capacity, seed, packed_format) ? GENERATE_DONE : GENERATE_FAILED;
+        });
+    }
+
+    // 结束了就回收线程; 返回当前状态
+    int poll_generate() {
+        int s = generate_state.load();
+        if (s != GENERATE_RUNNING && generator.joinable()) generator.join();
+        return s;
+    }
+
+    // 只读表头和页表, 起读盘线程; 文件不存在或不对返回false
+    bool init(const std::string& file_path) {
+        FILE* f = fopen(file_path.c_str(), "rb");
+        if (!f) return false;
+        bool ok = fread(&header, sizeof(header), 1, f) == 1
+            && (!memcmp(header.magic, PAGE_MAGIC_RAW, 8) || !memcmp(header.magic, PAGE_MAGIC_PACKED, 8))
+            && header.page_count > 0 && header.page_count <= (uint32_t)MAX_CLUSTERS
+            && header.page_capacity > 0 && header.page_capacity <= MAX_ELEMENTS;
+        if (ok) {
+            table.resize(header.page_count);
+            ok = fread(table.data(), sizeof(PageRecord), header.page_count, f) == header.page_count;
+        }
+        // 页不能比槽大; 未压缩的页必须正好是count个InstanceData
+        const bool file_packed = !memcmp(header.magic, PAGE_MAGIC_PACKED, 8);
+        for (size_t p = 0; ok && p < table.size(); ++p) {
+            ok = table[p].count <= header.page_capacity && table[p].bytes % sizeof(uint32_t) == 0
+                && (file_packed || table[p].bytes == table[p].count * sizeof(InstanceData));
+        }
+        fclose(f);
+        if (!ok) return false;
+
+        path = file_path;
+        packed = file_packed;
+        page_of_slot.assign(MAX_ELEMENTS / header.page_capacity, -1);
+        for (const PageRecord& record : table) {
+            data_bytes += record.bytes;
+            packed_stride = std::max(packed_stride, record.bytes / (GLuint)sizeof(uint32_t));
+        }
+        if (packed) {
+            packed_ssbo = gpu_memory.create_buffer(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)packed_stride * MAX_UPLOADS_PER_FRAME * sizeof(uint32_t),
+                nullptr, GL_STREAM_DRAW, "Paging", "packed page staging");
+            decode_timer.init();
+        }
+        for (Feedback& fb : feedback) {
+            fb.buffer = gpu_memory.create_buffer(GL_COPY_WRITE_BUFFER, header.page_count * sizeof(GLuint), nullptr, GL_STREAM_READ,
+                "Paging", "residency feedback ring");
+        }
+        reader = std::thread([this] { reader_loop(); });
+        return true;
+    }
+
+    int page_count() const { return (int)header.page_count; }
+    int slot_count() const { return (int)page_of_slot.size(); }
+    double read_mb_per_s() const { return read_us ? bytes_read / (double)read_us : 0.0; }
+    // 展开成InstanceData的字节数 / 文件里页数据的字节数
+    double compression_ratio() const { return data_bytes ? header.total_instances * sizeof(InstanceData) / (double)data_bytes : 0.0; }
+
+    // 进入分页模式: 池是空的, 所有页只有包围球和占位
+    void reset(GLuint cluster_range_ssbo, GLuint cluster_bounds_ssbo, GLuint impostor_ssbo) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.clear();
+            loaded.clear(); // 读盘线程手上那一页回来时状态已经不是REQUESTED, 会被丢掉
+        }
+        state.assign(page_count(), PAGE_ABSENT);
+        slot_of_page.assign(page_count(), -1);
+        last_used.assign(page_count(), -1);
+        std::fill(page_of_slot.begin(), page_of_slot.end(), -1);
+        resident_pages = requested_pages = 0;
+        newest_feedback = -1;
+        for (Feedback& fb : feedback) {
+            if (fb.fence) glDeleteSync(fb.fence);
+            fb.fence = nullptr;
+        }
+
+        std::vector<ClusterRange> ranges(page_count(), ClusterRange{ PAGE_NOT_RESIDENT, 0 });
+        std::vector<glm::vec4> bounds(page_count());
+        std::vector<InstanceData> placeholders(page_count());
+        for (int p = 0; p < page_count(); ++p) {
+            bounds[p] = table[p].bounds;
+            placeholders[p] = table[p].placeholder;
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, cluster_range_ssbo);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, ranges.size() * sizeof(ClusterRange), ranges.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, cluster_bounds_ssbo);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bounds.size() * sizeof(glm::vec4), bounds.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, impostor_ssbo);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, placeholders.size() * sizeof(InstanceData), placeholders.data());
+    }
+
+    // 帧开始时调用, 不等GPU: 已完成的回读里, 逐个画过的页刷新LRU时间, 请求的页按离focus的距离排队读盘
+    void poll_feedback(const glm::vec3& focus) {
+        std::vector<int> wanted;
+        for (int i = 0; i < FEEDBACK_RING; ++i) {
+            Feedback& fb = feedback[(feedback_head + i) % FEEDBACK_RING]; // 从最旧的开始
+            if (!fb.fence || glClientWaitSync(fb.fence, 0, 0) == GL_TIMEOUT_EXPIRED) continue;
+            glDeleteSync(fb.fence);
+            fb.fence = nullptr;
+            glBindBuffer(GL_COPY_READ_BUFFER, fb.buffer);
+            const GLuint* lod = (const GLuint*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, page_count() * sizeof(GLuint), GL_MAP_READ_BIT);
+            if (!lod) continue;
+            for (int p = 0; p < page_count(); ++p) {
+                if (lod[p] == LOD_INSTANCES) {
+                    last_used[p] = std::max(last_used[p], fb.frame_index);
+                } else if (lod[p] == LOD_REQUESTED && state[p] == PAGE_ABSENT) {
+                    state[p] = PAGE_REQUESTED;
+                    wanted.push_back(p);
+                }
+            }
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+            newest_feedback = std::max(newest_feedback, fb.frame_index);
+        }
+        if (wanted.empty()) return;
+
+        auto distance = [&](int p) { return glm::length(glm::vec3(table[p].bounds) - focus); };
+        std::sort(wanted.begin(), wanted.end(), [&](int a, int b) { return distance(a) < distance(b); });
+        // 池里腾不出位置的页先不读, 免得读上来又只能扔掉
+        int room = -requested_pages;
+        for (int s = 0; s < slot_count(); ++s) room += evictable(s) ? 1 : 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int p : wanted) {
+                if (room <= 0 || requests.size() >= MAX_QUEUED_REQUESTS) {
+                    state[p] = PAGE_ABSENT;
+                    continue;
+                }
+                requests.push_back(p);
+                requested_pages++;
+                room--;
+            }
+        }
+        cv.notify_one();
+    }
+
+    // 读好的页传进池: 空槽优先, 否则换出最久没逐个画过的页; 都不行就丢掉这次读取.
+    // 压缩页先传进暂存缓冲, 再用decode_program解进池里的槽. 槽第一次用时才提交
+    void upload(InstanceStorage& instances, GLuint cluster_range_ssbo, GLuint decode_program, int frame_index) {
+        const GLuint instance_ssbo = instances.buffer;
+        double start = glfwGetTime();
+        int decoded = 0, decode_slot = decode_timer.head;
+        for (int n = 0; n < MAX_UPLOADS_PER_FRAME; ++n) {
+            LoadedPage page;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (loaded.empty()) break;
+                page = std::move(loaded.front());
+                loaded.pop_front();
+            }
+            if (state[page.page] != PAGE_REQUESTED) continue; // reset之前发出的请求
+            requested_pages--;
+            int slot = find_slot();
+            if (slot < 0 || page.data.empty()) {
+                state[page.page] = PAGE_ABSENT;
+                loads_dropped++;
+                continue;
+            }
+
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, cluster_range_ssbo);
+            int victim = page_of_slot[slot];
+            if (victim >= 0) {
+                ClusterRange absent = { PAGE_NOT_RESIDENT, 0 };
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, victim * sizeof(ClusterRange), sizeof(ClusterRange), &absent);
+                state[victim] = PAGE_ABSENT;
+                slot_of_page[victim] = -1;
+                resident_pages--;
+                pages_evicted++;
+            }
+            ClusterRange range = { (GLuint)slot * header.page_capacity, table[page.page].count };
+            instances.ensure(range.first, header.page_capacity);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, page.page * sizeof(ClusterRange), sizeof(ClusterRange), &range);
+            if (packed) {
+                if (decoded == 0) {
+                    // 查询环里这个位置上一轮的结果在begin里读出, 和当时记下的字节数配对
+                    bool had_result = decode_timer.issued[decode_slot];
+                    decode_timer.begin();
+                    if (had_result && decode_timer.last_ms > 0.0f) {
+                        decode_ms = decode_timer.last_ms;
+                        decode_gb_per_s = decode_bytes[decode_slot] / (decode_ms * 1.0e6);
+                    }
+                    decode_bytes[decode_slot] = 0;
+                    glUseProgram(decode_program);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, packed_ssbo);
+                }
+                GLuint page_base = decoded * packed_stride;
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, packed_ssbo);
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, page_base * sizeof(uint32_t), page.data.size() * sizeof(uint32_t), page.data.data());
+                glUniform1ui(glGetUniformLocation(decode_program, "page_base"), page_base);
+                glUniform1ui(glGetUniformLocation(decode_program, "output_first"), range.first);
+                glUniform1ui(glGetUniformLocation(decode_program, "page_id"), page.page);
+                glDispatchCompute((range.count + PACKED_BLOCK_SIZE - 1) / PACKED_BLOCK_SIZE, 1, 1);
+                decode_bytes[decode_slot] += (uint64_t)range.count * sizeof(InstanceData);
+                decoded++;
+            } else {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, instance_ssbo);
+                glBufferSubData(GL_COPY_WRITE_BUFFER, range.first * sizeof(InstanceData), page.data.size() * sizeof(uint32_t), page.data.data());
+            }
+
+            page_of_slot[slot] = page.page;
+            slot_of_page[page.page] = slot;
+            state[page.page] = PAGE_RESIDENT;
+            last_used[page.page] = frame_index; // 回读追上之前不会被换出
+            resident_pages++;
+            pages_loaded++;
+        }
+        if (decoded > 0) {
+            decode_timer.end();
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT); // 剔除要读解出来的实例
+        }
+        upload_ms = (float)((glfwGetTime() - start) * 1000.0);
+    }
+
+    // 剔除之后调用: 把这一帧每页的LOD状态拷走; 回读落后时这一帧不拷
+    void copy_feedback(GLuint cluster_lod_ssbo, int frame_index) {
+        Feedback& fb = feedback[feedback_head];
+        if (fb.fence) return;
+        glBindBuffer(GL_COPY_READ_BUFFER, cluster_lod_ssbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, fb.buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, page_count() * sizeof(GLuint));
+        fb.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        fb.frame_index = frame_index;
+        feedback_head = (feedback_head + 1) % FEEDBACK_RING;
+    }
+
+    void shutdown() {
+        if (generator.joinable()) generator.join();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quitting = true;
+        }
+        cv.notify_one();
+        if (reader.joinable()) reader.join();
+        for (Feedback& fb : feedback) {
+            if (fb.fence) glDeleteSync(fb.fence);
+            gpu_memory.forget(GpuMemoryRegistry::BUFFER, fb.buffer);
+            if (fb.buffer) glDeleteBuffers(1, &fb.buffer);
+        }
+        gpu_memory.forget(GpuMemoryRegistry::BUFFER, packed_ssbo);
+        if (packed_ssbo) glDeleteBuffers(1, &packed_ssbo);
+    }
+
+private:
+    // 空槽, 或者最新一份回读里没有逐个画的页 (刚上传的页last_used是上传那帧, 比回读新)
+    bool evictable(int slot) const {
+        int p = page_of_slot[slot];
+        return p < 0 || last_used[p] < newest_feedback;
+    }
+
+    int find_slot() const {
+        int best = -1;
+        for (int s = 0; s < slot_count(); ++s) {
+            if (page_of_slot[s] < 0) return s;
+            if (evictable(s) && (best < 0 || last_used[page_of_slot[s]] < last_used[page_of_slot[best]])) best = s;
+        }
+        return best;
+    }
+
+    void reader_loop() {
+        FILE* f = fopen(path.c_str(), "rb");
+        for (;;) {
+            int page;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return quitting || !requests.empty(); });
+                if (quitting) break;
+                page = requests.front();
+                requests.pop_front();
+            }
+            const PageRecord& record = table[page];
+            LoadedPage result{ page, std::vector<uint32_t>(record.bytes / sizeof(uint32_t)) };
+            double start = glfwGetTime();
+            bool ok = f && seek_file(f, record.offset) == 0
+                && fread(result.data.data(), 1, record.bytes, f) == record.bytes;
+            read_us += (uint64_t)((glfwGetTime() - start) * 1e6);
+            if (ok) bytes_read += record.bytes;
+            else result.data.clear();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                loaded.push_back(std::move(result));
+            }
+        }
+        if (f) fclose(f);
+    }
+};
+
+
+// --- 参数轨迹录制/回放 ---
+// 每帧一行CSV, 第一行是列名. 回放按列名对应字段, 新旧版本多出或缺少的列都能容忍,
+// 不同build之间就能跑完全相同的输入序列.
+struct ParameterTrace {
+    struct Field {
+        enum Type { INT, FLOAT, BOOL };
+        const char* name;
+        Type type;
+        void* ptr;
+    };
+    std::vector<Field> fields;
+    FILE* record_file = nullptr;
+    std::vector<std::vector<double>> rows; // 按fields排列, 轨迹里没有的列是NaN
+    size_t replay_row = 0;
+    bool replaying = false;
+
+    void add(const char* name, int* v) { fields.push_back({ name, Field::INT, v }); }
+    void add(const char* name, float* v) { fields.push_back({ name, Field::FLOAT, v }); }
+    void add(const char* name, bool* v) { fields.push_back({ name, Field::BOOL, v }); }
+
+    bool start_recording(const std::string& path) {
+        stop_recording();
+        record_file = fopen(path.c_str(), "w");
+        if (!record_file) return false;
+        fprintf(record_file, "frame");
+        for (const Field& f : fields) fprintf(record_file, ",%s", f.name);
+        fprintf(record_file, "\n");
+        return true;
+    }
+
+    void record_frame(int frame_index) {
+        if (!record_file) return;
+        fprintf(record_file, "%d", frame_index);
+        for (const Field& f : fields) {
+            switch (f.type) {
+            case Field::INT: fprintf(record_file, ",%d", *(int*)f.ptr); break;
+            case Field::FLOAT: fprintf(record_file, ",%.9g", *(float*)f.ptr); break; // 9位有效数字可以无损往返
+            case Field::BOOL: fprintf(record_file, ",%d", *(bool*)f.ptr ? 1 : 0); break;
+            }
+        }
+        fprintf(record_file, "\n");
+    }
+
+    void stop_recording() {
+        if (record_file) fclose(record_file);
+        record_file = nullptr;
+    }
+
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        std::string line;
+        if (!in || !std::getline(in, line)) return false;
+
+        // 轨迹的每一列对应哪个字段 (-1表示不认识的列)
+        std::vector<int> column_field;
+        std::stringstream header(line);
+        std::string name;
+        while (std::getline(header, name, ',')) {
+            int index = -1;
+            for (size_t i = 0; i < fields.size(); ++i) {
+                if (name == fields[i].name) index = (int)i;
+            }
+            column_field.push_back(index);
+        }
+
+        rows.clear();
+        while (std::getline(in, line)) {
+            if (line.empty()) continue;
+            std::vector<double> row(fields.size(), std::nan(""));
+            std::stringstream values(line);
+            std::string value;
+            for (size_t column = 0; std::getline(values, value, ',') && column < column_field.size(); ++column) {
+                if (column_field[column] >= 0) row[column_field[column]] = strtod(value.c_str(), nullptr);
+            }
+            rows.push_back(row);
+        }
+        replay_row = 0;
+        replaying = !rows.empty();
+        return replaying;
+    }
+
+    // 把下一行写回各字段; 轨迹放完返回false
+    bool apply_next() {
+        if (!replaying) return false;
+        if (replay_row >= rows.size()) {
+            replaying = false;
+            return false;
+        }
+        const std::vector<double>& row = rows[replay_row++];
+        for (size_t i = 0; i < fields.size(); ++i) {
+            if (std::isnan(row[i])) continue;
+            switch (fields[i].type) {
+            case Field::INT: *(int*)fields[i].ptr = (int)row[i]; break;
+            case Field::FLOAT: *(float*)fields[i].ptr = (float)row[i]; break;
+            case Field::BOOL: *(bool*)fields[i].ptr = row[i] != 0.0; break;
+            }
+        }
+        return true;
+    }
+};
+
+// --- 无界面基准 ---
+// 回放一条轨迹, 记录每帧的CPU帧时间和GPU计时, 最后写一个JSON.
+// 可以把同一条轨迹按不同的 (模式, 元素数) 连续跑多次, 每次是一个Run.
+// GPU计时要RING_SIZE帧之后才取得到, 所以每次轨迹放完后再多跑几帧, 输出时按帧对齐.
+struct BenchReport {
+    struct Run {
+        int mode = -1;  // -1: 用轨迹里的值
+        int count = -1;
+        int fetch = -1;
+        int fused = -1;
+        int packed = -1;
+        int occlusion = -1;
+        int pipelined = -1;
+        int async_upload = -1;
+        float zoom = -1.0f; // >0: 固定正交缩放, 用来控制可见比例
+        int final_mode = 0, final_count = 0, final_fetch = 0; // 实际跑的 (轨迹中途切换时取最后一帧)
+        bool final_fused = false, final_packed = false, final_occlusion = false, final_pipelined = false, final_async_upload = false;
+        bool final_render_thread = false;
+        unsigned int final_visible = 0;
+        int final_cull_latency = 0; // 流水线剔除时画的是几帧前的结果
+        int final_occluders = 0, final_occlusion_tested = 0, final_occlusion_rejected = 0;
+        bool final_paging = false, final_page_packed = false;
+        bool final_sparse = false;
+        double final_committed_mb = 0.0, final_reserved_mb = 0.0;
+        std::vector<std::pair<const char*, std::array<int64_t, GpuMemoryRegistry::KIND_COUNT>>> final_gpu_memory;
+        int64_t final_gpu_memory_bytes = 0, final_driver_free_kb = -1;
+        int final_pages_loaded = 0;
+        double final_compression = 0.0, final_decode_gb_per_s = 0.0, final_read_mb_per_s = 0.0;
+        std::vector<float> cpu_ms, cull_ms, draw_ms, cpu_cull_ms, cpu_cull_wait_ms, cpu_submit_ms, occluder_raster_ms, occlusion_test_ms;
+        std::vector<float> ui_ms, render_wait_ms;
+        std::vector<unsigned int> draw_calls;
+        std::vector<float> scene_load_render_ms, scene_load_worker_ms; // 每次换场景一项
+        std::vector<float> scene_load_frames;
+    };
+    std::vector<Run> runs;
+    size_t current = 0;
+
+    // 由渲染线程调用, 记到那一帧的包所属的Run (current是UI线程在放的那个)
+    void add(size_t run_index, float cpu, float ui, float render_wait, float cull, float draw, unsigned int calls,
+             float cpu_cull, float cpu_cull_wait, float cpu_submit, float occluder_raster, float occlusion_test) {
+        Run& run = runs[run_index];
+        run.cpu_ms.push_back(cpu);
+        run.ui_ms.push_back(ui);
+        run.render_wait_ms.push_back(render_wait);
+        run.cull_ms.push_back(cull);
+        run.draw_ms.push_back(draw);
+        run.draw_calls.push_back(calls);
+        run.cpu_cull_ms.push_back(cpu_cull);
+        run.cpu_cull_wait_ms.push_back(cpu_cull_wait);
+        run.cpu_submit_ms.push_back(cpu_submit);
+        run.occluder_raster_ms.push_back(occluder_raster);
+        run.occlusion_test_ms.push_back(occlusion_test);
+    }
+
+    static float percentile(std::vector<float> v, float p) {
+        if (v.empty()) return 0.0f;
+        std::sort(v.begin(), v.end());
+        return v[std::min(v.size() - 1, (size_t)(v.size() * p))];
+    }
+
+    // 第i帧的GPU时间在第i + gpu_lag帧才读到
+    static std::vector<float> align(const std::vector<float>& v, int frame_count, int gpu_lag) {
+        std::vector<float> out;
+        for (int i = 0; i < frame_count && !v.empty(); ++i) out.push_back(v[std::min(v.size() - 1, (size_t)(i + gpu_lag))]);
+        return out;
+    }
+
+    static void write_summary(FILE* f, const char* name, const std::vector<float>& v) {
+        double sum = 0.0;
+        for (float x : v) sum += x;
+        fprintf(f, "      \"%s\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"max\": %.4f },\n",
+            name, v.empty() ? 0.0 : sum / v.size(), percentile(v, 0.5f), percentile(v, 0.95f), percentile(v, 1.0f));
+    }
+
+    bool write_json(const std::string& path, const std::string& trace_path, int frame_count, int gpu_lag) {
+        FILE* f = path.empty() ? stdout : fopen(path.c_str(), "w");
+        if (!f) return false;
+        fprintf(f, "{\n  \"trace\": \"%s\",\n  \"frames\": %d,\n  \"runs\": [\n", trace_path.c_str(), frame_count);
+        for (size_t r = 0; r < runs.size(); ++r) {
+            const Run& run = runs[r];
+            int n = std::min(frame_count, (int)run.cpu_ms.size());
+            std::vector<float> cpu(run.cpu_ms.begin(), run.cpu_ms.begin() + n);
+            std::vector<float> ui(run.ui_ms.begin(), run.ui_ms.begin() + n);
+            std::vector<float> render_wait(run.render_wait_ms.begin(), run.render_wait_ms.begin() + n);
+            std::vector<float> cpu_cull(run.cpu_cull_ms.begin(), run.cpu_cull_ms.begin() + n);
+            std::vector<float> cpu_cull_wait(run.cpu_cull_wait_ms.begin(), run.cpu_cull_wait_ms.begin() + n);
+            std::vector<float> cpu_submit(run.cpu_submit_ms.begin(), run.cpu_submit_ms.begin() + n);
+            std::vector<float> occluder_raster(run.occluder_raster_ms.begin(), run.occluder_raster_ms.begin() + n);
+            std::vector<float> occlusion_test(run.occlusion_test_ms.begin(), run.occlusion_test_ms.begin() + n);
+            std::vector<float> cull = align(run.cull_ms, n, gpu_lag), draw = align(run.draw_ms, n, gpu_lag);
+            fprintf(f, "    {\n      \"mode\": \"%s\",\n      \"fetch\": \"%s\",\n      \"fused_compaction\": %s,\n      \"element_count\": %d,\n",
+                render_mode_cli_names[run.final_mode], fetch_backend_cli_names[run.final_fetch], run.final_fused ? "true" : "false", run.final_count);
+            fprintf(f, "      \"visible\": %u,\n", run.final_visible);
+            // 可见列表每帧写一遍读一遍; 16位格式每256个元素的组最多补一格, 这里不计
+            fprintf(f, "      \"id_format\": \"%s\",\n      \"visible_list_bytes\": %u,\n",
+                run.final_packed ? "packed16" : "plain32", run.final_visible * (run.final_packed ? 2u : 4u));
+            write_summary(f, "cpu_frame_ms", cpu);
+            // cpu_frame_ms是渲染线程上交换到交换的间隔; ui_thread_ms是UI线程每帧做的事, render_wait_ms是渲染线程空等它的时间
+            fprintf(f, "      \"render_thread\": %s,\n", run.final_render_thread ? "true" : "false");
+            write_summary(f, "ui_thread_ms", ui);
+            write_summary(f, "render_wait_ms", render_wait);
+            write_summary(f, "cpu_cull_ms", cpu_cull);
+            // 流水线剔除时渲染线程真正阻塞的部分; 同步剔除时和cpu_cull_ms相同
+            fprintf(f, "      \"pipelined_cull\": %s,\n      \"cull_latency_frames\": %d,\n", run.final_pipelined ? "true" : "false", run.final_cull_latency);
+            write_summary(f, "cpu_cull_wait_ms", cpu_cull_wait);
+            write_summary(f, "cpu_submit_ms", cpu_submit);
+            // CPU遮挡剔除 (只有CPU剔除的两种模式), 计数取最后一帧
+            fprintf(f, "      \"cpu_occlusion\": { \"enabled\": %s, \"occluders\": %d, \"tested\": %d, \"rejected\": %d, \"rejection_rate\": %.4f },\n",
+                run.final_occlusion ? "true" : "false", run.final_occluders, run.final_occlusion_tested, run.final_occlusion_rejected,
+                (double)run.final_occlusion_rejected / std::max(run.final_occlusion_tested, 1));
+            fprintf(f, "      \"instance_buffer\": { \"sparse\": %s, \"committed_mb\": %.2f, \"reserved_mb\": %.2f },\n",
+                run.final_sparse ? "true" : "false", run.final_committed_mb, run.final_reserved_mb);
+            // 登记表按子系统的汇总 (字节), driver_free_kb为-1表示没有驱动显存信息扩展
+            fprintf(f, "      \"gpu_memory\": {\n        \"subsystems\": {");
+            for (size_t i = 0; i < run.final_gpu_memory.size(); ++i) {
+                const auto& t = run.final_gpu_memory[i];
+                fprintf(f, "%s\n          \"%s\": { \"buffers\": %lld, \"textures\": %lld, \"programs\": %lld }", i ? "," : "", t.first,
+                    (long long)t.second[0], (long long)t.second[1], (long long)t.second[2]);
+            }
+            fprintf(f, "\n        },\n        \"total_bytes\": %lld,\n        \"driver_free_kb\": %lld\n      },\n",
+                (long long)run.final_gpu_memory_bytes, (long long)run.final_driver_free_kb);
+            // 分页: 压缩比按文件里的页数据算, 解码带宽按解出的InstanceData算 (最近读到的一次)
+            if (run.final_paging) {
+                fprintf(f, "      \"paging\": { \"format\": \"%s\", \"compression_ratio\": %.3f, \"pages_loaded\": %d, \"disk_read_mb_per_s\": %.1f, \"decode_gb_per_s\": %.3f },\n",
+                    run.final_page_packed ? "packed" : "raw", run.final_compression, run.final_pages_loaded, run.final_read_mb_per_s, run.final_decode_gb_per_s);
+            }
+            // 换场景: 渲染线程上的时间就是卡顿; 后台上传时它只剩开始和完成两小段, 代价是晚几帧换过去
+            fprintf(f, "      \"scene_loads\": { \"async_upload\": %s, \"count\": %zu },\n",
+                run.final_async_upload ? "true" : "false", run.scene_load_render_ms.size());
+            write_summary(f, "scene_load_render_ms", run.scene_load_render_ms);
+            write_summary(f, "scene_load_worker_ms", run.scene_load_worker_ms);
+            write_summary(f, "scene_load_frames", run.scene_load_frames);
+            write_summary(f, "occluder_raster_ms", occluder_raster);
+            write_summary(f, "occlusion_test_ms", occlusion_test);
+            write_summary(f, "gpu_cull_ms", cull);
+            write_summary(f, "gpu_draw_ms", draw);
+            fprintf(f, "      \"per_frame\": [\n");
+            for (int i = 0; i < n; ++i) {
+                fprintf(f, "        { \"cpu_ms\": %.4f, \"cpu_cull_ms\": %.4f, \"cpu_submit_ms\": %.4f, \"gpu_cull_ms\": %.4f, \"gpu_draw_ms\": %.4f, \"draw_calls\": %u }%s\n",
+                    cpu[i], cpu_cull[i], cpu_submit[i], cull[i], draw[i], run.draw_calls[i], i + 1 < n ? "," : "");
+            }
+            fprintf(f, "      ]\n    }%s\n", r + 1 < runs.size() ? "," : "");
+        }
+        fprintf(f, "  ]");
+
+        // 交叉点: 元素数从小到大, 第一个 "计算剔除 + 绘制" 比VS剔除更快的元素数
+        int gpu_crossover = -1, cpu_crossover = -1;
+        for (const Run& instanced : runs) {
+            if (instanced.final_mode != INSTANCED_INDIRECT) continue;
+            for (const Run& vs : runs) {
+                if (vs.final_mode != VS_CULL || vs.final_count != instanced.final_count) continue;
+                int n = std::min(frame_count, (int)std::min(instanced.cpu_ms.size(), vs.cpu_ms.size()));
+                std::vector<float> instanced_gpu = align(instanced.cull_ms, n, gpu_lag), instanced_draw = align(instanced.draw_ms, n, gpu_lag);
+                for (int i = 0; i < n; ++i) instanced_gpu[i] += instanced_draw[i];
+                float vs_gpu = percentile(align(vs.draw_ms, n, gpu_lag), 0.5f);
+                if (percentile(instanced_gpu, 0.5f) < vs_gpu && (gpu_crossover < 0 || instanced.final_count < gpu_crossover)) {
+                    gpu_crossover = instanced.final_count;
+                }
+                if (percentile(instanced.cpu_ms, 0.5f) < percentile(vs.cpu_ms, 0.5f) && (cpu_crossover < 0 || instanced.final_count < cpu_crossover)) {
+                    cpu_crossover = instanced.final_count;
+                }
+            }
+        }
+        if (gpu_crossover >= 0 || cpu_crossover >= 0) {
+            fprintf(f, ",\n  \"crossover\": { \"gpu_ms_element_count\": %d, \"cpu_frame_ms_element_count\": %d }", gpu_crossover, cpu_crossover);
+        }
+
+        // 融合收集 vs visible_ids: 同一缩放下成对比较GPU剔除+绘制 (p50)
+        bool first_pair = true;
+        for (const Run& ids : runs) {
+            if (ids.zoom <= 0.0f || ids.final_fused) continue;
+            for (const Run& fused : runs) {
+                if (fused.zoom != ids.zoom || !fused.final_fused) continue;
+                auto gpu_p50 = [&](const Run& run) {
+                    int n = std::min(frame_count, (int)run.cpu_ms.size());
+                    std::vector<float> total = align(run.cull_ms, n, gpu_lag), draw = align(run.draw_ms, n, gpu_lag);
+                    for (int i = 0; i < n; ++i) total[i] += draw[i];
+                    return percentile(total, 0.5f);
+                };
+                // 帧时间也写上: 软件驱动上计时查询包不住计算着色器, GPU时间可能读成0
+                fprintf(f, "%s    { \"zoom\": %.3f, \"visible_ratio\": %.4f, \"ids_gpu_ms\": %.4f, \"fused_gpu_ms\": %.4f, "
+                    "\"ids_cpu_frame_ms\": %.4f, \"fused_cpu_frame_ms\": %.4f }",
+                    first_pair ? ",\n  \"compaction\": [\n" : ",\n", ids.zoom, (double)ids.final_visible / std::max(ids.final_count, 1),
+                    gpu_p50(ids), gpu_p50(fused), percentile(ids.cpu_ms, 0.5f), percentile(fused.cpu_ms, 0.5f));
+                first_pair = false;
+            }
+        }
+        if (!first_pair) fprintf(f, "\n  ]");
+        fprintf(f, "\n}\n");
+        if (f != stdout) fclose(f);
+        return true;
+    }
+};
+
+// --- UI线程 / 渲染线程 ---
+// 主线程是生产者: 输入, ImGui, 轨迹回放和基准覆盖, 动态实例的spawn/kill请求, 每帧写成一个FramePacket;
+// 渲染线程独占GL上下文, 按包做换场景, 剔除, 提交, 帧捕获, 画UI和交换.
+// 包在固定的几个槽里循环使用, 两个无锁环只传槽号 (和CullPipeline一样), UI线程最多领先MAX_FRAMES_AHEAD帧.
+// 渲染线程上的状态 (统计回读, 计时, 分页/上传进度...) 每帧结束时拷进包里, 槽回到UI线程手上时拿去显示,
+// 所以面板上的数字比画面晚一到两帧
+
+// UI和轨迹能改的所有参数; 渲染线程每帧从包里拷一份, 不和UI线程共享
+struct FrameSettings {
+    Camera camera;
+    int element_count = 0;
+    RenderMode current_mode = MICRO_BATCH_INDIRECT;
+    CullTest cull_test = CULL_TEST_POINT_2D;
+    InstanceDistribution distribution = DIST_UNIFORM;
+    int seed = 1;
+    bool multiview_enabled = false, multiview_single_dispatch = true;
+    int view_count = 0;
+    bool lod_enabled = false;
+    float lod_error_px = 0.0f;
+    bool chain_enabled = false, persistent_enabled = false;
+    int persistent_groups = 0;
+    bool paging_enabled = false;
+    bool dynamic_enabled = false;
+    int spawn_per_frame = 0, kill_per_frame = 0;
+    bool defrag_enabled = false;
+    float defrag_threshold = 0.0f;
+    bool bitmask_cull_enabled = false;
+    bool tf_query_draw = false;
+    FetchBackend fetch_backend = FETCH_SSBO;
+    bool fused_compaction = false, packed_ids_enabled = false;
+    bool occlusion_enabled = false;
+    float occluder_min_px = 0.0f;
+    int max_occluders = 0;
+    bool occlusion_avx2 = false;
+    bool pipelined_cull = false;
+    bool async_scene_upload = false;
+    bool bvh_enabled = false, drift_enabled = false;
+    float drift_speed = 0.0f, bvh_rebuild_ratio = 0.0f;
+    bool hover_query_enabled = false;
+};
+
+// 渲染线程上的状态, 给UI显示
+struct RenderStats {
+    uint32_t values[StatsReadback::MAX_VALUES] = {}; // 统计回读的结果
+    unsigned int gpu_draw_calls = 0;
+    float gpu_cull_ms = 0.0f, gpu_draw_ms = 0.0f; // 平滑过的
+    float render_ms = 0.0f;      // 渲染线程这一帧的工作时间 (不含等包)
+    float render_wait_ms = 0.0f; // 渲染线程等UI线程的包等了多久
+    float cpu_cull_ms = 0.0f, cpu_submit_ms = 0.0f, cpu_cull_wait_ms = 0.0f;
+    int cull_latency = 0, command_ring_stalls = 0;
+    int occluder_count = 0, occlusion_tested = 0, occlusion_rejected = 0;
+    float occluder_raster_ms = 0.0f, occlusion_test_ms = 0.0f;
+    bool use_packed_ids = false, temporal_reuse = false;
+    GLuint tf_visible = 0;
+    size_t cluster_count = 0;
+    int defrag_runs = 0, bvh_rebuilds = 0;
+    float bvh_ms = 0.0f, bvh_quality = 1.0f;
+    // 实例缓冲
+    bool sparse = false;
+    double committed_mb = 0.0, reserved_mb = 0.0;
+    int sparse_page_kb = 0, commit_calls = 0;
+    // 换场景
+    bool scene_loading = false;
+    int scene_loading_frames = 0, scene_loads = 0, scene_load_frames = 0;
+    float scene_load_render_ms = 0.0f, scene_load_worker_ms = 0.0f;
+    // 分页
+    bool pager_ready = false, pager_failed = false, pager_generating = false, pager_packed = false;
+    int page_count = 0, page_slots = 0, resident_pages = 0, requested_pages = 0;
+    int pages_loaded = 0, pages_evicted = 0, loads_dropped = 0;
+    uint64_t page_instances = 0, page_data_bytes = 0;
+    double read_mb_per_s = 0.0, compression_ratio = 0.0, decode_gb_per_s = 0.0;
+    float page_upload_ms = 0.0f, page_decode_ms = 0.0f;
+    // 空间查询
+    uint32_t hover_hits = 0, select_hits = 0;
+    bool hover_valid = false;
+    uint32_t hover_id = 0;
+    InstanceData hover_instance = {};
+    float query_ms = 0.0f;
+    bool query_used_bvh = false;
+    int query_latency_frames = 0;
+    // 显存登记表
+    std::vector<std::pair<const char*, std::array<int64_t, GpuMemoryRegistry::KIND_COUNT>>> gpu_memory;
+    int64_t gpu_memory_bytes = 0, driver_free_kb = -1, driver_total_kb = 0;
+    size_t gpu_memory_objects = 0;
+    // 帧捕获
+    int capture_in_flight = 0, capture_dropped = 0, capture_stalls = 0;
+    size_t capture_queued = 0;
+};
+
+struct FramePacket {
+    // UI线程写
+    FrameSettings settings;
+    int frame_index = 0;
+    float frame_time = 0.0f; // UI线程上一帧的时长, 漂移的步长
+    int fb_width = 0, fb_height = 0;
+    bool regenerate = false; // 换了分布或种子
+    bool quit = false;       // 渲染线程画完前面的包就退出
+    size_t bench_run = 0;
+    float ui_ms = 0.0f;
+    glm::vec2 cursor_ndc = glm::vec2(0.0f);
+    bool left_down = false, mouse_over_ui = false;
+    bool capture_shot = false, capture_recording = false;
+    FrameCapture::Format capture_format = FrameCapture::FORMAT_PNG;
+    std::vector<InstanceData> spawn_requests;
+    std::vector<GLuint> kill_requests;
+    ImDrawData draw_data; // ImGui::Render()的深拷贝, CmdLists归这个包
+    // 渲染线程写
+    RenderStats stats;
+    bool stats_valid = false;
+};
+
+// ImGui::Render()的结果归ImGui上下文, UI线程下一帧就改写; 渲染线程画包里的这一份
+void copy_draw_data(const ImDrawData* src, ImDrawData& dst) {
+    for (ImDrawList* list : dst.CmdLists) IM_DELETE(list);
+    dst.Clear();
+    if (!src || !src->Valid) return;
+    dst = *src;
+    for (ImDrawList*& list : dst.CmdLists) list = list->CloneOutput();
+}
+
+struct FrameQueue {
+    static const int MAX_FRAMES_AHEAD = 1;
+    static const int SLOT_COUNT = MAX_FRAMES_AHEAD + 1; // UI线程在写的一个 + 渲染线程在画的一个
+    FramePacket slots[SLOT_COUNT];
+    SpscRing<int, SLOT_COUNT + 1> ready, free_slots;
+
+    void init() {
+        for (int i = 0; i < SLOT_COUNT; ++i) free_slots.push(i);
+    }
+
+    // UI线程: 取一个渲染线程画完的槽 (领先太多时在这里等)
+    int acquire() {
+        int slot;
+        while (!free_slots.pop(slot)) std::this_thread::yield();
+        return slot;
+    }
+    void submit(int slot) { ready.push(slot); }
+
+    // 渲染线程
+    int receive() {
+        int slot;
+        while (!ready.pop(slot)) std::this_thread::yield();
+        return slot;
+    }
+    void release(int slot) { free_slots.push(slot); }
+
+    void shutdown() {
+        for (FramePacket& packet : slots) copy_draw_data(nullptr, packet.draw_data);
+    }
+};
+
+// --- 主函数 ---
+int main(int argc, char** argv) {
+    // 命令行: --distribution <name> --seed <n> --count <n>
+    //         --record <trace.csv> / --replay <trace.csv> / --bench <trace.csv> [--bench-out <result.json>]
+    InstanceDistribution distribution = DIST_UNIFORM;
+    int seed = 1;
+    int element_count = 100000;
+    std::string record_path, replay_path, bench_out_path;
+    bool bench_mode = false;
+    int forced_mode = -1; // --mode: 覆盖轨迹里的current_mode, 同一条轨迹跑出四种模式的对比
+    bool crossover_sweep = false; // --crossover: 实例化间接 vs VS剔除, 扫一遍元素数
+    bool force_gl33 = false; // --gl33: 直接要3.3上下文, 在新机器上也能跑变换反馈退路
+    bool no_sparse = false;  // --no-sparse: 有GL_ARB_sparse_buffer也整块分配instance_ssbo, 对比用
+    int forced_fetch = -1;   // --fetch: 固定取数方式; all = 基准里每种各跑一遍
+    bool fetch_sweep = false;
+    bool compaction_sweep = false; // --compaction-sweep: 不同可见比例下, 融合收集 vs visible_ids
+    int forced_packed = -1;        // --id-format: plain / packed (16位) / both (基准里两种各跑一遍)
+    int forced_occlusion = -1;     // --occlusion: off / on / both (CPU剔除模式的遮挡缓冲, 基准里开关各跑一遍)
+    int forced_cull_thread = -1;   // --cull-thread: off / on / both (CPU剔除放到工作线程上)
+    int forced_upload_thread = -1; // --upload-thread: off / on / both (换场景的上传走共享上下文的后台线程)
+    bool render_thread_enabled = true; // --render-thread: off时UI线程自己接着画同一个包, 对比用
+    std::string page_file_path;    // --page-file: 分页模式的数据; 不存在时按下面三项生成
+    bool page_packed = false;      // --page-format: raw / packed (压缩页, GPU解码); 已有的文件按它自己的格式读
+    int page_grid = 32;            // --page-grid: grid x grid页
+    int page_capacity = 4096;      // --page-capacity: 每页最多多少个实例
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--distribution") && has_value) {
+            const char* name = argv[++i];
+            int found = -1;
+            for (int d = 0; d < DIST_COUNT; ++d) {
+                if (!strcmp(name, distribution_cli_names[d])) found = d;
+            }
+            if (found < 0) {
+                std::cerr << "Unknown distribution: " << name << std::endl;
+                return 1;
+            }
+            distribution = (InstanceDistribution)found;
+        } else if (!strcmp(argv[i], "--seed") && has_value) {
+            seed = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--count") && has_value) {
+            element_count = std::clamp(atoi(argv[++i]), 1000, (int)MAX_ELEMENTS);
+        } else if (!strcmp(argv[i], "--record") && has_value) {
+            record_path = argv[++i];
+        } else if (!strcmp(argv[i], "--replay") && has_value) {
+            replay_path = argv[++i];
+        } else if (!strcmp(argv[i], "--bench") && has_value) {
+            replay_path = argv[++i];
+            bench_mode = true;
+        } else if (!strcmp(argv[i], "--bench-out") && has_value) {
+            bench_out_path = argv[++i];
+        } else if (!strcmp(argv[i], "--crossover")) {
+            crossover_sweep = true;
+        } else if (!strcmp(argv[i], "--gl33")) {
+            force_gl33 = true;
+        } else if (!strcmp(argv[i], "--no-sparse")) {
+            no_sparse = true;
+        } else if (!strcmp(argv[i], "--compaction-sweep")) {
+            compaction_sweep = true;
+        } else if (!strcmp(argv[i], "--id-format") && has_value) {
+            const char* name = argv[++i];
+            if (!strcmp(name, "plain")) forced_packed = 0;
+            else if (!strcmp(name, "packed")) forced_packed = 1;
+            else if (!strcmp(name, "both")) forced_packed = 2;
+            else {
+                std::cerr << "Unknown id format: " << name << std::endl;
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--occlusion") && has_value) {
+            const char* name = argv[++i];
+            if (!strcmp(name, "off")) forced_occlusion = 0;
+            else if (!strcmp(name, "on")) forced_occlusion = 1;
+            else if (!strcmp(name, "both")) forced_occlusion = 2;
+            else {
+                std::cerr << "Unknown occlusion setting: " << name << std::endl;
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--upload-thread") && has_value) {
+            const char* name = argv[++i];
+            if (!strcmp(name, "off")) forced_upload_thread = 0;
+            else if (!strcmp(name, "on")) forced_upload_thread = 1;
+            else if (!strcmp(name, "both")) forced_upload_thread = 2;
+            else {
+                std::cerr << "Unknown upload thread setting: " << name << std::endl;
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--cull-thread") && has_value) {
+            const char* name = argv[++i];
+            if (!strcmp(name, "off")) forced_cull_thread = 0;
+            else if (!strcmp(name, "on")) forced_cull_thread = 1;
+            else if (!strcmp(name, "both")) forced_cull_thread = 2;
+            else {
+                std::cerr << "Unknown cull thread setting: " << name << std::endl;
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--render-thread") && has_value) {
+            const char* name = argv[++i];
+            if (strcmp(name, "off") && strcmp(name, "on")) {
+                std::cerr << "Unknown render thread setting: " << name << std::endl;
+                return 1;
+            }
+            render_thread_enabled = !strcmp(name, "on");
+        } else if (!strcmp(argv[i], "--page-file") && has_value) {
+            page_file_path = argv[++i];
+        } else if (!strcmp(argv[i], "--page-format") && has_value) {
+            const char* name = argv[++i];
+            if (strcmp(name, "raw") && strcmp(name, "packed")) {
+                std::cerr << "Unknown page format: " << name << std::endl;
+                return 1;
+            }
+            page_packed = !strcmp(name, "packed");
+        } else if (!strcmp(argv[i], "--page-grid") && has_value) {
+            page_grid = std::clamp(atoi(argv[++i]), 1, 128); // 页数不超过MAX_CLUSTERS
+        } else if (!strcmp(argv[i], "--page-capacity") && has_value) {
+            page_capacity = std::clamp(atoi(argv[++i]), 256, (int)MAX_ELEMENTS / 4);
+        } else if (!strcmp(argv[i], "--fetch") && has_value) {
+            const char* name = argv[++i];
+            fetch_sweep = !strcmp(name, "all");
+            for (int f = 0; f < FETCH_COUNT; ++f) {
+                if (!strcmp(name, fetch_backend_cli_names[f])) forced_fetch = f;
+            }
+            if (forced_fetch < 0 && !fetch_sweep) {
+                std::cerr << "Unknown fetch backend: " << name << std::endl;
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--mode") && has_value) {
+            const char* name = argv[++i];
+            for (int m = 0; m < RENDER_MODE_COUNT; ++m) {
+                if (!strcmp(name, render_mode_cli_names[m])) forced_mode = m;
+            }
+            if (forced_mode < 0) {
+                std::cerr << "Unknown mode: " << name << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--distribution uniform|gaussian|powerlaw|grid|text] [--seed N] [--count N]"
+                      << " [--record trace.csv] [--replay trace.csv] [--bench trace.csv [--bench-out result.json]]"
+                      << " [--mode micro|instanced|direct|cpu_mdi|vs_cull|tf] [--crossover] [--gl33] [--no-sparse]"
+                      << " [--fetch ssbo|tbo|ubo|attrib|all] [--compaction-sweep] [--id-format plain|packed|both]"
+                      << " [--occlusion off|on|both] [--cull-thread off|on|both] [--upload-thread off|on|both]"
+                      << " [--render-thread off|on]"
+                      << " [--page-file pages.bin [--page-format raw|packed] [--page-grid N] [--page-capacity N]]" << std::endl;
+            return 1;
+        }
+    }
+    if (page_file_path.empty()) page_file_path = page_packed ? "pages_packed.bin" : "pages.bin";
+
+    // ... (GLFW, GLAD, ImGui 初始化代码)
+    // --- Boilerplate: Window, OpenGL, ImGui initialization ---
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, force_gl33 ? 3 : 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, force_gl33 ? 3 : 5);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (bench_mode) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE); // 基准不需要显示窗口
+    GLFWwindow* window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Draw Call Performance Demo", NULL, NULL);
+    if (window == NULL && !force_gl33) {
+        // 只有GL 3.3的机器: 退回3.3核心上下文, 只能跑变换反馈剔除
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Draw Call Performance Demo", NULL, NULL);
+    }
+    if (window == NULL) { /*...*/ return -1; }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0); // VSync Off for performance measurement
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) { return -1; }
+
+    // 其他模式都是按4.5写的 (计算着色器/间接dispatch/持久映射), 不到4.5就只剩变换反馈剔除
+    GLint gl_major = 0, gl_minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &gl_major);
+    glGetIntegerv(GL_MINOR_VERSION, &gl_minor);
+    const bool has_compute = !force_gl33 && (gl_major > 4 || (gl_major == 4 && gl_minor >= 5));
+    // 变换反馈对象和glDrawTransformFeedback: 4.0核心, 很多3.3驱动也有这个扩展
+    const bool has_feedback_draw = gl_major >= 4 || has_gl_extension("GL_ARB_transform_feedback2");
+    gpu_memory.init(gl_major > 4 || (gl_major == 4 && gl_minor >= 1) || has_gl_extension("GL_ARB_get_program_binary"));
+
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGuiIO& io = ImGui::GetIO(); (void)io;
+    ImGui::StyleColorsDark();
+    ImGui_ImplGlfw_InitForOpenGL(window, true);
+    ImGui_ImplOpenGL3_Init(has_compute ? "#version 450" : "#version 330");
+    ImGui_ImplOpenGL3_NewFrame(); // 字体纹理和着色器在这里建好, 之后ImGui::NewFrame在UI线程上, 不碰GL
+    
+    // --- 数据准备 ---
+    // 初始实例按分布和种子生成; 动态模式的spawn请求仍用均匀分布
+    std::uniform_real_distribution<float> pos_dist(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> size_dist(0.002f, 0.008f);
+    std::uniform_real_distribution<float> color_dist(0.1f, 1.0f);
+
+    auto make_random_instance = [&](std::mt19937& gen) {
+        glm::vec3 position(pos_dist(gen), pos_dist(gen), pos_dist(gen));
+        glm::vec2 size(size_dist(gen), size_dist(gen));
+        return make_instance(position, size, glm::vec4(color_dist(gen), color_dist(gen), color_dist(gen), 1.0f));
+    };
+
+    std::vector<InstanceData> instance_cpu_data(MAX_ELEMENTS);
+    generate_instances(distribution, seed, instance_cpu_data);
+
+    // --- OpenGL Buffer 设置 ---
+    // 基础Quad VBO/EBO
+    float quad_vertices[] = { -0.5f, -0.5f, 0.5f, -0.5f, 0.5f, 0.5f, -0.5f, 0.5f };
+    unsigned int quad_indices[] = { 0, 1, 2, 2, 3, 0 };
+    GLuint quadVAO, quadVBO, quadEBO;
+    glGenVertexArrays(1, &quadVAO);
+    glGenBuffers(1, &quadVBO);
+    glGenBuffers(1, &quadEBO);
+    glBindVertexArray(quadVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), quad_vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quad_indices), quad_indices, GL_STATIC_DRAW);
+    gpu_memory.track(GpuMemoryRegistry::BUFFER, quadVBO, "Scene", "quad vertices", sizeof(quad_vertices));
+    gpu_memory.track(GpuMemoryRegistry::BUFFER, quadEBO, "Scene", "quad indices", sizeof(quad_indices));
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+
+    // SSBOs
+    // 稀疏时这里什么都没提交, 第一帧按element_count提交并上传分簇后的实例
+    InstanceStorage instance_storage;
+    instance_storage.init(has_compute && !no_sparse && has_gl_extension("GL_ARB_sparse_buffer"), instance_cpu_data.data());
+    GLuint instance_ssbo = instance_storage.buffer;
+    // SSBO/间接绘制/原子计数器缓冲和计算程序都是4.x才有: 3.3上下文不创建, 句柄留0, 显存登记里也不出现
+    // (只在has_compute的路径上用到, 3.3上固定走变换反馈)
+    GLuint visible_id_ssbo = 0, command_buffer = 0, counter_buffer = 0;
+    if (has_compute) {
+        visible_id_ssbo = gpu_memory.create_buffer(GL_SHADER_STORAGE_BUFFER, MAX_ELEMENTS * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW,
+            "Cull", "visible_id_ssbo");
+        command_buffer = gpu_memory.create_buffer(GL_DRAW_INDIRECT_BUFFER, MAX_ELEMENTS * sizeof(GLuint) * 5, nullptr, GL_DYNAMIC_DRAW,
+            "Cull", "command_buffer");
+        counter_buffer = gpu_memory.create_buffer(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW, "Cull", "counter_buffer");
+    }
+
+    // 每帧常量UBO
+    GLuint frame_ubo = gpu_memory.create_buffer(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW, "Scene", "frame_ubo");
+
+    // 多视图: 视图常量UBO, 每视图一条DrawCommand, 每视图一段可见id (按最大元素数预留)
+    GLuint multiview_ubo = gpu_memory.create_buffer(GL_UNIFORM_BUFFER, sizeof(MultiViewUniforms), nullptr, GL_DYNAMIC_DRAW,
+        "Multi-View", "multiview_ubo");
+    GLuint multiview_command_buffer = 0, multiview_visible_id_ssbo = 0;
+    if (has_compute) {
+        multiview_command_buffer = gpu_memory.create_buffer(GL_DRAW_INDIRECT_BUFFER, MAX_VIEWS * sizeof(GLuint) * 5, nullptr, GL_DYNAMIC_DRAW,
+            "Multi-View", "multiview_command_buffer");
+        multiview_visible_id_ssbo = gpu_memory.create_buffer(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)MAX_VIEWS * MAX_ELEMENTS * sizeof(GLuint),
+            nullptr, GL_DYNAMIC_DRAW, "Multi-View", "multiview_visible_id_ssbo");
+    }
+
+    // 簇: 区间/包围球/impostor由归约生成, LOD状态和impostor列表每帧重写
+    GLuint cluster_range_ssbo, cluster_bounds_ssbo, impostor_ssbo, cluster_lod_ssbo, impostor_id_ssbo, impostor_command_buffer;
+    auto create_ssbo = [has_compute](GLuint& buffer, GLsizeiptr size, const char* subsystem, const char* purpose) {
+        buffer = 0;
+        if (!has_compute) return;
+        buffer = gpu_memory.create_buffer(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_DRAW, subsystem, purpose);
+    };
+    create_ssbo(cluster_range_ssbo, MAX_CLUSTERS * sizeof(ClusterRange), "Cluster LOD", "cluster_range_ssbo");
+    create_ssbo(cluster_bounds_ssbo, MAX_CLUSTERS * sizeof(glm::vec4), "Cluster LOD", "cluster_bounds_ssbo");
+    create_ssbo(impostor_ssbo, MAX_CLUSTERS * sizeof(InstanceData), "Cluster LOD", "impostor_ssbo");
+    create_ssbo(cluster_lod_ssbo, MAX_CLUSTERS * sizeof(GLuint), "Cluster LOD", "cluster_lod_ssbo");
+    create_ssbo(impostor_id_ssbo, MAX_CLUSTERS * sizeof(GLuint), "Cluster LOD", "impostor_id_ssbo");
+    create_ssbo(impostor_command_buffer, 6 * sizeof(GLuint), "Cluster LOD", "impostor_command_buffer"); // 一条DrawCommand + merged_instance_count
+
+    // 链式管线状态: 各阶段的DispatchIndirectCommand + 计数 + 近处簇列表
+    GLuint chain_state_buffer;
+    create_ssbo(chain_state_buffer, sizeof(ChainStateHeader) + MAX_CLUSTERS * sizeof(GLuint), "Chain", "chain_state_buffer");
+    GLuint work_queue_ssbo; // 常驻线程推回的条目 (first, count)
+    create_ssbo(work_queue_ssbo, (MAX_WORK_ITEMS + MAX_PERSISTENT_GROUPS) * 2 * sizeof(GLuint), "Chain", "work_queue_ssbo");
+
+    // 动态实例: 分配器头 + 空闲栈, 存活位图, 每帧的spawn/kill请求, 整理碎片用的scratch
+    const int ALIVE_MASK_WORDS = (MAX_ELEMENTS + 31) / 32;
+    GLuint slot_allocator_buffer, alive_mask_ssbo, spawn_request_ssbo, kill_request_ssbo, defrag_scratch_ssbo, defrag_offset_ssbo;
+    create_ssbo(slot_allocator_buffer, sizeof(SlotAllocatorHeader) + MAX_ELEMENTS * sizeof(GLuint), "Dynamic", "slot_allocator_buffer");
+    create_ssbo(alive_mask_ssbo, ALIVE_MASK_WORDS * sizeof(GLuint), "Dynamic", "alive_mask_ssbo");
+    create_ssbo(spawn_request_ssbo, MAX_SLOT_COMMANDS * sizeof(InstanceData), "Dynamic", "spawn_request_ssbo");
+    create_ssbo(kill_request_ssbo, MAX_SLOT_COMMANDS * sizeof(GLuint), "Dynamic", "kill_request_ssbo");
+    create_ssbo(defrag_scratch_ssbo, MAX_ELEMENTS * sizeof(InstanceData), "Dynamic", "defrag_scratch_ssbo");
+    create_ssbo(defrag_offset_ssbo, ALIVE_MASK_WORDS * sizeof(GLuint), "Dynamic", "defrag_offset_ssbo");
+
+    // 位图剔除: 两块可见性位图按帧交替读写, 外加读取量统计
+    GLuint visibility_mask_ssbo[2], cull_load_stats_buffer;
+    create_ssbo(visibility_mask_ssbo[0], ALIVE_MASK_WORDS * sizeof(GLuint), "Bitmask Cull", "visibility_mask_ssbo[0]");
+    create_ssbo(visibility_mask_ssbo[1], ALIVE_MASK_WORDS * sizeof(GLuint), "Bitmask Cull", "visibility_mask_ssbo[1]");
+    create_ssbo(cull_load_stats_buffer, 2 * sizeof(GLuint), "Bitmask Cull", "cull_load_stats_buffer");
+
+    // LBVH: 排序用两对键/值乒乓, 直方图 [数字][组], 2n-1个节点和父指针, refit的访问计数, 遍历的子树列表
+    const int RADIX_MAX_GROUPS = (MAX_ELEMENTS + BVH_RADIX_TILE - 1) / BVH_RADIX_TILE;
+    GLuint bvh_key_ssbo[2], bvh_value_ssbo[2], radix_histogram_ssbo, bvh_node_ssbo, bvh_parent_ssbo, bvh_refit_visit_ssbo;
+    GLuint bvh_frontier_ssbo, bvh_state_buffer;
+    for (int i = 0; i < 2; ++i) {
+        create_ssbo(bvh_key_ssbo[i], MAX_ELEMENTS * sizeof(GLuint), "LBVH", i ? "bvh_key_ssbo[1]" : "bvh_key_ssbo[0]");
+        create_ssbo(bvh_value_ssbo[i], MAX_ELEMENTS * sizeof(GLuint), "LBVH", i ? "bvh_value_ssbo[1]" : "bvh_value_ssbo[0]");
+    }
+    create_ssbo(radix_histogram_ssbo, 256 * RADIX_MAX_GROUPS * sizeof(GLuint), "LBVH", "radix_histogram_ssbo");
+    create_ssbo(bvh_node_ssbo, (2 * MAX_ELEMENTS - 1) * 2 * sizeof(glm::vec4), "LBVH", "bvh_node_ssbo");
+    create_ssbo(bvh_parent_ssbo, (2 * MAX_ELEMENTS - 1) * sizeof(GLuint), "LBVH", "bvh_parent_ssbo");
+    create_ssbo(bvh_refit_visit_ssbo, MAX_ELEMENTS * sizeof(GLuint), "LBVH", "bvh_refit_visit_ssbo");
+    create_ssbo(bvh_frontier_ssbo, 2 * BVH_FRONTIER_CAPACITY * sizeof(GLuint), "LBVH", "bvh_frontier_ssbo");
+    create_ssbo(bvh_state_buffer, sizeof(BvhStateHeader), "LBVH", "bvh_state_buffer");
+
+    // --- Shader编译 ---
+    // subsystem/name只用于显存登记. #version 450的程序和计算程序在3.3上下文上编不了, 返回0
+    auto create_shader_program = [has_compute](const char* vs_body, const char* fs_body, const std::string& defines, const char* subsystem, const char* name) {
+        // ... (standard shader compilation code)
+        if (!has_compute) return 0u;
+        std::string vs_src = build_shader_source(vs_body, defines), fs_src = build_shader_source(fs_body, defines);
+        const char* vs = vs_src.c_str();
+        const char* fs = fs_src.c_str();
+        GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER); glShaderSource(vertexShader, 1, &vs, NULL); glCompileShader(vertexShader);
+        GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER); glShaderSource(fragmentShader, 1, &fs, NULL); glCompileShader(fragmentShader);
+        GLuint shaderProgram = glCreateProgram(); glAttachShader(shaderProgram, vertexShader); glAttachShader(shaderProgram, fragmentShader); glLinkProgram(shaderProgram);
+        glDeleteShader(vertexShader); glDeleteShader(fragmentShader);
+        gpu_memory.track_program(shaderProgram, subsystem, name, defines);
+        return shaderProgram;
+    };
+    auto create_compute_program = [has_compute](const char* cs_body, const std::string& defines, const char* subsystem, const char* name) {
+        // ... (standard compute shader compilation code)
+        if (!has_compute) return 0u;
+        std::string cs_src = build_shader_source(cs_body, defines);
+        const char* cs = cs_src.c_str();
+        GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER); glShaderSource(computeShader, 1, &cs, NULL); glCompileShader(computeShader);
+        GLuint shaderProgram = glCreateProgram(); glAttachShader(shaderProgram, computeShader); glLinkProgram(shaderProgram);
+        glDeleteShader(computeShader);
+        gpu_memory.track_program(shaderProgram, subsystem, name, defines);
+        return shaderProgram;
+    };
+    
+    // 计算着色器变体按(源码, 宏)缓存, 第一次用到时才编译
+    std::map<std::pair<const char*, std::string>, GLuint> compute_program_cache;
+    auto get_compute_program = [&](const char* cs_body, const std::string& defines, const char* subsystem, const char* name) {
+        auto key = std::make_pair(cs_body, defines);
+        auto it = compute_program_cache.find(key);
+        if (it != compute_program_cache.end()) return it->second;
+        GLuint program = create_compute_program(cs_body, defines, subsystem, name);
+        compute_program_cache[key] = program;
+        return program;
+    };
+
+    // 每种剔除测试各编一个变体, 方便直接对比两者的ALU开销
+    const std::string cull_test_defines[2] = { "", "#define CULL_SPHERE_FRUSTUM\n" };
+    GLuint render_program = create_shader_program(render_vs_source, render_fs_source, "", "Scene", "render");
+    GLuint vs_cull_programs[2];
+    for (int t = 0; t < 2; ++t) {
+        vs_cull_programs[t] = create_shader_program(render_vs_source, render_fs_source, "#define VS_CULL\n" + cull_test_defines[t], "Cull", "render");
+    }
+    GLuint cluster_reduce_program = create_compute_program(cluster_reduce_cs_source, "", "Cluster LOD", "cluster_reduce_cs");
+    GLuint chain_finalize_program = create_compute_program(chain_finalize_cs_source, "", "Chain", "chain_finalize_cs");
+    GLuint slot_kill_program = create_compute_program(slot_kill_cs_source, "", "Dynamic", "slot_kill_cs");
+    GLuint slot_spawn_program = create_compute_program(slot_spawn_cs_source, "", "Dynamic", "slot_spawn_cs");
+    GLuint slot_fixup_program = create_compute_program(slot_fixup_cs_source, "", "Dynamic", "slot_fixup_cs");
+    GLuint defrag_reset_program = create_compute_program(slot_fixup_cs_source, "#define DEFRAG_RESET\n", "Dynamic", "slot_fixup_cs");
+    GLuint defrag_scan_program = create_compute_program(defrag_scan_cs_source, "", "Dynamic", "defrag_scan_cs");
+    GLuint defrag_scatter_program = create_compute_program(defrag_scatter_cs_source, "", "Dynamic", "defrag_scatter_cs");
+    GLuint defrag_commit_program = create_compute_program(defrag_commit_cs_source, "", "Dynamic", "defrag_commit_cs");
+    // 有gl_ViewportIndex就一次MDI画完所有视图, 否则退回每视图一次绘制
+    const bool has_viewport_layer_array = has_gl_extension("GL_ARB_shader_viewport_layer_array");
+    GLuint render_multiview_program = create_shader_program(render_multiview_vs_source, render_fs_source,
+        has_viewport_layer_array ? "#define VIEWPORT_FROM_DRAW_ID\n" : "", "Multi-View", "render_multiview");
+
+    // GL 3.3程序: 可以带GS, 没有FS时 (剔除pass) 在链接前声明要捕获的变换反馈输出;
+    // 没有binding限定符, UBO和纹理单元在这里设
+    auto create_gl33_program = [](const char* vs_body, const char* gs_body, const char* fs_body,
+                                  const std::string& defines, const char* feedback_varying, const char* subsystem, const char* name) {
+        GLuint program = glCreateProgram();
+        std::vector<GLuint> shaders;
+        auto attach = [&](GLenum type, const char* body) {
+            if (!body) return;
+            std::string src = build_shader_source(body, defines);
+            const char* text = src.c_str();
+            GLuint shader = glCreateShader(type); glShaderSource(shader, 1, &text, NULL); glCompileShader(shader);
+            glAttachShader(program, shader);
+            shaders.push_back(shader);
+        };
+        attach(GL_VERTEX_SHADER, vs_body);
+        attach(GL_GEOMETRY_SHADER, gs_body);
+        attach(GL_FRAGMENT_SHADER, fs_body);
+        if (feedback_varying) glTransformFeedbackVaryings(program, 1, &feedback_varying, GL_INTERLEAVED_ATTRIBS);
+        glLinkProgram(program);
+        for (GLuint shader : shaders) glDeleteShader(shader);
+        GLuint block = glGetUniformBlockIndex(program, "FrameUniforms");
+        if (block != GL_INVALID_INDEX) glUniformBlockBinding(program, block, 0);
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "instance_texels"), 0);
+        glUseProgram(0);
+        gpu_memory.track_program(program, subsystem, name, defines);
+        return program;
+    };
+    GLuint tf_cull_programs[2];
+    for (int t = 0; t < 2; ++t) {
+        tf_cull_programs[t] = create_gl33_program(tf_cull_vs_source, tf_cull_gs_source, nullptr, cull_test_defines[t], "visible_id", "Transform Feedback", "tf_cull");
+    }
+    GLuint tf_render_points_program = create_gl33_program(tf_render_vs_source, tf_render_gs_source, tf_render_fs_source, "#define EXPAND_IN_GS\n", nullptr, "Transform Feedback", "tf_render");
+    GLuint tf_render_instanced_program = create_gl33_program(tf_render_vs_source, nullptr, tf_render_fs_source, "", nullptr, "Transform Feedback", "tf_render");
+
+    // 变换反馈: 可见id缓冲同时是绘制时的顶点属性来源; 实例数据走纹理缓冲
+    GLuint tf_visible_id_buffer, tf_feedback = 0, instance_tbo, tf_cull_vao, tf_points_vao, tf_instanced_vao;
+    tf_visible_id_buffer = gpu_memory.create_buffer(GL_ARRAY_BUFFER, MAX_ELEMENTS * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY,
+        "Transform Feedback", "tf_visible_id_buffer");
+    if (has_feedback_draw) {
+        glGenTransformFeedbacks(1, &tf_feedback);
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tf_feedback);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, tf_visible_id_buffer);
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+    }
+    glGenTextures(1, &instance_tbo);
+    glBindTexture(GL_TEXTURE_BUFFER, instance_tbo);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, instance_ssbo);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    gpu_memory.track(GpuMemoryRegistry::TEXTURE, instance_tbo, "Fetch", "instance_tbo (view of instance_ssbo)", 0);
+    // 3.3只保证65536个texel, 实际驱动一般大得多; 超出的元素在这个模式下不画
+    GLint max_texture_buffer_texels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texture_buffer_texels);
+    const int tf_max_elements = std::min((int)MAX_ELEMENTS, max_texture_buffer_texels / 2);
+
+    glGenVertexArrays(1, &tf_cull_vao); // 剔除pass没有顶点属性, 但核心模式绘制必须绑VAO
+    glGenVertexArrays(1, &tf_points_vao);
+    glBindVertexArray(tf_points_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, tf_visible_id_buffer);
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+    glEnableVertexAttribArray(1);
+    glGenVertexArrays(1, &tf_instanced_vao);
+    glBindVertexArray(tf_instanced_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, tf_visible_id_buffer);
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(1);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadEBO);
+    glBindVertexArray(0);
+
+    // --- 取数方式: SSBO (render_program) / TBO / UBO分块 / 顶点属性 ---
+    // UBO一块取64KB和驱动上限里小的那个; 偏移是整块大小的倍数, 满足UBO偏移对齐
+    GLint max_uniform_block_size = 0;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &max_uniform_block_size);
+    const GLuint ubo_chunk_instances = (GLuint)(std::min(max_uniform_block_size, 65536) / sizeof(InstanceData));
+    const GLsizeiptr ubo_chunk_bytes = ubo_chunk_instances * sizeof(InstanceData);
+    const GLuint max_ubo_chunks = (MAX_ELEMENTS + ubo_chunk_instances - 1) / ubo_chunk_instances;
+    // [0]: 经过visible_ids; [1]: 融合收集, 直接按gl_InstanceID读压缩副本 (UBO/顶点属性本来就读副本, 两边共用)
+    GLuint render_fetch_programs[2][FETCH_COUNT];
+    for (int fused = 0; fused < 2; ++fused) {
+        std::string compact = fused ? "#define FETCH_COMPACT\n" : "";
+        render_fetch_programs[fused][FETCH_SSBO] = fused ? create_shader_program(render_vs_source, render_fs_source, compact, "Fetch", "render") : render_program;
+        render_fetch_programs[fused][FETCH_TBO] = create_shader_program(render_vs_source, render_fs_source, "#define FETCH_TBO\n" + compact, "Fetch", "render");
+        if (!has_compute) continue;
+        glUseProgram(render_fetch_programs[fused][FETCH_TBO]);
+        glUniform1i(glGetUniformLocation(render_fetch_programs[fused][FETCH_TBO], "instance_texels"), 0);
+        glUniform1i(glGetUniformLocation(render_fetch_programs[fused][FETCH_TBO], "visible_id_texels"), 1);
+        glUseProgram(0);
+    }
+    render_fetch_programs[0][FETCH_UBO] = render_fetch_programs[1][FETCH_UBO] = create_shader_program(render_vs_source, render_fs_source,
+        "#define FETCH_UBO\n#define UBO_CHUNK_INSTANCES " + std::to_string(ubo_chunk_instances) + "\n", "Fetch", "render");
+    render_fetch_programs[0][FETCH_ATTRIBUTE] = render_fetch_programs[1][FETCH_ATTRIBUTE] = create_shader_program(render_vs_source, render_fs_source, "#define FETCH_ATTRIBUTE\n", "Fetch", "render");
+
+    GLuint visible_id_tbo;
+    glGenTextures(1, &visible_id_tbo);
+    glBindTexture(GL_TEXTURE_BUFFER, visible_id_tbo);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, visible_id_ssbo);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    gpu_memory.track(GpuMemoryRegistry::TEXTURE, visible_id_tbo, "Fetch", "visible_id_tbo (view of visible_id_ssbo)", 0);
+
+    // 压缩副本按整块分配, 最后一块的glBindBufferRange不会越界
+    GLuint compact_instance_ssbo, ubo_chunk_command_buffer;
+    create_ssbo(compact_instance_ssbo, max_ubo_chunks * ubo_chunk_bytes, "Fetch", "compact_instance_ssbo");
+    create_ssbo(ubo_chunk_command_buffer, max_ubo_chunks * sizeof(GLuint) * 5, "Fetch", "ubo_chunk_command_buffer");
+    // 16位可见id: 每65536个元素一段, 每段一条DrawCommand; id本身写在visible_id_ssbo里 (只用到一半)
+    const GLuint ID_SEGMENT_SIZE = 65536;
+    const GLuint max_id_segments = (MAX_ELEMENTS + ID_SEGMENT_SIZE - 1) / ID_SEGMENT_SIZE;
+    GLuint segment_command_buffer;
+    create_ssbo(segment_command_buffer, max_id_segments * sizeof(GLuint) * 5, "Cull", "segment_command_buffer");
+    GLuint render_packed_ids_program = create_shader_program(render_vs_source, render_fs_source, "#define PACKED_IDS\n", "Cull", "render");
+
+    GLuint compact_instance_tbo;
+    glGenTextures(1, &compact_instance_tbo);
+    glBindTexture(GL_TEXTURE_BUFFER, compact_instance_tbo);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, compact_instance_ssbo);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    gpu_memory.track(GpuMemoryRegistry::TEXTURE, compact_instance_tbo, "Fetch", "compact_instance_tbo (view of compact_instance_ssbo)", 0);
+
+    GLuint attribute_fetch_vao;
+    glGenVertexArrays(1, &attribute_fetch_vao);
+    if (has_compute) { // 压缩副本是SSBO, 3.3上没有
+        glBindVertexArray(attribute_fetch_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, compact_instance_ssbo);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, position_radius));
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, size));
+        glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(InstanceData), (void*)offsetof(InstanceData, color));
+        for (GLuint a = 1; a <= 3; ++a) {
+            glVertexAttribDivisor(a, 1);
+            glEnableVertexAttribArray(a);
+        }
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadEBO);
+        glBindVertexArray(0);
+    }
+
+    FrameCapture capture;
+    capture.init();
+
+    Camera camera;
+    GpuTimer cull_timer, draw_timer, bvh_timer, query_timer;
+    cull_timer.init();
+    draw_timer.init();
+    bvh_timer.init();
+    query_timer.init();
+    StatsReadback stats;
+    stats.init();
+
+    // 空间查询和命中描边; 描边的id: 前MAX_QUERY_HITS个给悬停, 后面给框选
+    SpatialQueries spatial_queries;
+    GLuint highlight_program = 0, rect_outline_program = 0, highlight_id_ssbo = 0;
+    if (has_compute) {
+        spatial_queries.init(get_compute_program(spatial_query_cs_source, "", "Spatial Query", "spatial_query_cs"), get_compute_program(spatial_query_cs_source, "#define USE_BVH\n", "Spatial Query", "spatial_query_cs"));
+        highlight_program = create_shader_program(highlight_vs_source, render_fs_source, "", "Spatial Query", "highlight");
+        rect_outline_program = create_shader_program(highlight_vs_source, render_fs_source, "#define RECT_OUTLINE\n", "Spatial Query", "highlight");
+        create_ssbo(highlight_id_ssbo, 2 * MAX_QUERY_HITS * sizeof(GLuint), "Spatial Query", "highlight_id_ssbo");
+    }
+    FeedbackCounter tf_counter;
+    tf_counter.init();
+    PersistentCommandRing cpu_command_ring;
+    if (has_compute) cpu_command_ring.init(); // glBufferStorage是4.4
+    std::vector<GLuint> cpu_visible_ids;
+    MaskedOcclusionBuffer occlusion;
+    occlusion.init();
+    CullPipeline cull_pipeline;
+    cull_pipeline.init();
+    AsyncUploader uploader;
+    if (has_compute && forced_upload_thread != 0 && !uploader.init(window)) {
+        std::cerr << "No shared upload context, scene uploads stay on the render thread" << std::endl;
+    }
+
+    ClusteredInstances clustered;
+    PageStreamer pager;
+    bool pager_ready = false, pager_failed = false; // 第一次打开分页时才读页表 (没有就生成)
+
+    // --- 主循环 ---
+    RenderMode current_mode = forced_mode >= 0 ? (RenderMode)forced_mode : MICRO_BATCH_INDIRECT;
+    CullTest cull_test = CULL_TEST_POINT_2D;
+    bool multiview_enabled = false;
+    bool multiview_single_dispatch = true;
+    int view_count = 4;
+    bool lod_enabled = false;
+    float lod_error_px = 4.0f;
+    bool chain_enabled = false;
+    bool persistent_enabled = false;
+    int persistent_groups = 128; // GL查不到SM/CU数, 由用户调到刚好填满GPU
+    bool paging_enabled = false;     // 实例化间接: 页从磁盘流进instance_ssbo
+    bool paging_active = false;      // instance_ssbo现在是不是页池
+    bool dynamic_enabled = false;
+    int spawn_per_frame = 2000;
+    int kill_per_frame = 2000;
+    bool defrag_enabled = true;
+    float defrag_threshold = 0.25f;
+    int dynamic_count = -1;     // 分配器按哪个element_count初始化的, -1表示未启用
+    GLuint dynamic_slot_bound = 0; // 槽位 (high_water) 的上界, instance_storage提交到这里
+    int dynamic_frames = 0;        // 重置之后连续跑了几帧动态模式
+    GLuint recent_spawns[StatsReadback::RING_SIZE] = {}; // 最近几帧的spawn数, 回读落后多少帧就要补多少
+    int last_defrag_frame = -StatsReadback::RING_SIZE;
+    int defrag_runs = 0;
+    std::mt19937 churn_rng(12345);
+    int scene_generation = 0; // 每次重新生成实例加一, 让依赖旧数据的缓存失效
+    // 换场景 (元素数/分布/种子) 的上传: 有上传线程时在后台分簇+上传, 期间照旧画原来的场景
+    bool async_scene_upload = uploader.active;
+    bool regenerate_pending = false;  // 换了分布/种子, 下一次换场景时重新生成instance_cpu_data (元素数可能没变)
+    bool scene_load_regenerates = false; // 在途的这次换场景是否重新生成了instance_cpu_data
+    int scene_ticket = -1;            // 在途的后台上传, -1表示没有
+    int scene_shown_count = 0;        // 后台上传期间画的元素数 (原来的场景)
+    int scene_load_start_frame = 0;
+    ClusteredInstances pending_clustered; // 上传线程分簇的结果, 完成时和clustered交换
+    GLuint scene_landing_buffer = 0;      // 上传线程拷到这里, 完成后渲染线程再GPU拷进instance_ssbo
+    GLsync landing_fence = nullptr;       // 渲染线程最后一次从landing拷贝, 上传线程再写之前要等
+    float scene_load_render_ms = 0.0f;    // 最近一次换场景花在渲染线程上的时间 (开始 + 完成两帧之和)
+    float scene_load_worker_ms = 0.0f;    // 同一次在上传线程上的时间
+    int scene_load_frames = 0;            // 从开始到换过去用了几帧
+    int scene_loads = 0;
+    bool bitmask_cull_enabled = false;
+    bool visibility_mask_valid = false; // 上一帧是否写出了可用的可见性位图
+    FrameUniforms last_mask_uniforms = {};
+    int last_mask_config[5] = {};     // cull_test, use_lod, use_dynamic, element_count, scene_generation
+    float last_mask_lod_error = 0.0f;
+    bool temporal_reuse = false;
+    bool tf_query_draw = !has_feedback_draw; // 变换反馈模式: 读回查询个数再实例化绘制, 而不是glDrawTransformFeedback
+    FetchBackend fetch_backend = forced_fetch >= 0 ? (FetchBackend)forced_fetch : FETCH_SSBO;
+    bool fused_compaction = false; // 剔除时直接写可见实例的压缩副本, 绘制不再经过visible_ids
+    bool packed_ids_enabled = false; // 可见id存成 (段, 16位偏移)
+    bool use_packed_ids = false;     // 本帧实际用了没有 (给基准记录)
+    bool occlusion_enabled = false;  // CPU剔除模式: 视锥之后再测遮挡缓冲
+    float occluder_min_px = 16.0f;   // 遮挡缓冲像素
+    int max_occluders = 1024;
+    bool occlusion_avx2 = occlusion.avx2_supported;
+    bool use_occlusion = false;
+    bool bvh_enabled = false;        // 实例化间接: LBVH遍历代替逐实例的平铺剔除
+    bool drift_enabled = false;      // 让实例动起来, BVH每帧refit
+    float drift_speed = 0.05f;       // 世界单位/秒
+    float bvh_rebuild_ratio = 1.5f;  // refit后表面积涨到上次重建时的这么多倍就重建
+    bool bvh_dirty = true;           // instance_ssbo重新上传过
+    bool instances_drifted = false;  // instance_ssbo被漂移改过, 和CPU上的副本对不上了
+    int bvh_built_frame = -StatsReadback::RING_SIZE;
+    uint64_t bvh_base_area = 0;      // 重建那一帧的表面积 (隔RING_SIZE帧才读得到)
+    float bvh_quality = 1.0f;
+    int bvh_rebuilds = 0;
+    enum { QUERY_TAG_HOVER, QUERY_TAG_SELECT };
+    bool hover_query_enabled = true; // 鼠标下的实例: 每帧一个点查询
+    bool selecting = false;          // 左键拖拽框选中
+    bool hovering = false;
+    glm::vec2 select_start(0.0f), select_end(0.0f);
+    SpatialQueryResult hover_result = {}, select_result = {};
+    std::vector<SpatialQueryResult> query_results;
+    float frame_time = 0.0f;
+    float cpu_cull_ms = 0.0f, cpu_submit_ms = 0.0f; // 只有CPU剔除的两种基线模式才有
+    bool pipelined_cull = false;   // CPU剔除放到工作线程上, 和提交重叠, 落后一帧
+    float cpu_cull_wait_ms = 0.0f; // 渲染线程为剔除结果阻塞的时间 (同步剔除时就是剔除时间)
+    unsigned int gpu_draw_calls = 0;
+    int frame_index = 0;
+    bool capture_key_down = false;
+
+    // 录制/回放的参数表: 相机 + 所有会影响性能的开关和滑杆
+    ParameterTrace trace;
+    trace.add("camera.perspective", &camera.perspective);
+    trace.add("camera.ortho_center.x", &camera.ortho_center.x);
+    trace.add("camera.ortho_center.y", &camera.ortho_center.y);
+    trace.add("camera.ortho_zoom", &camera.ortho_zoom);
+    trace.add("camera.position.x", &camera.position.x);
+    trace.add("camera.position.y", &camera.position.y);
+    trace.add("camera.position.z", &camera.position.z);
+    trace.add("camera.yaw", &camera.yaw);
+    trace.add("camera.pitch", &camera.pitch);
+    trace.add("camera.fov_y", &camera.fov_y);
+    trace.add("element_count", &element_count);
+    trace.add("current_mode", (int*)&current_mode);
+    trace.add("cull_test", (int*)&cull_test);
+    trace.add("distribution", (int*)&distribution);
+    trace.add("seed", &seed);
+    trace.add("multiview_enabled", &multiview_enabled);
+    trace.add("multiview_single_dispatch", &multiview_single_dispatch);
+    trace.add("view_count", &view_count);
+    trace.add("lod_enabled", &lod_enabled);
+    trace.add("lod_error_px", &lod_error_px);
+    trace.add("chain_enabled", &chain_enabled);
+    trace.add("persistent_enabled", &persistent_enabled);
+    trace.add("persistent_groups", &persistent_groups);
+    trace.add("paging_enabled", &paging_enabled);
+    trace.add("dynamic_enabled", &dynamic_enabled);
+    trace.add("spawn_per_frame", &spawn_per_frame);
+    trace.add("kill_per_frame", &kill_per_frame);
+    trace.add("defrag_enabled", &defrag_enabled);
+    trace.add("defrag_threshold", &defrag_threshold);
+    trace.add("bitmask_cull_enabled", &bitmask_cull_enabled);
+    trace.add("tf_query_draw", &tf_query_draw);
+    trace.add("fetch_backend", (int*)&fetch_backend);
+    trace.add("fused_compaction", &fused_compaction);
+    trace.add("packed_ids_enabled", &packed_ids_enabled);
+    trace.add("occlusion_enabled", &occlusion_enabled);
+    trace.add("occluder_min_px", &occluder_min_px);
+    trace.add("max_occluders", &max_occluders);
+    trace.add("occlusion_avx2", &occlusion_avx2);
+    trace.add("pipelined_cull", &pipelined_cull);
+    trace.add("async_scene_upload", &async_scene_upload);
+    trace.add("bvh_enabled", &bvh_enabled);
+    trace.add("drift_enabled", &drift_enabled);
+    trace.add("drift_speed", &drift_speed);
+    trace.add("bvh_rebuild_ratio", &bvh_rebuild_ratio);
+    trace.add("hover_query_enabled", &hover_query_enabled);
+    std::string trace_path = !replay_path.empty() ? replay_path : (!record_path.empty() ? record_path : "trace.csv");
+    if (!record_path.empty() && !trace.start_recording(record_path)) {
+        std::cerr << "Cannot write trace: " << record_path << std::endl;
+    }
+    if (!replay_path.empty() && !trace.load(replay_path)) {
+        std::cerr << "Cannot read trace: " << replay_path << std::endl;
+        if (bench_mode) return 1;
+    }
+    const int bench_frames = (int)trace.rows.size();
+    BenchReport bench;
+    if (crossover_sweep) {
+        const int sweep_counts[] = { 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000 };
+        for (int count : sweep_counts) {
+            for (RenderMode mode : { INSTANCED_INDIRECT, VS_CULL }) {
+                BenchReport::Run run;
+                run.mode = mode;
+                run.count = count;
+                bench.runs.push_back(run);
+            }
+        }
+    } else if (compaction_sweep) {
+        // 正交缩放z下可见比例约为1/z^2: 100% .. 0.1%
+        const float sweep_zooms[] = { 1.0f, 1.414f, 2.0f, 3.162f, 5.0f, 10.0f, 31.62f };
+        for (float zoom : sweep_zooms) {
+            for (int fused = 0; fused < 2; ++fused) {
+                BenchReport::Run run;
+                run.mode = INSTANCED_INDIRECT;
+                run.fetch = forced_fetch;
+                run.fused = fused;
+                run.zoom = zoom;
+                bench.runs.push_back(run);
+            }
+        }
+    } else if (forced_packed == 2) {
+        for (int packed = 0; packed < 2; ++packed) {
+            BenchReport::Run run;
+            run.mode = INSTANCED_INDIRECT;
+            run.packed = packed;
+            bench.runs.push_back(run);
+        }
+    } else if (forced_occlusion == 2) {
+        for (int enabled = 0; enabled < 2; ++enabled) {
+            BenchReport::Run run;
+            run.mode = forced_mode == DIRECT_DRAWS ? DIRECT_DRAWS : CPU_MDI;
+            run.occlusion = enabled;
+            bench.runs.push_back(run);
+        }
+    } else if (forced_upload_thread == 2) {
+        // 换场景的卡顿: 轨迹里要有元素数/分布/种子的变化
+        for (int enabled = 0; enabled < 2; ++enabled) {
+            BenchReport::Run run;
+            run.mode = forced_mode;
+            run.async_upload = enabled;
+            bench.runs.push_back(run);
+        }
+    } else if (forced_cull_thread == 2) {
+        for (int enabled = 0; enabled < 2; ++enabled) {
+            BenchReport::Run run;
+            run.mode = forced_mode == DIRECT_DRAWS ? DIRECT_DRAWS : CPU_MDI;
+            run.occlusion = forced_occlusion;
+            run.pipelined = enabled;
+            bench.runs.push_back(run);
+        }
+    } else if (fetch_sweep) {
+        for (int f = 0; f < FETCH_COUNT; ++f) {
+            BenchReport::Run run;
+            run.mode = INSTANCED_INDIRECT;
+            run.fetch = f;
+            bench.runs.push_back(run);
+        }
+    } else {
+        BenchReport::Run run;
+        run.mode = forced_mode;
+        run.fetch = forced_fetch;
+        run.packed = forced_packed;
+        run.occlusion = forced_occlusion;
+        run.pipelined = forced_cull_thread;
+        bench.runs.push_back(run);
+    }
+    // --- 渲染线程的一帧 ---
+    // 参数全部来自包里的拷贝, 用同名的局部变量遮住UI线程上的那一份, 下面的代码只碰渲染线程自己的状态
+    double last_swap_time = 0.0;
+    auto render_frame = [&](FramePacket& packet, float wait_ms) {
+        const double render_start = glfwGetTime();
+        const FrameSettings& settings = packet.settings;
+        const Camera& camera = settings.camera;
+        int element_count = settings.element_count; // 后台换场景期间停在原来的值
+        const RenderMode current_mode = settings.current_mode;
+        const CullTest cull_test = settings.cull_test;
+        const InstanceDistribution distribution = settings.distribution;
+        const int seed = settings.seed;
+        const bool multiview_enabled = settings.multiview_enabled;
+        const bool multiview_single_dispatch = settings.multiview_single_dispatch;
+        const int view_count = settings.view_count;
+        const bool lod_enabled = settings.lod_enabled;
+        const float lod_error_px = settings.lod_error_px;
+        const bool chain_enabled = settings.chain_enabled;
+        const bool persistent_enabled = settings.persistent_enabled;
+        int persistent_groups = settings.persistent_groups;
+        const bool paging_enabled = settings.paging_enabled;
+        const bool dynamic_enabled = settings.dynamic_enabled;
+        const int spawn_per_frame = settings.spawn_per_frame;
+        const int kill_per_frame = settings.kill_per_frame;
+        const bool defrag_enabled = settings.defrag_enabled;
+        const float defrag_threshold = settings.defrag_threshold;
+        const bool bitmask_cull_enabled = settings.bitmask_cull_enabled;
+        const bool tf_query_draw = settings.tf_query_draw;
+        const FetchBackend fetch_backend = settings.fetch_backend;
+        const bool fused_compaction = settings.fused_compaction;
+        const bool packed_ids_enabled = settings.packed_ids_enabled;
+        const bool occlusion_enabled = settings.occlusion_enabled;
+        const float occluder_min_px = settings.occluder_min_px;
+        const int max_occluders = settings.max_occluders;
+        const bool occlusion_avx2 = settings.occlusion_avx2;
+        const bool pipelined_cull = settings.pipelined_cull;
+        const bool async_scene_upload = settings.async_scene_upload;
+        const bool bvh_enabled = settings.bvh_enabled;
+        const bool drift_enabled = settings.drift_enabled;
+        const float drift_speed = settings.drift_speed;
+        const float bvh_rebuild_ratio = settings.bvh_rebuild_ratio;
+        const bool hover_query_enabled = settings.hover_query_enabled;
+        const int frame_index = packet.frame_index;
+        const float frame_time = packet.frame_time;
+        const int fb_width = packet.fb_width, fb_height = packet.fb_height;
+        const float aspect = fb_height > 0 ? (float)fb_width / fb_height : 1.0f;
+
+        glViewport(0, 0, fb_width, fb_height);
+        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        stats.begin_frame();
+        if (packet.capture_shot) capture.single_shot = true;
+        capture.recording = packet.capture_recording;
+        capture.format = packet.capture_format;
+
+        // --- 每帧常量: 矩阵和视锥平面只传一次 ---
+        FrameUniforms frame_uniforms = camera.frame_uniforms(aspect);
+        glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame_uniforms);
+        glBindBufferBase(GL_UNIFORM_BUFFER, 0, frame_ubo);
+
+        // --- 换了分布或种子: 记下来, 由下面换场景时重新生成 (后台上传时在上传线程上生成) ---
+        regenerate_pending |= packet.regenerate;
+
+        const bool use_dynamic = dynamic_enabled && current_mode == INSTANCED_INDIRECT && !multiview_enabled;
+        if (!use_dynamic && dynamic_count != -1) {
+            // 退出动态模式: instance_ssbo已被spawn/整理改写, 重新上传分簇后的前缀
+            dynamic_count = -1;
+            clustered.count = -1;
+        }
+        // --- 分页: 第一次打开时读页表, 没有页文件就在后台生成一个, 生成完之前照旧画分簇的场景 ---
+        if (paging_enabled && has_compute && !pager_ready && !pager_failed) {
+            int generate = pager.poll_generate();
+            if (generate == PageStreamer::GENERATE_IDLE) {
+                pager_ready = pager.init(page_file_path);
+                if (!pager_ready) pager.generate_async(page_file_path, page_grid, page_capacity, seed, page_packed);
+            } else if (generate == PageStreamer::GENERATE_DONE) {
+                pager_ready = pager.init(page_file_path);
+                pager_failed = !pager_ready;
+            } else if (generate == PageStreamer::GENERATE_FAILED) {
+                pager_failed = true;
+            }
+            if (pager_failed) std::cerr << "Cannot open or write page file: " << page_file_path << std::endl;
+        }
+        const bool use_paging = paging_enabled && pager_ready && current_mode == INSTANCED_INDIRECT && !multiview_enabled && !use_dynamic;
+        if (use_paging != paging_active) {
+            // 进入: 池从空开始, 簇缓冲换成页表; 离开: 重新上传分簇后的实例
+            if (use_paging) {
+                pager.reset(cluster_range_ssbo, cluster_bounds_ssbo, impostor_ssbo);
+                instance_storage.release_from(0); // 池槽在页第一次放进去时才提交
+            } else {
+                clustered.count = -1;
+            }
+            paging_active = use_paging;
+        }
+        const bool use_bvh = bvh_enabled && current_mode == INSTANCED_INDIRECT && !multiview_enabled && !use_dynamic && !use_paging
+            && !lod_enabled && !chain_enabled && !bitmask_cull_enabled;
+        const bool use_drift = drift_enabled && use_bvh;
+        if (instances_drifted && !use_drift) {
+            // 停止漂移: 换回CPU上的那份, 其他模式和簇包围球都按它来
+            instances_drifted = false;
+            clustered.count = -1;
+        }
+
+        // --- 元素数变化/重新生成: 重新分簇, 上传重排后的实例, 归约出簇包围球和impostor ---
+        // 后台上传要求instance_ssbo里原来的场景还完整 (clustered.count >= 0), 否则 (刚启动, 退出动态/分页/漂移) 同步做.
+        // 后台上传期间元素数停在原来的值, 完成那一帧才换成新场景
+        bool scene_ready = false;
+        double scene_start = glfwGetTime();
+        // 动态模式下instance_ssbo在被spawn/kill改写, 分配器状态和原来的场景绑在一起, 只能同步换
+        if (!use_paging && scene_ticket < 0 && (clustered.count != element_count || regenerate_pending)) {
+            scene_load_regenerates = regenerate_pending;
+            regenerate_pending = false;
+            scene_load_start_frame = frame_index;
+            scene_load_worker_ms = 0.0f;
+            if (async_scene_upload && clustered.count >= 0 && !use_dynamic) {
+                if (!scene_landing_buffer) {
+                    scene_landing_buffer = gpu_memory.create_buffer(GL_COPY_WRITE_BUFFER, MAX_ELEMENTS * sizeof(InstanceData), nullptr,
+                        GL_STATIC_COPY, "Upload", "scene landing buffer");
+                }
+                // 上传线程手上有票据时渲染线程不碰instance_cpu_data
+                const int count = element_count;
+                const bool regenerate_data = scene_load_regenerates;
+                const InstanceDistribution dist = distribution;
+                const uint32_t data_seed = seed;
+                scene_ticket = uploader.submit([&pending_clustered, &instance_cpu_data, count, regenerate_data, dist, data_seed] {
+                    if (regenerate_data) generate_instances(dist, data_seed, instance_cpu_data);
+                    build_clusters(instance_cpu_data, count, pending_clustered);
+                    return std::make_pair((const void*)pending_clustered.instances.data(), (GLsizeiptr)(count * sizeof(InstanceData)));
+                }, scene_landing_buffer, 0, landing_fence);
+                landing_fence = nullptr;
+                scene_shown_count = clustered.count;
+                scene_load_render_ms = (float)((glfwGetTime() - scene_start) * 1000.0);
+            } else {
+                cull_pipeline.flush(); // 剔除线程可能还在读旧的clustered.instances
+                if (scene_load_regenerates) {
+                    generate_instances(distribution, seed, instance_cpu_data);
+                    scene_generation++;
+                }
+                build_clusters(instance_cpu_data, element_count, clustered);
+                instance_storage.ensure(0, element_count);
+                instance_storage.release_from(element_count);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, instance_ssbo);
+                glBufferSubData(GL_COPY_WRITE_BUFFER, 0, element_count * sizeof(InstanceData), clustered.instances.data());
+                scene_load_render_ms = 0.0f;
+                scene_ready = true;
+            }
+        }
+        if (scene_ticket >= 0) {
+            if (uploader.poll(scene_ticket)) {
+                scene_ticket = -1;
+                scene_start = glfwGetTime();
+                scene_load_worker_ms = uploader.last_worker_ms;
+                if (scene_load_regenerates) scene_generation++;
+                if (!use_paging) { // 期间进了分页: instance_ssbo是页池, 结果作废, 退出分页时会同步重建
+                    cull_pipeline.flush();
+                    std::swap(clustered, pending_clustered);
+                    instance_storage.ensure(0, clustered.count);
+                    instance_storage.release_from(clustered.count);
+                    glBindBuffer(GL_COPY_READ_BUFFER, scene_landing_buffer);
+                    glBindBuffer(GL_COPY_WRITE_BUFFER, instance_ssbo);
+                    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, clustered.count * sizeof(InstanceData));
+                    landing_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                    glFlush(); // 上传线程的上下文要等这个fence
+                    element_count = clustered.count;
+                    scene_ready = true;
+                }
+            } else if (!use_paging) {
+                element_count = scene_shown_count;
+            }
+        }
+        if (scene_ready) {
+            // 前count个槽换成了新场景: 动态分配器 (活着的位图/空闲栈/high_water) 在动态块里按新场景重置
+            dynamic_count = -1;
+            if (has_compute) {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, cluster_range_ssbo);
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, clustered.clusters.size() * sizeof(ClusterRange), clustered.clusters.data());
+
+                glUseProgram(cluster_reduce_program);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, cluster_range_ssbo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cluster_bounds_ssbo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, impostor_ssbo);
+                glDispatchCompute((GLuint)clustered.clusters.size(), 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            }
+            bvh_dirty = true;
+            scene_load_render_ms += (float)((glfwGetTime() - scene_start) * 1000.0);
+            scene_load_frames = frame_index - scene_load_start_frame + 1;
+            scene_loads++;
+            if (bench_mode) {
+                BenchReport::Run& run = bench.runs[packet.bench_run];
+                run.scene_load_render_ms.push_back(scene_load_render_ms);
+                run.scene_load_worker_ms.push_back(scene_load_worker_ms);
+                run.scene_load_frames.push_back((float)scene_load_frames);
+            }
+        }
+        // 分页靠簇LOD出请求和占位, 靠链式管线只剔除池里的页
+        const bool use_lod = (lod_enabled && current_mode == INSTANCED_INDIRECT && !multiview_enabled && !use_dynamic) || use_paging;
+        const bool use_chain = (chain_enabled && current_mode == INSTANCED_INDIRECT && !multiview_enabled && !use_dynamic) || use_paging;
+        const GLuint cluster_count = use_paging ? (GLuint)pager.page_count() : (GLuint)clustered.clusters.size();
+        // 实例槽位范围的上界: 动态模式的槽位和分页的池都可能用到MAX_ELEMENTS
+        const GLuint slot_bound = (use_dynamic || use_paging) ? MAX_ELEMENTS : (GLuint)element_count;
+        if (use_paging) {
+            glm::vec3 focus = camera.perspective ? camera.position : glm::vec3(camera.ortho_center, 0.0f);
+            pager.poll_feedback(focus);
+            pager.upload(instance_storage, cluster_range_ssbo, get_compute_program(page_decode_cs_source, "", "Paging", "page_decode_cs"), frame_index);
+        }
+
+        // --- 动态实例: kill -> spawn -> fixup, 必要时整理碎片 ---
+        bool slots_changed = false; // 槽位内容变了, 上一帧的可见性位图作废
+        if (use_dynamic) {
+            slots_changed = spawn_per_frame > 0 || kill_per_frame > 0;
+            if (dynamic_count != element_count) {
+                // 前element_count个槽位活着, 空闲栈为空
+                std::vector<GLuint> alive_words(ALIVE_MASK_WORDS, 0);
+                for (int i = 0; i < element_count; ++i) alive_words[i >> 5] |= 1u << (i & 31);
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, alive_mask_ssbo);
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, alive_words.size() * sizeof(GLuint), alive_words.data());
+                SlotAllocatorHeader header = { 0, (GLuint)element_count, (GLuint)element_count, 0,
+                    { (GLuint)(element_count + 255) / 256, 1, 1 }, 0 };
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot_allocator_buffer);
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), &header);
+                dynamic_count = element_count;
+                dynamic_slot_bound = element_count;
+                dynamic_frames = 0;
+            }
+            // spawn只会取空闲栈里的槽或者high_water往上加, 所以每帧最多往上长spawn_per_frame个槽.
+            // 回读到的high_water是RING_SIZE帧之前的, 加上那之后的spawn数也是上界, 整理过碎片后靠它收回来
+            dynamic_slot_bound = std::min<GLuint>(MAX_ELEMENTS, dynamic_slot_bound + spawn_per_frame);
+            if (dynamic_frames >= StatsReadback::RING_SIZE) {
+                GLuint spawned = spawn_per_frame;
+                for (GLuint n : recent_spawns) spawned += n;
+                dynamic_slot_bound = std::min(dynamic_slot_bound, stats.values[STAT_HIGH_WATER] + spawned);
+            }
+            recent_spawns[dynamic_frames % StatsReadback::RING_SIZE] = spawn_per_frame;
+            dynamic_frames++;
+            instance_storage.ensure(0, dynamic_slot_bound);
+            instance_storage.release_from(dynamic_slot_bound);
+
+            // 请求由UI线程随机生成, 个数和spawn_per_frame/kill_per_frame一致
+            const std::vector<InstanceData>& spawn_requests = packet.spawn_requests;
+            const std::vector<GLuint>& kill_requests = packet.kill_requests;
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, slot_allocator_buffer); // SLOT_ALLOCATOR_BINDING
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, alive_mask_ssbo);       // ALIVE_MASK_BINDING
+            if (kill_per_frame > 0) {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, kill_request_ssbo);
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, kill_per_frame * sizeof(GLuint), kill_requests.data());
+                glUseProgram(slot_kill_program);
+                glUniform1ui(glGetUniformLocation(slot_kill_program, "kill_count"), kill_per_frame);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, kill_request_ssbo);
+                glDispatchCompute((kill_per_frame + 255) / 256, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            }
+            if (spawn_per_frame > 0) {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, spawn_request_ssbo);
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, spawn_per_frame * sizeof(InstanceData), spawn_requests.data());
+                glUseProgram(slot_spawn_program);
+                glUniform1ui(glGetUniformLocation(slot_spawn_program, "spawn_count"), spawn_per_frame);
+                glUniform1ui(glGetUniformLocation(slot_spawn_program, "slot_capacity"), MAX_ELEMENTS);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, spawn_request_ssbo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, instance_ssbo);
+                glDispatchCompute((spawn_per_frame + 255) / 256, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            }
+            glUseProgram(slot_fixup_program);
+            glUniform1ui(glGetUniformLocation(slot_fixup_program, "slot_capacity"), MAX_ELEMENTS);
+            glDispatchCompute(1, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+            // 碎片率来自几帧前的回读; 整理后等回读追上再判断, 免得连续触发
+            GLuint high_water = stats.values[STAT_HIGH_WATER];
+            bool fragmented = high_water > 0 && (float)stats.values[STAT_FREE_SLOTS] / high_water > defrag_threshold;
+            if (defrag_enabled && fragmented && frame_index - last_defrag_frame > StatsReadback::RING_SIZE) {
+                glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, slot_allocator_buffer);
+
+                glUseProgram(defrag_scan_program);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, defrag_offset_ssbo);
+                glDispatchCompute(1, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+                glUseProgram(defrag_scatter_program);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, defrag_scratch_ssbo);
+                glDispatchComputeIndirect(offsetof(SlotAllocatorHeader, cull_dispatch));
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+                glUseProgram(defrag_commit_program);
+                glDispatchComputeIndirect(offsetof(SlotAllocatorHeader, cull_dispatch));
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+                glUseProgram(defrag_reset_program);
+                glUniform1ui(glGetUniformLocation(defrag_reset_program, "slot_capacity"), MAX_ELEMENTS);
+                glDispatchCompute(1, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+                last_defrag_frame = frame_index;
+                slots_changed = true;
+                defrag_runs++;
+            }
+
+            stats.copy(slot_allocator_buffer, offsetof(SlotAllocatorHeader, alive_count), STAT_ALIVE_SLOTS);
+            stats.copy(slot_allocator_buffer, offsetof(SlotAllocatorHeader, high_water), STAT_HIGH_WATER);
+            stats.copy(slot_allocator_buffer, offsetof(SlotAllocatorHeader, free_top), STAT_FREE_SLOTS);
+            stats.copy(slot_allocator_buffer, offsetof(SlotAllocatorHeader, failed_spawns), STAT_FAILED_SPAWNS);
+        }
+
+        // --- 位图剔除: 相机/场景/剔除配置都没变时只重测上一帧可见的实例 ---
+        const bool use_bitmask = bitmask_cull_enabled && current_mode == INSTANCED_INDIRECT && !multiview_enabled && !use_chain;
+        const bool use_fused = fused_compaction && current_mode == INSTANCED_INDIRECT && !multiview_enabled;
+        const std::string compact_define = use_fused ? "#define WRITE_COMPACT\n" : "";
+        use_packed_ids = packed_ids_enabled && current_mode == INSTANCED_INDIRECT && !multiview_enabled && !use_chain && !use_bitmask
+            && !use_fused && !use_bvh && fetch_backend == FETCH_SSBO;
+        // 段数按元素范围的上界 (动态模式下槽位可以涨到MAX_ELEMENTS)
+        const GLuint id_segment_count = (slot_bound + ID_SEGMENT_SIZE - 1) / ID_SEGMENT_SIZE;
+        const int mask_config[5] = { (int)cull_test, (int)use_lod, (int)use_dynamic, element_count, scene_generation };
+        temporal_reuse = use_bitmask && visibility_mask_valid && !slots_changed
+            && memcmp(&frame_uniforms, &last_mask_uniforms, sizeof(FrameUniforms)) == 0
+            && memcmp(mask_config, last_mask_config, sizeof(mask_config)) == 0
+            && (!use_lod || lod_error_px == last_mask_lod_error);
+        const int mask_write = frame_index & 1;
+        if (use_bitmask) {
+            GLuint zero = 0;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibility_mask_ssbo[mask_write]);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, cull_load_stats_buffer);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+            last_mask_uniforms = frame_uniforms;
+            memcpy(last_mask_config, mask_config, sizeof(mask_config));
+            last_mask_lod_error = lod_error_px;
+        }
+        visibility_mask_valid = use_bitmask;
+
+        // --- LBVH: instance_ssbo重新上传过就重建; 实例在动就每帧refit, 表面积涨太多再重建 ---
+        if (use_bvh) {
+            const GLuint leaf_count = (GLuint)element_count;
+            const GLuint leaf_groups = (leaf_count + 255) / 256;
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, bvh_state_buffer);
+            if (use_drift) {
+                GLuint program = get_compute_program(drift_instances_cs_source, "", "LBVH", "drift_instances_cs");
+                glUseProgram(program);
+                glUniform1ui(glGetUniformLocation(program, "element_count"), leaf_count);
+                glUniform1f(glGetUniformLocation(program, "step_length"), drift_speed * frame_time);
+                glDispatchCompute(leaf_groups, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                instances_drifted = true;
+            }
+            // 重建那一帧的表面积RING_SIZE帧之后才读到, 之后的都和它比
+            const uint64_t surface_area = (uint64_t)stats.values[STAT_BVH_SURFACE_AREA_HIGH] << 32 | stats.values[STAT_BVH_SURFACE_AREA];
+            if (frame_index == bvh_built_frame + StatsReadback::RING_SIZE) bvh_base_area = surface_area;
+            bvh_quality = bvh_base_area ? (float)((double)surface_area / bvh_base_area) : 1.0f;
+            const bool rebuild = bvh_dirty || (use_drift && bvh_base_area && frame_index > bvh_built_frame + StatsReadback::RING_SIZE
+                && bvh_quality > bvh_rebuild_ratio);
+
+            if (rebuild || use_drift) {
+                bvh_timer.begin();
+                if (rebuild) {
+                    BvhStateHeader state_reset = { { ~0u, ~0u, ~0u }, { 0, 0, 0 }, 0, 0, 0, { 0, 1, 1 }, 0 };
+                    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvh_state_buffer);
+                    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(state_reset), &state_reset);
+
+                    GLuint program = get_compute_program(bvh_scene_bounds_cs_source, "", "LBVH", "bvh_scene_bounds_cs");
+                    glUseProgram(program);
+                    glUniform1ui(glGetUniformLocation(program, "leaf_count"), leaf_count);
+                    glDispatchCompute(leaf_groups, 1, 1);
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+                    program = get_compute_program(bvh_morton_cs_source, "", "LBVH", "bvh_morton_cs");
+                    glUseProgram(program);
+                    glUniform1ui(glGetUniformLocation(program, "leaf_count"), leaf_count);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bvh_key_ssbo[0]);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, bvh_value_ssbo[0]);
+                    glDispatchCompute(leaf_groups, 1, 1);
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+                    // 30位键, 每趟8位共4趟: 偶数趟, 结果回到[0]
+                    const GLuint radix_groups = (leaf_count + BVH_RADIX_TILE - 1) / BVH_RADIX_TILE;
+                    const char* radix_stages[3] = { "#define RADIX_HISTOGRAM\n", "#define RADIX_SCAN\n", "#define RADIX_SCATTER\n" };
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, radix_histogram_ssbo);
+                    for (int pass = 0; pass < 4; ++pass) {
+                        int src = pass & 1;
+                        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bvh_key_ssbo[src]);
+                        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, bvh_value_ssbo[src]);
+                        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bvh_key_ssbo[src ^ 1]);
+                        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, bvh_value_ssbo[src ^ 1]);
+                        for (int stage = 0; stage < 3; ++stage) {
+                            program = get_compute_program(radix_sort_cs_source, radix_stages[stage], "LBVH", "radix_sort_cs");
+                            glUseProgram(program);
+                            glUniform1ui(glGetUniformLocation(program, "element_count"), leaf_count);
+                            glUniform1ui(glGetUniformLocation(program, "shift"), pass * 8);
+                            glUniform1ui(glGetUniformLocation(program, "group_count"), radix_groups);
+                            glDispatchCompute(stage == 1 ? 1 : radix_groups, 1, 1);
+                            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                        }
+                    }
+
+                    program = get_compute_program(bvh_hierarchy_cs_source, "", "LBVH", "bvh_hierarchy_cs");
+                    glUseProgram(program);
+                    glUniform1ui(glGetUniformLocation(program, "leaf_count"), leaf_count);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bvh_key_ssbo[0]);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, bvh_value_ssbo[0]);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, bvh_node_ssbo);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bvh_parent_ssbo);
+                    glDispatchCompute(leaf_groups, 1, 1);
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+                    bvh_dirty = false;
+                    bvh_built_frame = frame_index;
+                    bvh_base_area = 0;
+                    bvh_rebuilds++;
+                }
+
+                // refit: 访问计数和表面积清零, 每个叶子一个线程往上走
+                GLuint zero = 0;
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvh_refit_visit_ssbo);
+                glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, (leaf_count - 1) * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvh_state_buffer);
+                glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, offsetof(BvhStateHeader, surface_area), 2 * sizeof(GLuint),
+                    GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+                GLuint program = get_compute_program(bvh_refit_cs_source, "", "LBVH", "bvh_refit_cs");
+                glUseProgram(program);
+                glUniform1ui(glGetUniformLocation(program, "leaf_count"), leaf_count);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, bvh_node_ssbo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bvh_parent_ssbo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, bvh_refit_visit_ssbo);
+                glDispatchCompute(leaf_groups, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                bvh_timer.end();
+            }
+            stats.copy(bvh_state_buffer, offsetof(BvhStateHeader, surface_area), STAT_BVH_SURFACE_AREA);
+            stats.copy(bvh_state_buffer, offsetof(BvhStateHeader, surface_area_high), STAT_BVH_SURFACE_AREA_HIGH);
+        }
+
+        // --- 空间查询: 鼠标下一个点查询, 左键拖拽时再加一个框选, 同一批跑; 有BVH就走BVH ---
+        if (has_compute) {
+            const bool query_allowed = !use_dynamic && !multiview_enabled && !use_paging;
+            const glm::vec2 cursor_ndc = packet.cursor_ndc;
+            const bool mouse_free = query_allowed && !packet.mouse_over_ui;
+            const bool left_down = packet.left_down;
+            if (!selecting && left_down && mouse_free) select_start = cursor_ndc;
+            selecting = left_down && (selecting || mouse_free);
+            if (selecting) select_end = cursor_ndc;
+            hovering = hover_query_enabled && mouse_free;
+
+            query_results.clear();
+            spatial_queries.poll(frame_index, query_results);
+            for (SpatialQueryResult& r : query_results) {
+                if (r.tag == QUERY_TAG_SELECT) select_result = std::move(r);
+                else if (hovering) hover_result = std::move(r);
+            }
+            if (!hovering) hover_result = {};
+            if (!query_allowed) select_result = {};
+            if (!query_results.empty()) {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, highlight_id_ssbo);
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, hover_result.ids.size() * sizeof(GLuint), hover_result.ids.data());
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, MAX_QUERY_HITS * sizeof(GLuint), select_result.ids.size() * sizeof(GLuint), select_result.ids.data());
+            }
+
+            if (hovering) spatial_queries.add_point(cursor_ndc, frame_uniforms.view_proj, QUERY_TAG_HOVER);
+            if (selecting && query_allowed) spatial_queries.add_rect(select_start, select_end, frame_uniforms.view_proj, QUERY_TAG_SELECT);
+            if (!spatial_queries.pending.empty()) {
+                query_timer.begin();
+                spatial_queries.submit(instance_ssbo, use_bvh ? bvh_node_ssbo : 0, element_count, frame_index);
+                query_timer.end();
+            }
+        }
+
+        cpu_cull_ms = cpu_submit_ms = cpu_cull_wait_ms = 0.0f;
+        use_occlusion = false;
+
+        // --- 多视图: 一次dispatch剔除所有视图, 再按视图绘制 ---
+        if (multiview_enabled && current_mode == INSTANCED_INDIRECT) {
+            MultiViewUniforms multiview_uniforms;
+            ViewRect view_rects[MAX_VIEWS];
+            build_views(camera, view_count, fb_width, fb_height, multiview_uniforms, view_rects);
+            glBindBuffer(GL_UNIFORM_BUFFER, multiview_ubo);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(MultiViewUniforms), &multiview_uniforms);
+            glBindBufferBase(GL_UNIFORM_BUFFER, 1, multiview_ubo);
+
+            // instanceCount兼做原子计数器, 每帧清零; baseInstance固定为各视图id段起点
+            GLuint view_commands[MAX_VIEWS][5];
+            for (int v = 0; v < view_count; ++v) {
+                GLuint cmd[5] = { 6, 0, 0, 0, (GLuint)(v * MAX_ELEMENTS) };
+                memcpy(view_commands[v], cmd, sizeof(cmd));
+            }
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, multiview_command_buffer);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, view_count * sizeof(view_commands[0]), view_commands);
+
+            GLuint program = get_compute_program(cull_multiview_cs_source, cull_test_defines[cull_test], "Multi-View", "cull_multiview_cs");
+            glUseProgram(program);
+            glUniform1ui(glGetUniformLocation(program, "total_element_count"), element_count);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, multiview_visible_id_ssbo);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, multiview_command_buffer);
+            unsigned int num_groups = (element_count + 255) / 256;
+
+            cull_timer.begin();
+            if (multiview_single_dispatch) {
+                glUniform1ui(glGetUniformLocation(program, "first_view"), 0);
+                glUniform1ui(glGetUniformLocation(program, "view_loop_count"), view_count);
+                glDispatchCompute(num_groups, 1, 1);
+            } else {
+                // 对照组: 每个视图单独dispatch一次, instance_ssbo被重复读view_count遍
+                glUniform1ui(glGetUniformLocation(program, "view_loop_count"), 1);
+                for (int v = 0; v < view_count; ++v) {
+                    glUniform1ui(glGetUniformLocation(program, "first_view"), v);
+                    glDispatchCompute(num_groups, 1, 1);
+                }
+            }
+            cull_timer.end();
+
+            glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+            if (camera.perspective) glEnable(GL_DEPTH_TEST);
+            glUseProgram(render_multiview_program);
+            glBindVertexArray(quadVAO);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, multiview_visible_id_ssbo);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, multiview_command_buffer);
+
+            draw_timer.begin();
+            if (has_viewport_layer_array) {
+                float viewports[MAX_VIEWS][4];
+                for (int v = 0; v < view_count; ++v) {
+                    viewports[v][0] = (float)view_rects[v].x;
+                    viewports[v][1] = (float)view_rects[v].y;
+                    viewports[v][2] = (float)view_rects[v].width;
+                    viewports[v][3] = (float)view_rects[v].height;
+                }
+                glViewportArrayv(0, view_count, &viewports[0][0]);
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, view_count, 0);
+                gpu_draw_calls = 1;
+            } else {
+                for (int v = 0; v < view_count; ++v) {
+                    glViewport(view_rects[v].x, view_rects[v].y, view_rects[v].width, view_rects[v].height);
+                    glUniform1ui(glGetUniformLocation(render_multiview_program, "view_index"), v);
+                    glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(uintptr_t)(v * sizeof(view_commands[0])));
+                }
+                gpu_draw_calls = view_count;
+            }
+            draw_timer.end();
+            glDisable(GL_DEPTH_TEST);
+            glViewport(0, 0, fb_width, fb_height);
+        } else if (current_mode == TF_CULL) {
+            // --- GL 3.3退路: 每个元素一个点, 不光栅化, GS只放出可见的点, 变换反馈把id写进缓冲 ---
+            const int tf_count = std::min(element_count, tf_max_elements);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_BUFFER, instance_tbo);
+            cull_timer.begin();
+            glUseProgram(tf_cull_programs[cull_test]);
+            glBindVertexArray(tf_cull_vao);
+            if (has_feedback_draw) glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tf_feedback);
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, tf_visible_id_buffer);
+            glEnable(GL_RASTERIZER_DISCARD);
+            tf_counter.begin();
+            glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS, 0, tf_count);
+            glEndTransformFeedback();
+            tf_counter.end();
+            glDisable(GL_RASTERIZER_DISCARD);
+            if (has_feedback_draw) glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+            cull_timer.end();
+
+            if (camera.perspective) glEnable(GL_DEPTH_TEST);
+            draw_timer.begin();
+            if (tf_query_draw) {
+                // 个数要读回CPU: 等剔除做完, 用它做实例数
+                GLuint visible = tf_counter.wait_latest();
+                glUseProgram(tf_render_instanced_program);
+                glBindVertexArray(tf_instanced_vao);
+                glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0, visible);
+            } else {
+                // 顶点数由变换反馈对象自己记着, 不经过CPU; 一个点GS展开成一个quad
+                glUseProgram(tf_render_points_program);
+                glBindVertexArray(tf_points_vao);
+                glDrawTransformFeedback(GL_POINTS, tf_feedback);
+            }
+            draw_timer.end();
+            gpu_draw_calls = 1;
+            glDisable(GL_DEPTH_TEST);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+        } else if (current_mode == VS_CULL) {
+            // --- VS剔除: 没有dispatch/barrier/计数器清零, 固定开销最低, 但每个实例都要过VS ---
+            // 剔除计时器照样开关一次 (空段), 计时环才能和帧对齐, GPU Cull显示为0
+            cull_timer.begin();
+            cull_timer.end();
+            if (camera.perspective) glEnable(GL_DEPTH_TEST);
+            glUseProgram(vs_cull_programs[cull_test]);
+            glBindVertexArray(quadVAO);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+            draw_timer.begin();
+            glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0, element_count);
+            draw_timer.end();
+            gpu_draw_calls = 1;
+            glDisable(GL_DEPTH_TEST);
+        } else if (current_mode == DIRECT_DRAWS || current_mode == CPU_MDI) {
+            // --- 基线: CPU剔除 (CPU这份数据和GPU上的前缀一样, 都是按簇排过序的) ---
+            // GPU上没有剔除, 剔除计时器照样开关一次 (空段), 计时环才能和帧对齐, GPU Cull显示为0
+            cull_timer.begin();
+            cull_timer.end();
+            // 正交2D不开深度测试, 后画的盖住先画的, 没有遮挡可言
+            use_occlusion = occlusion_enabled && camera.perspective;
+            if (pipelined_cull) {
+                // 工作线程剔除这一帧, 这里画它上一帧的结果; 计时取工作线程上的剔除时间
+                CullPipeline::Packet& result = cull_pipeline.submit_and_receive(frame_index, clustered.instances, element_count,
+                    frame_uniforms, cull_test, use_occlusion, occluder_min_px, max_occluders, occlusion_avx2);
+                // 冷启动后的下一帧会再画同一个结果, 所以拷贝而不是交换 (容量留着, 稳态不分配)
+                cpu_visible_ids.assign(result.visible_ids.begin(), result.visible_ids.end());
+                cpu_cull_ms = result.cull_ms;
+                cpu_cull_wait_ms = cull_pipeline.wait_ms;
+                if (result.occlusion) {
+                    occlusion.occluder_count = result.occluder_count;
+                    occlusion.tested = result.tested;
+                    occlusion.rejected = result.rejected;
+                    occlusion.raster_ms = result.raster_ms;
+                    occlusion.test_ms = result.test_ms;
+                }
+            } else {
+                double cull_start = glfwGetTime();
+                cpu_visible_ids.clear();
+                for (int i = 0; i < element_count; ++i) {
+                    if (cpu_is_visible(clustered.instances[i], frame_uniforms, cull_test)) cpu_visible_ids.push_back(i);
+                }
+                if (use_occlusion) {
+                    occlusion.cull(clustered.instances, frame_uniforms, cpu_visible_ids, occluder_min_px, max_occluders, occlusion_avx2);
+                }
+                cpu_cull_ms = (float)((glfwGetTime() - cull_start) * 1000.0);
+                cpu_cull_wait_ms = cpu_cull_ms;
+            }
+
+            if (camera.perspective) glEnable(GL_DEPTH_TEST);
+            glUseProgram(render_program);
+            glUniform1i(glGetUniformLocation(render_program, "is_instanced_mode"), 0);
+            glBindVertexArray(quadVAO);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+
+            double submit_start = glfwGetTime();
+            draw_timer.begin();
+            if (current_mode == DIRECT_DRAWS) {
+                // 实例id走baseInstance, 和微批次模式的VS路径完全相同
+                for (GLuint id : cpu_visible_ids) {
+                    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0, 1, id);
+                }
+            } else {
+                GLuint* commands = cpu_command_ring.begin_segment();
+                for (size_t i = 0; i < cpu_visible_ids.size(); ++i) {
+                    GLuint* cmd = commands + i * 5;
+                    cmd[0] = 6; cmd[1] = 1; cmd[2] = 0; cmd[3] = 0; cmd[4] = cpu_visible_ids[i];
+                }
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, cpu_command_ring.buffer);
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)cpu_command_ring.segment_offset(), (GLsizei)cpu_visible_ids.size(), 0);
+                cpu_command_ring.end_segment();
+            }
+            draw_timer.end();
+            cpu_submit_ms = (float)((glfwGetTime() - submit_start) * 1000.0);
+            gpu_draw_calls = current_mode == DIRECT_DRAWS ? (unsigned int)cpu_visible_ids.size() : 1;
+            glDisable(GL_DEPTH_TEST);
+        } else {
+
+            // --- 剔除与指令生成 ---
+            GLuint zero = 0;
+            glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counter_buffer);
+            glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &zero);
+
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+            glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, (current_mode == MICRO_BATCH_INDIRECT ? 2 : 3), counter_buffer);
+
+            unsigned int num_groups = (element_count + 255) / 256;
+
+            cull_timer.begin();
+            if (current_mode == MICRO_BATCH_INDIRECT) {
+                GLuint program = get_compute_program(cull_microbatch_cs_source, cull_test_defines[cull_test], "Cull", "cull_microbatch_cs");
+                glUseProgram(program);
+                glUniform1ui(glGetUniformLocation(program, "total_element_count"), element_count);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, command_buffer);
+                glDispatchCompute(num_groups, 1, 1);
+            } else { // INSTANCED_INDIRECT
+                if (use_fused) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, compact_instance_ssbo);
+                if (use_lod || use_chain) {
+                    // 先按簇选LOD, 远处的簇直接进impostor列表; 链式模式下近处簇排进下一阶段
+                    GLuint impostor_reset[6] = { 6, 0, 0, 0, 0, 0 };
+                    glBindBuffer(GL_SHADER_STORAGE_BUFFER, impostor_command_buffer);
+                    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(impostor_reset), impostor_reset);
+                    if (use_chain) {
+                        ChainStateHeader chain_reset = { { 0, 1, 1 }, { 0, 1, 1 }, 0 };
+                        glBindBuffer(GL_SHADER_STORAGE_BUFFER, chain_state_buffer);
+                        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(chain_reset), &chain_reset);
+                    }
+
+                    GLuint lod_program = get_compute_program(cluster_lod_cs_source,
+                        std::string(use_chain ? "#define CHAIN_OUTPUT\n" : "") + (use_paging ? "#define PAGED\n" : ""), "Cluster LOD", "cluster_lod_cs");
+                    glUseProgram(lod_program);
+                    glUniform1ui(glGetUniformLocation(lod_program, "cluster_count"), cluster_count);
+                    glUniform1f(glGetUniformLocation(lod_program, "projection_scale"), camera.projection_scale(fb_height));
+                    glUniform1f(glGetUniformLocation(lod_program, "lod_error_px"), use_lod ? lod_error_px : 0.0f);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, cluster_range_ssbo);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cluster_bounds_ssbo);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, cluster_lod_ssbo);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, impostor_id_ssbo);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, impostor_command_buffer);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, chain_state_buffer);
+                    glDispatchCompute((cluster_count + 255) / 256, 1, 1);
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+                }
+                if (use_chain) {
+                    // 下游各阶段的大小都由上一阶段在GPU上写好
+                    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, chain_state_buffer);
+
+                    if (persistent_enabled) {
+                        // 工作组数固定, 活从队列里取; 只清掉这一帧可能用到的那部分条目,
+                        // 包括各工作组越过最后一个推回条目占着等的位置 (不清的话会读到上一帧的条目)
+                        GLuint zero = 0;
+                        persistent_groups = std::clamp(persistent_groups, 1, MAX_PERSISTENT_GROUPS); // 轨迹里的值不过滑杆
+                        GLsizeiptr queue_items = std::min<GLsizeiptr>(MAX_WORK_ITEMS, slot_bound / 256 + cluster_count) + persistent_groups;
+                        GLsizeiptr queue_bytes = queue_items * 2 * sizeof(GLuint);
+                        glBindBuffer(GL_SHADER_STORAGE_BUFFER, work_queue_ssbo);
+                        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, queue_bytes, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+                        GLuint program = get_compute_program(cull_persistent_cs_source, cull_test_defines[cull_test] + compact_define, "Chain", "cull_persistent_cs");
+                        glUseProgram(program);
+                        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, cluster_range_ssbo);
+                        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visible_id_ssbo);
+                        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, work_queue_ssbo);
+                        glDispatchCompute(persistent_groups, 1, 1);
+                    } else {
+                        GLuint program = get_compute_program(cull_cluster_instances_cs_source, cull_test_defines[cull_test] + compact_define, "Chain", "cull_cluster_instances_cs");
+                        glUseProgram(program);
+                        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, cluster_range_ssbo);
+                        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visible_id_ssbo);
+                        glDispatchComputeIndirect(offsetof(ChainStateHeader, instance_dispatch));
+                    }
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+                    glUseProgram(chain_finalize_program);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, command_buffer);
+                    glDispatchComputeIndirect(offsetof(ChainStateHeader, finalize_dispatch));
+
+                    stats.copy(chain_state_buffer, offsetof(ChainStateHeader, instance_dispatch), STAT_NEAR_CLUSTERS);
+                    stats.copy(chain_state_buffer, offsetof(ChainStateHeader, visible_count), STAT_VISIBLE_INSTANCES);
+                    stats.copy(chain_state_buffer, offsetof(ChainStateHeader, lanes_busy), STAT_LANES_BUSY);
+                    stats.copy(chain_state_buffer, offsetof(ChainStateHeader, lanes_issued), STAT_LANES_ISSUED);
+                } else if (use_packed_ids) {
+                    std::vector<GLuint> segment_reset(id_segment_count * 5);
+                    for (GLuint seg = 0; seg < id_segment_count; ++seg) {
+                        GLuint* cmd = &segment_reset[seg * 5];
+                        cmd[0] = 6; cmd[1] = 0; cmd[2] = 0; cmd[3] = 0; cmd[4] = seg * ID_SEGMENT_SIZE;
+                    }
+                    glBindBuffer(GL_SHADER_STORAGE_BUFFER, segment_command_buffer);
+                    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, segment_reset.size() * sizeof(GLuint), segment_reset.data());
+
+                    GLuint program = get_compute_program(cull_packed_ids_cs_source,
+                        cull_test_defines[cull_test] + (use_lod ? "#define USE_CLUSTER_LOD\n" : "")
+                        + (use_dynamic ? "#define USE_ALIVE_MASK\n" : ""), "Cull", "cull_packed_ids_cs");
+                    glUseProgram(program);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visible_id_ssbo);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, segment_command_buffer);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, counter_buffer);
+                    if (use_lod) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, cluster_lod_ssbo);
+                    if (use_dynamic) {
+                        glUniform1ui(glGetUniformLocation(program, "total_element_count"), MAX_ELEMENTS);
+                        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, slot_allocator_buffer);
+                        glDispatchComputeIndirect(offsetof(SlotAllocatorHeader, cull_dispatch));
+                    } else {
+                        glUniform1ui(glGetUniformLocation(program, "total_element_count"), element_count);
+                        glDispatchCompute(num_groups, 1, 1);
+                    }
+                } else if (use_bvh) {
+                    // 上半段一个工作组展开出几千棵子树, 下半段按子树数间接dispatch
+                    const std::string defines = cull_test_defines[cull_test] + compact_define;
+                    GLuint top_program = get_compute_program(bvh_traverse_cs_source, "#define BVH_TOP\n" + defines, "LBVH", "bvh_traverse_cs");
+                    GLuint subtree_program = get_compute_program(bvh_traverse_cs_source, defines, "LBVH", "bvh_traverse_cs");
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visible_id_ssbo);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, command_buffer);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bvh_node_ssbo);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, bvh_frontier_ssbo);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, bvh_state_buffer);
+                    glUseProgram(top_program);
+                    glUniform1ui(glGetUniformLocation(top_program, "leaf_count"), element_count);
+                    glDispatchCompute(1, 1, 1);
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+                    glUseProgram(subtree_program);
+                    glUniform1ui(glGetUniformLocation(subtree_program, "leaf_count"), element_count);
+                    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, bvh_state_buffer);
+                    glDispatchComputeIndirect(offsetof(BvhStateHeader, subtree_dispatch));
+                } else {
+                    GLuint program = get_compute_program(cull_instanced_cs_source,
+                        cull_test_defines[cull_test] + (use_lod ? "#define USE_CLUSTER_LOD\n" : "")
+                        + (use_dynamic ? "#define USE_ALIVE_MASK\n" : "")
+                        + (use_bitmask ? "#define USE_VISIBILITY_MASK\n" : "") + compact_define, "Cull", "cull_instanced_cs");
+                    glUseProgram(program);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visible_id_ssbo);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, command_buffer);
+                    if (use_lod) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, cluster_lod_ssbo);
+                    if (use_bitmask) {
+                        glUniform1i(glGetUniformLocation(program, "temporal_reuse"), temporal_reuse);
+                        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, visibility_mask_ssbo[mask_write ^ 1]);
+                        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, visibility_mask_ssbo[mask_write]);
+                        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, cull_load_stats_buffer);
+                    }
+                    if (use_dynamic) {
+                        // 槽位范围只有GPU知道, 按分配器写好的high_water间接dispatch
+                        glUniform1ui(glGetUniformLocation(program, "total_element_count"), MAX_ELEMENTS);
+                        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, slot_allocator_buffer);
+                        glDispatchComputeIndirect(offsetof(SlotAllocatorHeader, cull_dispatch));
+                    } else {
+                        glUniform1ui(glGetUniformLocation(program, "total_element_count"), element_count);
+                        glDispatchCompute(num_groups, 1, 1);
+                    }
+                }
+            }
+            // UBO分块/顶点属性: 按可见id把实例收集成压缩副本, 算在剔除时间里
+            // 融合收集时副本已经有了, UBO分块只需要写分块指令
+            const bool use_gather = current_mode == INSTANCED_INDIRECT && (fetch_backend == FETCH_UBO || (fetch_backend == FETCH_ATTRIBUTE && !use_fused));
+            // 块数只知道上界 (动态模式下槽位可以涨到MAX_ELEMENTS), 多出来的块是空绘制
+            const GLuint ubo_chunk_count = (slot_bound + ubo_chunk_instances - 1) / ubo_chunk_instances;
+            if (use_gather) {
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+                if (!use_chain) {
+                    glBindBuffer(GL_COPY_READ_BUFFER, counter_buffer);
+                    glBindBuffer(GL_COPY_WRITE_BUFFER, command_buffer);
+                    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, sizeof(GLuint), sizeof(GLuint));
+                }
+                const bool ubo_chunks = fetch_backend == FETCH_UBO;
+                GLuint program = get_compute_program(gather_instances_cs_source,
+                    std::string(ubo_chunks ? "#define UBO_CHUNKS\n" : "") + (use_fused ? "#define CHUNK_COMMANDS_ONLY\n" : ""), "Fetch", "gather_instances_cs");
+                glUseProgram(program);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visible_id_ssbo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, compact_instance_ssbo);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, command_buffer);
+                if (ubo_chunks) {
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ubo_chunk_command_buffer);
+                    glUniform1ui(glGetUniformLocation(program, "chunk_size"), ubo_chunk_instances);
+                    glUniform1ui(glGetUniformLocation(program, "chunk_count"), ubo_chunk_count);
+                }
+                GLuint gather_threads = use_fused ? ubo_chunk_count : std::max(slot_bound, ubo_chunk_count);
+                glDispatchCompute((gather_threads + 255) / 256, 1, 1);
+            }
+            cull_timer.end();
+
+            glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT |
+                            (use_gather ? GL_UNIFORM_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT : 0));
+            if (use_paging) pager.copy_feedback(cluster_lod_ssbo, frame_index);
+            if (use_bitmask) {
+                stats.copy(cull_load_stats_buffer, 0, STAT_RECORDS_LOADED);
+                stats.copy(cull_load_stats_buffer, sizeof(GLuint), STAT_MASK_WORDS_LOADED);
+            }
+
+            // --- 渲染 ---
+            // 3D下billboard互相遮挡, 需要深度测试; 2D保持原来的画家顺序
+            if (camera.perspective) glEnable(GL_DEPTH_TEST);
+            glUseProgram(render_program);
+            glBindVertexArray(quadVAO);
+
+            draw_timer.begin();
+            if (current_mode == MICRO_BATCH_INDIRECT) {
+                glUniform1i(glGetUniformLocation(render_program, "is_instanced_mode"), 0);
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+                // 读取可见数量
+                glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counter_buffer);
+                GLuint* count_ptr = (GLuint*)glMapBufferRange(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT);
+                gpu_draw_calls = count_ptr[0];
+                glUnmapBuffer(GL_ATOMIC_COUNTER_BUFFER);
+
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, gpu_draw_calls, 0);
+            } else { // INSTANCED_INDIRECT
+                glUniform1i(glGetUniformLocation(render_program, "is_instanced_mode"), 1);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visible_id_ssbo);
+
+                // 关键：将原子计数器的值，写入到我们生成的唯一一个DrawCommand的instanceCount字段中
+                // 这通常在CS的结尾做，或者用一个小的专用CS，这里为了简单直接用glCopyBufferSubData
+                // (链式管线里由chain_finalize_cs完成; 收集pass之前已经拷过)
+                if (!use_chain && !use_gather) {
+                    glBindBuffer(GL_COPY_READ_BUFFER, counter_buffer);
+                    glBindBuffer(GL_COPY_WRITE_BUFFER, command_buffer);
+                    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, sizeof(GLuint), sizeof(GLuint)); // a bit of a hack for demo
+                }
+
+                glUseProgram(render_fetch_programs[use_fused][fetch_backend]);
+                if (use_fused && fetch_backend == FETCH_SSBO) {
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, compact_instance_ssbo);
+                } else if (fetch_backend == FETCH_TBO) {
+                    glActiveTexture(GL_TEXTURE0);
+                    glBindTexture(GL_TEXTURE_BUFFER, use_fused ? compact_instance_tbo : instance_tbo);
+                    glActiveTexture(GL_TEXTURE1);
+                    glBindTexture(GL_TEXTURE_BUFFER, visible_id_tbo);
+                    glActiveTexture(GL_TEXTURE0);
+                } else if (fetch_backend == FETCH_ATTRIBUTE) {
+                    glBindVertexArray(attribute_fetch_vao);
+                }
+                if (use_packed_ids) {
+                    glUseProgram(render_packed_ids_program);
+                    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, segment_command_buffer);
+                    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0, id_segment_count, 0);
+                    gpu_draw_calls = id_segment_count;
+                } else if (fetch_backend == FETCH_UBO) {
+                    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ubo_chunk_command_buffer);
+                    for (GLuint c = 0; c < ubo_chunk_count; ++c) {
+                        glBindBufferRange(GL_UNIFORM_BUFFER, 2, compact_instance_ssbo, c * ubo_chunk_bytes, ubo_chunk_bytes);
+                        glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(uintptr_t)(c * sizeof(GLuint) * 5));
+                    }
+                    gpu_draw_calls = ubo_chunk_count;
+                } else {
+                    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+                    glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0);
+                    gpu_draw_calls = 1; // 只有一个间接绘制调用
+                }
+                glUseProgram(render_program);
+                glBindVertexArray(quadVAO);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+                if (!use_chain) stats.copy(counter_buffer, 0, STAT_VISIBLE_INSTANCES);
+
+                if (use_lod) {
+                    // impostor用覆盖率做alpha混合, 不写深度
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, impostor_ssbo);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, impostor_id_ssbo);
+                    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, impostor_command_buffer);
+                    glEnable(GL_BLEND);
+                    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                    glDepthMask(GL_FALSE);
+                    glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0);
+                    glDepthMask(GL_TRUE);
+                    glDisable(GL_BLEND);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+                    gpu_draw_calls += 1;
+
+                    stats.copy(impostor_command_buffer, sizeof(GLuint), STAT_IMPOSTORS);
+                    stats.copy(impostor_command_buffer, 5 * sizeof(GLuint), STAT_MERGED_INSTANCES);
+                }
+            }
+            draw_timer.end();
+            glDisable(GL_DEPTH_TEST);
+        }
+
+        stats.end_frame();
+
+        // --- 帧捕获 (只抓场景, 不含UI) ---
+        capture.on_frame(frame_index, fb_width, fb_height);
+
+        // --- 查询命中的描边: 悬停白色, 框选黄色 (在捕获之后画, 截图里没有) ---
+        if (has_compute && (!hover_result.ids.empty() || !select_result.ids.empty() || selecting)) {
+            glBindVertexArray(quadVAO);
+            glUseProgram(highlight_program);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_ssbo);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, highlight_id_ssbo);
+            glUniform2f(glGetUniformLocation(highlight_program, "margin"), 6.0f / fb_width, 6.0f / fb_height);
+            glUniform1ui(glGetUniformLocation(highlight_program, "id_offset"), MAX_QUERY_HITS);
+            glUniform4f(glGetUniformLocation(highlight_program, "color"), 1.0f, 0.85f, 0.1f, 1.0f);
+            glDrawArraysInstanced(GL_LINE_LOOP, 0, 4, (GLsizei)select_result.ids.size());
+            glUniform1ui(glGetUniformLocation(highlight_program, "id_offset"), 0);
+            glUniform4f(glGetUniformLocation(highlight_program, "color"), 1.0f, 1.0f, 1.0f, 1.0f);
+            glDrawArraysInstanced(GL_LINE_LOOP, 0, 4, (GLsizei)hover_result.ids.size());
+            if (selecting) {
+                glUseProgram(rect_outline_program);
+                glUniform4f(glGetUniformLocation(rect_outline_program, "ndc_rect"), select_start.x, select_start.y, select_end.x, select_end.y);
+                glUniform4f(glGetUniformLocation(rect_outline_program, "color"), 1.0f, 0.85f, 0.1f, 1.0f);
+                glDrawArrays(GL_LINE_LOOP, 0, 4);
+            }
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visible_id_ssbo);
+        }
+
+        // --- 渲染UI和交换缓冲 ---
+        if (!bench_mode) {
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplOpenGL3_RenderDrawData(&packet.draw_data);
+        }
+        glfwSwapBuffers(window);
+        const double frame_end = glfwGetTime();
+        // 帧间隔按交换算: 两个线程重叠时约等于慢的那个, 不重叠 (--render-thread off) 时是两者之和
+        const float frame_ms = (float)((frame_end - (last_swap_time > 0.0 ? last_swap_time : render_start)) * 1000.0);
+        last_swap_time = frame_end;
+
+        // --- 交给UI线程显示的状态 ---
+        RenderStats& out = packet.stats;
+        memcpy(out.values, stats.values, sizeof(out.values));
+        out.gpu_draw_calls = gpu_draw_calls;
+        out.gpu_cull_ms = cull_timer.smoothed_ms;
+        out.gpu_draw_ms = draw_timer.smoothed_ms;
+        out.render_ms = (float)((frame_end - render_start) * 1000.0);
+        out.render_wait_ms = wait_ms;
+        out.cpu_cull_ms = cpu_cull_ms;
+        out.cpu_submit_ms = cpu_submit_ms;
+        out.cpu_cull_wait_ms = cpu_cull_wait_ms;
+        out.cull_latency = cull_pipeline.latency;
+        out.command_ring_stalls = cpu_command_ring.stalls;
+        out.occluder_count = occlusion.occluder_count;
+        out.occlusion_tested = occlusion.tested;
+        out.occlusion_rejected = occlusion.rejected;
+        out.occluder_raster_ms = occlusion.raster_ms;
+        out.occlusion_test_ms = occlusion.test_ms;
+        out.use_packed_ids = use_packed_ids;
+        out.temporal_reuse = temporal_reuse;
+        out.tf_visible = tf_counter.last_count;
+        out.cluster_count = clustered.clusters.size();
+        out.defrag_runs = defrag_runs;
+        out.bvh_rebuilds = bvh_rebuilds;
+        out.bvh_ms = bvh_timer.last_ms;
+        out.bvh_quality = bvh_quality;
+        out.sparse = instance_storage.sparse;
+        out.committed_mb = instance_storage.committed_bytes() / 1048576.0;
+        out.reserved_mb = instance_storage.reserved_bytes / 1048576.0;
+        out.sparse_page_kb = (int)(instance_storage.page_bytes / 1024);
+        out.commit_calls = instance_storage.commit_calls;
+        out.scene_loading = scene_ticket >= 0;
+        out.scene_loading_frames = frame_index - scene_load_start_frame;
+        out.scene_loads = scene_loads;
+        out.scene_load_frames = scene_load_frames;
+        out.scene_load_render_ms = scene_load_render_ms;
+        out.scene_load_worker_ms = scene_load_worker_ms;
+        out.pager_ready = pager_ready;
+        out.pager_failed = pager_failed;
+        out.pager_generating = pager.generate_state == PageStreamer::GENERATE_RUNNING;
+        if (pager_ready) {
+            out.pager_packed = pager.packed;
+            out.page_count = pager.page_count();
+            out.page_slots = pager.slot_count();
+            out.resident_pages = pager.resident_pages;
+            out.requested_pages = pager.requested_pages;
+            out.pages_loaded = pager.pages_loaded;
+            out.pages_evicted = pager.pages_evicted;
+            out.loads_dropped = pager.loads_dropped;
+            out.page_instances = pager.header.total_instances;
+            out.page_data_bytes = pager.data_bytes;
+            out.read_mb_per_s = pager.read_mb_per_s();
+            out.compression_ratio = pager.compression_ratio();
+            out.decode_gb_per_s = pager.decode_gb_per_s;
+            out.page_upload_ms = pager.upload_ms;
+            out.page_decode_ms = pager.decode_ms;
+        }
+        out.hover_hits = hover_result.hit_count;
+        out.select_hits = select_result.hit_count;
+        out.hover_valid = !hover_result.ids.empty() && hover_result.ids[0] < clustered.instances.size();
+        if (out.hover_valid) {
+            out.hover_id = hover_result.ids[0];
+            out.hover_instance = clustered.instances[hover_result.ids[0]];
+        }
+        out.query_ms = query_timer.last_ms;
+        out.query_used_bvh = spatial_queries.last_used_bvh;
+        out.query_latency_frames = spatial_queries.last_latency_frames;
+        out.gpu_memory = gpu_memory.totals();
+        out.gpu_memory_bytes = gpu_memory.total_bytes();
+        out.gpu_memory_objects = gpu_memory.entries.size();
+        out.driver_free_kb = gpu_memory.driver_free_kb();
+        out.driver_total_kb = gpu_memory.driver_total_kb();
+        out.capture_in_flight = capture.in_flight();
+        out.capture_queued = capture.queued();
+        out.capture_dropped = capture.frames_dropped;
+        out.capture_stalls = capture.readback_stalls;
+        packet.stats_valid = true;
+
+        if (bench_mode) {
+            BenchReport::Run& run = bench.runs[packet.bench_run];
+            bench.add(packet.bench_run, frame_ms, packet.ui_ms, wait_ms, cull_timer.last_ms, draw_timer.last_ms, gpu_draw_calls,
+                cpu_cull_ms, cpu_cull_wait_ms, cpu_submit_ms, use_occlusion ? occlusion.raster_ms : 0.0f, use_occlusion ? occlusion.test_ms : 0.0f);
+            run.final_render_thread = render_thread_enabled;
+            run.final_mode = current_mode;
+            run.final_count = element_count;
+            run.final_fetch = fetch_backend;
+            run.final_fused = fused_compaction;
+            run.final_packed = use_packed_ids;
+            run.final_occlusion = use_occlusion;
+            run.final_pipelined = pipelined_cull;
+            run.final_cull_latency = pipelined_cull ? cull_pipeline.latency : 0;
+            run.final_async_upload = async_scene_upload;
+            run.final_occluders = use_occlusion ? occlusion.occluder_count : 0;
+            run.final_occlusion_tested = use_occlusion ? occlusion.tested : 0;
+            run.final_occlusion_rejected = use_occlusion ? occlusion.rejected : 0;
+            run.final_visible = stats.values[STAT_VISIBLE_INSTANCES];
+            run.final_sparse = instance_storage.sparse;
+            run.final_gpu_memory = out.gpu_memory;
+            run.final_gpu_memory_bytes = out.gpu_memory_bytes;
+            run.final_driver_free_kb = out.driver_free_kb;
+            run.final_committed_mb = out.committed_mb;
+            run.final_reserved_mb = out.reserved_mb;
+            run.final_paging = use_paging;
+            if (use_paging) {
+                run.final_page_packed = pager.packed;
+                run.final_pages_loaded = pager.pages_loaded;
+                run.final_compression = pager.compression_ratio();
+                run.final_decode_gb_per_s = pager.decode_gb_per_s;
+                run.final_read_mb_per_s = pager.read_mb_per_s();
+            }
+        }
+    };
+
+    // --- 渲染线程: 拿走GL上下文, 按顺序画UI线程交过来的包; --render-thread off时UI线程自己画 ---
+    FrameQueue frames;
+    frames.init();
+    std::thread render_thread;
+    if (render_thread_enabled) {
+        glfwMakeContextCurrent(NULL);
+        render_thread = std::thread([&] {
+            glfwMakeContextCurrent(window);
+            while (true) {
+                double wait_start = glfwGetTime();
+                const int slot = frames.receive();
+                FramePacket& packet = frames.slots[slot];
+                if (packet.quit) break;
+                render_frame(packet, (float)((glfwGetTime() - wait_start) * 1000.0));
+                frames.release(slot);
+            }
+            glfwMakeContextCurrent(NULL);
+        });
+    }
+
+    RenderStats shown; // 渲染线程最近交回来的状态
+    bool capture_recording = false;
+    FrameCapture::Format capture_format = FrameCapture::FORMAT_PNG;
+    int run_frame = 0;
+
+    while (!glfwWindowShouldClose(window)) {
+        double current_time = glfwGetTime();
+        // 渲染线程画完前一个包才有空槽; 槽里带回来的是渲染线程那一帧的状态
+        const int slot = frames.acquire();
+        FramePacket& packet = frames.slots[slot];
+        if (packet.stats_valid) shown = packet.stats;
+        double ui_start = glfwGetTime();
+
+        glfwPollEvents();
+        bool capture_key = glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+        bool capture_shot = capture_key && !capture_key_down;
+        capture_key_down = capture_key;
+
+        int fb_width, fb_height;
+        glfwGetFramebufferSize(window, &fb_width, &fb_height);
+        camera.update(window, frame_time, io.WantCaptureMouse, io.WantCaptureKeyboard);
+
+        // --- UI ---
+        ImGui_ImplGlfw_NewFrame();
+        ImGui::NewFrame();
+        ImGui::Begin("Performance Demo");
+        ImGui::Text("Render Mode:");
+        if (has_compute) {
+            ImGui::RadioButton("Micro-Batch Indirect (现状)", (int*)&current_mode, MICRO_BATCH_INDIRECT);
+            ImGui::RadioButton("Instanced Indirect (优化)", (int*)&current_mode, INSTANCED_INDIRECT);
+            ImGui::RadioButton("Direct Draws (CPU cull, 1 draw/instance)", (int*)&current_mode, DIRECT_DRAWS);
+            ImGui::RadioButton("CPU MDI (CPU cull, persistent-mapped commands)", (int*)&current_mode, CPU_MDI);
+            ImGui::RadioButton("VS Cull (no compute pass)", (int*)&current_mode, VS_CULL);
+        } else {
+            ImGui::Text("GL %d.%d: no compute shaders, transform feedback fallback only", gl_major, gl_minor);
+        }
+        ImGui::RadioButton("Transform Feedback Cull (GL 3.3 fallback)", (int*)&current_mode, TF_CULL);
+        if (current_mode == TF_CULL) {
+            if (has_feedback_draw) {
+                ImGui::Checkbox("Draw from Query Count (stalls, no ARB_transform_feedback2 path)", &tf_query_draw);
+            } else {
+                ImGui::Text("No ARB_transform_feedback2: drawing from query count");
+            }
+            ImGui::Text("Visible: %u", shown.tf_visible);
+            if (element_count > tf_max_elements) ImGui::Text("Texture buffer limit: only first %d elements", tf_max_elements);
+        }
+        if (current_mode == INSTANCED_INDIRECT && !multiview_enabled) {
+            ImGui::Combo("Instance Fetch", (int*)&fetch_backend, fetch_backend_names, FETCH_COUNT);
+            if (fetch_backend == FETCH_UBO) ImGui::Text("UBO chunk: %u instances, one indirect draw per chunk", ubo_chunk_instances);
+            if ((fetch_backend == FETCH_UBO || fetch_backend == FETCH_ATTRIBUTE) && !fused_compaction) ImGui::Text("(GPU Cull includes the gather pass)");
+            ImGui::Checkbox("Fused Compaction (cull writes visible instance data)", &fused_compaction);
+            // 每个可见实例: 融合多写28字节 (32字节记录代替4字节id), 绘制省掉一次id读和一次随机的32字节读
+            GLuint visible = shown.values[STAT_VISIBLE_INSTANCES];
+            size_t bytes_per_visible = fused_compaction ? sizeof(InstanceData) : (shown.use_packed_ids ? sizeof(uint16_t) : sizeof(GLuint));
+            ImGui::Text("Visible: %u (%.1f%%)  Cull writes: %.1f KB %s", visible, 100.0f * visible / std::max(element_count, 1),
+                visible * bytes_per_visible / 1024.0, fused_compaction ? "(records)" : "(ids)");
+            ImGui::Checkbox("16-bit Visible IDs (segment + offset, SSBO fetch only)", &packed_ids_enabled);
+            if (packed_ids_enabled) {
+                ImGui::Text("(not with Chain / Bitmask / Fused Compaction)");
+                ImGui::Text("Visible list: %.1f KB packed vs %.1f KB plain, %u segment draws", visible * 2 / 1024.0, visible * 4 / 1024.0,
+                    ((dynamic_enabled ? MAX_ELEMENTS : (GLuint)element_count) + ID_SEGMENT_SIZE - 1) / ID_SEGMENT_SIZE);
+            }
+        }
+        ImGui::SliderInt("Element Count", &element_count, 1000, MAX_ELEMENTS);
+        bool regenerate = ImGui::Combo("Distribution", (int*)&distribution, distribution_names, DIST_COUNT);
+        regenerate |= ImGui::InputInt("Seed", &seed);
+        if (uploader.active) ImGui::Checkbox("Async Scene Upload (shared-context thread)", &async_scene_upload);
+        else ImGui::Text("Scene upload: render thread only (no shared upload context)");
+        if (shown.scene_loading) ImGui::Text("Loading scene... (%d frames)", shown.scene_loading_frames);
+        else if (shown.scene_loads > 0) ImGui::Text("Last scene load: render thread %.2f ms, upload thread %.2f ms, %d frames",
+            shown.scene_load_render_ms, shown.scene_load_worker_ms, shown.scene_load_frames);
+        ImGui::Text("Camera:");
+        int projection_mode = camera.perspective ? 1 : 0;
+        ImGui::RadioButton("Ortho 2D", &projection_mode, 0);
+        ImGui::SameLine();
+        ImGui::RadioButton("Perspective 3D (RMB/WASD/QE)", &projection_mode, 1);
+        camera.perspective = projection_mode == 1;
+        if (!camera.perspective) {
+            ImGui::SliderFloat("Ortho Zoom (WASD/QE)", &camera.ortho_zoom, 0.05f, 100.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+        }
+        ImGui::Text("Cull Test:");
+        ImGui::RadioButton("Clip Point (2D)", (int*)&cull_test, CULL_TEST_POINT_2D);
+        ImGui::SameLine();
+        ImGui::RadioButton("Sphere vs Frustum (3D)", (int*)&cull_test, CULL_TEST_SPHERE_3D);
+        ImGui::Checkbox("Multi-View (Instanced only)", &multiview_enabled);
+        if (multiview_enabled) {
+            ImGui::SliderInt("View Count", &view_count, 1, MAX_VIEWS);
+            ImGui::Checkbox("Single Dispatch (load each instance once)", &multiview_single_dispatch);
+            ImGui::Text("Draw: %s", has_viewport_layer_array ? "1x MDI + gl_ViewportIndex" : "per-view indirect draws");
+        }
+        ImGui::Checkbox("Cluster LOD / Impostors (Instanced only)", &lod_enabled);
+        if (lod_enabled) {
+            ImGui::SliderFloat("LOD Error Bound (px)", &lod_error_px, 0.5f, 64.0f);
+            ImGui::Text("Clusters: %zu  Impostors: %u (replacing %u instances)", shown.cluster_count,
+                shown.values[STAT_IMPOSTORS], shown.values[STAT_MERGED_INSTANCES]);
+            ImGui::Text("Individually drawn: %u", shown.values[STAT_VISIBLE_INSTANCES]);
+        }
+        ImGui::Checkbox("GPU-Driven Chain (indirect dispatch, Instanced only)", &chain_enabled);
+        if (chain_enabled) {
+            ImGui::Text("cluster cull -> instance cull -> finalize, no CPU-side counts");
+            ImGui::Text("Near clusters: %u  Visible: %u", shown.values[STAT_NEAR_CLUSTERS], shown.values[STAT_VISIBLE_INSTANCES]);
+            ImGui::Checkbox("Persistent Threads (work queue)", &persistent_enabled);
+            if (persistent_enabled) {
+                ImGui::SliderInt("Persistent Workgroups", &persistent_groups, 1, MAX_PERSISTENT_GROUPS);
+            }
+            GLuint lanes_issued = shown.values[STAT_LANES_ISSUED];
+            ImGui::Text("Lane utilization: %.1f%% (%u batches of 256)",
+                lanes_issued ? 100.0f * shown.values[STAT_LANES_BUSY] / lanes_issued : 0.0f, lanes_issued / 256);
+        }
+        ImGui::Checkbox("Out-of-Core Paging (stream pages from disk, Instanced only)", &paging_enabled);
+        if (paging_enabled) {
+            if (shown.pager_failed) {
+                ImGui::Text("Cannot open or write %s", page_file_path.c_str());
+            } else if (shown.pager_generating) {
+                ImGui::Text("Writing %s (%d pages) in the background...", page_file_path.c_str(), page_grid * page_grid);
+            } else if (shown.pager_ready) {
+                // 页就是簇: 远处的页和还没读进来的页都画占位
+                ImGui::Text("(forces Cluster LOD + Chain; pages are the clusters)");
+                ImGui::Text("%s: %d pages, %.2fM instances (%.0f MB)", page_file_path.c_str(), shown.page_count,
+                    shown.page_instances / 1e6, shown.page_instances * sizeof(InstanceData) / 1048576.0);
+                ImGui::Text("Resident: %d / %d slots  Requested: %d", shown.resident_pages, shown.page_slots, shown.requested_pages);
+                ImGui::Text("Loaded: %d  Evicted: %d  Dropped: %d", shown.pages_loaded, shown.pages_evicted, shown.loads_dropped);
+                ImGui::Text("Disk read: %.1f MB/s  Upload: %.3f ms", shown.read_mb_per_s, shown.page_upload_ms);
+                if (shown.pager_packed) {
+                    ImGui::Text("Packed pages: %.2fx (%.1f B/instance)  Decode: %.3f ms, %.2f GB/s", shown.compression_ratio,
+                        shown.page_data_bytes / (double)std::max<uint64_t>(shown.page_instances, 1), shown.page_decode_ms, shown.decode_gb_per_s);
+                }
+            }
+        }
+        ImGui::Checkbox("Dynamic Instances (GPU free-list, Instanced only)", &dynamic_enabled);
+        if (dynamic_enabled) {
+            // 槽位会被打乱, 簇区间失效, 所以和LOD/链式互斥
+            ImGui::Text("(disables Cluster LOD / Chain while active)");
+            ImGui::SliderInt("Spawn per Frame", &spawn_per_frame, 0, MAX_SLOT_COMMANDS);
+            ImGui::SliderInt("Kill per Frame", &kill_per_frame, 0, MAX_SLOT_COMMANDS);
+            ImGui::Checkbox("Auto Defragment", &defrag_enabled);
+            ImGui::SameLine();
+            ImGui::SliderFloat("Threshold", &defrag_threshold, 0.05f, 0.9f);
+            GLuint high_water = shown.values[STAT_HIGH_WATER];
+            ImGui::Text("Alive: %u  High Water: %u  Free: %u", shown.values[STAT_ALIVE_SLOTS], high_water, shown.values[STAT_FREE_SLOTS]);
+            ImGui::Text("Fragmentation: %.1f%%  Failed Spawns: %u  Defrags: %d",
+                high_water ? 100.0f * shown.values[STAT_FREE_SLOTS] / high_water : 0.0f, shown.values[STAT_FAILED_SPAWNS], shown.defrag_runs);
+        }
+        ImGui::Checkbox("Bitmask Cull (skip zero words, reuse last visibility)", &bitmask_cull_enabled);
+        if (bitmask_cull_enabled) {
+            // 不用位图时每个槽位都要读一条32字节的记录
+            GLuint slot_range = dynamic_enabled && shown.values[STAT_HIGH_WATER] ? shown.values[STAT_HIGH_WATER] : (GLuint)element_count;
+            double masked_kb = (shown.values[STAT_RECORDS_LOADED] * (double)sizeof(InstanceData) + shown.values[STAT_MASK_WORDS_LOADED] * 4.0) / 1024.0;
+            double unmasked_kb = slot_range * (double)sizeof(InstanceData) / 1024.0;
+            ImGui::Text("Temporal reuse: %s  Records loaded: %u", shown.temporal_reuse ? "yes (static)" : "no", shown.values[STAT_RECORDS_LOADED]);
+            ImGui::Text("Cull bytes read: %.1f KB masked vs %.1f KB unmasked", masked_kb, unmasked_kb);
+        }
+        ImGui::Checkbox("LBVH Cull (GPU-built BVH, Instanced only)", &bvh_enabled);
+        if (bvh_enabled) {
+            ImGui::Text("(not with Multi-View / LOD / Chain / Dynamic / Bitmask)");
+            ImGui::Text("Nodes: %d  Rebuilds: %d  Build/Refit: %.3f ms", 2 * element_count - 1, shown.bvh_rebuilds, shown.bvh_ms);
+            ImGui::Text("Surface area: %.2fx of last build", shown.bvh_quality);
+            ImGui::Checkbox("Drift Instances (refit every frame)", &drift_enabled);
+            if (drift_enabled) {
+                ImGui::SliderFloat("Drift Speed", &drift_speed, 0.0f, 1.0f);
+                ImGui::SliderFloat("Rebuild at Area Ratio", &bvh_rebuild_ratio, 1.05f, 4.0f);
+            }
+        }
+        ImGui::Separator();
+        ImGui::Text("--- Stats ---");
+        ImGui::Text("FPS: %.1f", 1.0f / frame_time);
+        ImGui::Text("Frame Time: %.3f ms", frame_time * 1000.0f);
+        ImGui::Text("Render thread: %.3f ms busy, %.3f ms waiting for the UI thread%s", shown.render_ms, shown.render_wait_ms,
+            render_thread_enabled ? "" : " (off: drawn inline)");
+        ImGui::Text("GPU Draw Commands: %u", shown.gpu_draw_calls);
+        ImGui::Text("GPU Cull: %.3f ms  GPU Draw: %.3f ms", shown.gpu_cull_ms, shown.gpu_draw_ms);
+        if (shown.sparse) {
+            ImGui::Text("Instance buffer: sparse, %.1f / %.1f MB committed (%d KB pages, %d commit calls)",
+                shown.committed_mb, shown.reserved_mb, shown.sparse_page_kb, shown.commit_calls);
+        } else {
+            ImGui::Text("Instance buffer: dense, %.1f MB", shown.reserved_mb);
+        }
+        if (current_mode == DIRECT_DRAWS || current_mode == CPU_MDI) {
+            ImGui::Text("CPU Cull: %.3f ms  CPU Submit: %.3f ms", shown.cpu_cull_ms, shown.cpu_submit_ms);
+            ImGui::Checkbox("Pipelined CPU Cull (worker thread, 1 frame behind)", &pipelined_cull);
+            if (pipelined_cull) ImGui::Text("Waited for cull: %.3f ms  Latency: %d frames", shown.cpu_cull_wait_ms, shown.cull_latency);
+            if (current_mode == CPU_MDI) ImGui::Text("Command ring stalls: %d", shown.command_ring_stalls);
+            ImGui::Checkbox("Masked Occlusion (3D camera, large instances occlude)", &occlusion_enabled);
+            if (occlusion_enabled) {
+                ImGui::SliderFloat("Occluder Min Area (px)", &occluder_min_px, 1.0f, 4096.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+                ImGui::SliderInt("Max Occluders", &max_occluders, 1, 16384);
+                if (occlusion.avx2_supported) ImGui::Checkbox("AVX2", &occlusion_avx2);
+                else ImGui::Text("No AVX2: scalar path");
+                if (!camera.perspective) ImGui::Text("(ortho 2D draws without depth test: nothing is occluded)");
+                ImGui::Text("%dx%d buffer  Occluders: %d  Raster: %.3f ms  Test: %.3f ms", OCCLUSION_WIDTH, OCCLUSION_HEIGHT,
+                    shown.occluder_count, shown.occluder_raster_ms, shown.occlusion_test_ms);
+                ImGui::Text("Rejected: %d / %d (%.1f%%)", shown.occlusion_rejected, shown.occlusion_tested,
+                    shown.occlusion_tested ? 100.0f * shown.occlusion_rejected / shown.occlusion_tested : 0.0f);
+            }
+        }
+        if (has_compute) {
+            ImGui::Separator();
+            ImGui::Text("--- Spatial Query ---");
+            ImGui::Checkbox("Hover Highlight (GPU point query)", &hover_query_enabled);
+            if (dynamic_enabled || multiview_enabled) ImGui::Text("(not with Dynamic / Multi-View)");
+            if (shown.hover_valid) {
+                const InstanceData& inst = shown.hover_instance;
+                ImGui::Text("Hover: %u hits  id %u  size %.4f x %.4f  color #%08X", shown.hover_hits, shown.hover_id,
+                    inst.size.x, inst.size.y, inst.color);
+            } else {
+                ImGui::Text("Hover: nothing");
+            }
+            ImGui::Text("Drag LMB to select: %u hits", shown.select_hits);
+            if (shown.select_hits > MAX_QUERY_HITS) ImGui::Text("(highlighting the first %d)", MAX_QUERY_HITS);
+            ImGui::Text("Query pass: %.3f ms (%s)  Latency: %d frames", shown.query_ms,
+                shown.query_used_bvh ? "LBVH" : "linear", shown.query_latency_frames);
+        }
+        ImGui::Separator();
+        ImGui::Text("--- GPU Memory ---");
+        for (const auto& t : shown.gpu_memory) {
+            ImGui::Text("%-20s %8.2f MB  (buf %.2f  tex %.2f  prog %.2f)", t.first,
+                (t.second[0] + t.second[1] + t.second[2]) / 1048576.0,
+                t.second[0] / 1048576.0, t.second[1] / 1048576.0, t.second[2] / 1048576.0);
+        }
+        ImGui::Text("Tracked: %.2f MB in %zu objects", shown.gpu_memory_bytes / 1048576.0, shown.gpu_memory_objects);
+        {
+            int64_t free_kb = shown.driver_free_kb, total_kb = shown.driver_total_kb;
+            if (free_kb < 0) ImGui::Text("Driver: no memory info extension");
+            else if (total_kb > 0) ImGui::Text("Driver: %.1f / %.1f MB free", free_kb / 1024.0, total_kb / 1024.0);
+            else ImGui::Text("Driver: %.1f MB free", free_kb / 1024.0);
+        }
+        ImGui::Separator();
+        ImGui::Text("--- Capture ---");
+        if (ImGui::Button("Screenshot (F12)")) capture_shot = true;
+        ImGui::SameLine();
+        ImGui::Checkbox("Record Frames", &capture_recording);
+        ImGui::RadioButton("PNG", (int*)&capture_format, FrameCapture::FORMAT_PNG);
+        ImGui::SameLine();
+        ImGui::RadioButton("PPM (raw)", (int*)&capture_format, FrameCapture::FORMAT_PPM);
+        ImGui::Text("Written: %d  In-flight: %d  Queued: %zu", capture.frames_written.load(), shown.capture_in_flight, shown.capture_queued);
+        ImGui::Text("Dropped: %d  Failed: %d  Readback Stalls: %d", shown.capture_dropped, capture.frames_failed.load(), shown.capture_stalls);
+        ImGui::Separator();
+        ImGui::Text("--- Trace (%s) ---", trace_path.c_str());
+        if (!trace.record_file) {
+            if (ImGui::Button("Record Trace")) trace.start_recording(trace_path);
+        } else if (ImGui::Button("Stop Recording")) {
+            trace.stop_recording();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Replay Trace")) trace.load(trace_path);
+        if (trace.replaying) ImGui::Text("Replaying frame %zu / %zu", trace.replay_row, trace.rows.size());
+        ImGui::End();
+
+        // --- 回放: 轨迹里的值覆盖本帧的UI和相机输入, 然后 (如果在录) 记下本帧最终的参数 ---
+        if (trace.replaying) {
+            InstanceDistribution previous_distribution = distribution;
+            int previous_seed = seed;
+            trace.apply_next();
+            regenerate |= distribution != previous_distribution || seed != previous_seed;
+        }
+        if (bench_mode) {
+            const BenchReport::Run& run = bench.runs[bench.current];
+            if (run.mode >= 0) current_mode = (RenderMode)run.mode;
+            if (run.count >= 0) element_count = run.count;
+            if (run.fetch >= 0) fetch_backend = (FetchBackend)run.fetch;
+            if (run.fused >= 0) fused_compaction = run.fused != 0;
+            if (run.packed >= 0) packed_ids_enabled = run.packed != 0;
+            if (run.occlusion >= 0) occlusion_enabled = run.occlusion != 0;
+            if (run.pipelined >= 0) pipelined_cull = run.pipelined != 0;
+            if (run.async_upload >= 0) async_scene_upload = run.async_upload != 0 && uploader.active;
+            if (run.zoom > 0.0f) {
+                camera.perspective = false;
+                camera.ortho_zoom = run.zoom;
+            }
+        } else {
+            if (forced_mode >= 0) current_mode = (RenderMode)forced_mode;
+            if (forced_fetch >= 0) fetch_backend = (FetchBackend)forced_fetch;
+            if (forced_packed == 0 || forced_packed == 1) packed_ids_enabled = forced_packed != 0;
+            if (forced_occlusion == 0 || forced_occlusion == 1) occlusion_enabled = forced_occlusion != 0;
+            if (forced_cull_thread == 0 || forced_cull_thread == 1) pipelined_cull = forced_cull_thread != 0;
+            if (forced_upload_thread == 0) async_scene_upload = false;
+        }
+        if (!has_compute) current_mode = TF_CULL;
+        if (!has_feedback_draw) tf_query_draw = true;
+        if (!uploader.active) async_scene_upload = false;
+        trace.record_frame(frame_index);
+
+        // --- 动态实例: spawn/kill请求在这里随机生成, kill的槽位可能已经是死的, GPU侧会忽略 ---
+        // high_water是渲染线程几帧前回读的, 只用来估计kill的范围
+        if (dynamic_enabled && current_mode == INSTANCED_INDIRECT && !multiview_enabled) {
+            GLuint high_water_estimate = shown.values[STAT_HIGH_WATER] ? shown.values[STAT_HIGH_WATER] : (GLuint)element_count;
+            std::uniform_int_distribution<GLuint> slot_dist(0, high_water_estimate - 1);
+            packet.spawn_requests.resize(spawn_per_frame);
+            packet.kill_requests.resize(kill_per_frame);
+            for (auto& request : packet.spawn_requests) request = make_random_instance(churn_rng);
+            for (auto& request : packet.kill_requests) request = slot_dist(churn_rng);
+        }
+
+        // --- 鼠标: 空间查询在渲染线程上做, 这里只采样 ---
+        double cursor_x, cursor_y;
+        int window_width, window_height;
+        glfwGetCursorPos(window, &cursor_x, &cursor_y);
+        glfwGetWindowSize(window, &window_width, &window_height);
+        packet.cursor_ndc = glm::vec2(2.0f * (float)cursor_x / std::max(window_width, 1) - 1.0f, 1.0f - 2.0f * (float)cursor_y / std::max(window_height, 1));
+        packet.left_down = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+        packet.mouse_over_ui = io.WantCaptureMouse;
+
+        // --- 打包: 本帧的全部参数 + UI的绘制数据, 交给渲染线程 ---
+        ImGui::Render();
+        copy_draw_data(ImGui::GetDrawData(), packet.draw_data);
+        FrameSettings& settings = packet.settings;
+        settings.camera = camera;
+        settings.element_count = element_count;
+        settings.current_mode = current_mode;
+        settings.cull_test = cull_test;
+        settings.distribution = distribution;
+        settings.seed = seed;
+        settings.multiview_enabled = multiview_enabled;
+        settings.multiview_single_dispatch = multiview_single_dispatch;
+        settings.view_count = view_count;
+        settings.lod_enabled = lod_enabled;
+        settings.lod_error_px = lod_error_px;
+        settings.chain_enabled = chain_enabled;
+        settings.persistent_enabled = persistent_enabled;
+        settings.persistent_groups = persistent_groups;
+        settings.paging_enabled = paging_enabled;
+        settings.dynamic_enabled = dynamic_enabled;
+        settings.spawn_per_frame = spawn_per_frame;
+        settings.kill_per_frame = kill_per_frame;
+        settings.defrag_enabled = defrag_enabled;
+        settings.defrag_threshold = defrag_threshold;
+        settings.bitmask_cull_enabled = bitmask_cull_enabled;
+        settings.tf_query_draw = tf_query_draw;
+        settings.fetch_backend = fetch_backend;
+        settings.fused_compaction = fused_compaction;
+        settings.packed_ids_enabled = packed_ids_enabled;
+        settings.occlusion_enabled = occlusion_enabled;
+        settings.occluder_min_px = occluder_min_px;
+        settings.max_occluders = max_occluders;
+        settings.occlusion_avx2 = occlusion_avx2;
+        settings.pipelined_cull = pipelined_cull;
+        settings.async_scene_upload = async_scene_upload;
+        settings.bvh_enabled = bvh_enabled;
+        settings.drift_enabled = drift_enabled;
+        settings.drift_speed = drift_speed;
+        settings.bvh_rebuild_ratio = bvh_rebuild_ratio;
+        settings.hover_query_enabled = hover_query_enabled;
+        packet.frame_index = frame_index;
+        packet.frame_time = frame_time;
+        packet.fb_width = fb_width;
+        packet.fb_height = fb_height;
+        packet.regenerate = regenerate;
+        packet.bench_run = bench.current;
+        packet.capture_shot = capture_shot;
+        packet.capture_recording = capture_recording;
+        packet.capture_format = capture_format;
+        packet.ui_ms = (float)((glfwGetTime() - ui_start) * 1000.0);
+        if (render_thread_enabled) {
+            frames.submit(slot);
+        } else {
+            render_frame(packet, 0.0f);
+            frames.release(slot);
+        }
+
+        frame_time = glfwGetTime() - current_time;
+        frame_index++;
+
+        // 轨迹放完后保持最后一帧的参数再跑GpuTimer::RING_SIZE帧, 把GPU计时取齐; 然后从头放下一个Run
+        if (bench_mode && ++run_frame >= bench_frames + GpuTimer::RING_SIZE) {
+            if (++bench.current == bench.runs.size()) break;
+            run_frame = 0;
+            trace.replay_row = 0;
+            trace.replaying = true;
+        }
+    }
+
+    // 渲染线程画完已经提交的包再退出, 上下文回到主线程做清理
+    if (render_thread_enabled) {
+        const int slot = frames.acquire();
+        frames.slots[slot].quit = true;
+        frames.submit(slot);
+        render_thread.join();
+        glfwMakeContextCurrent(window);
+    }
+    frames.shutdown();
+
+    trace.stop_recording();
+    if (bench_mode) {
+        bench.write_json(bench_out_path, replay_path, bench_frames, GpuTimer::RING_SIZE);
     }
 
     // --- 清理 ---
+    capture.shutdown();
+    cull_pipeline.shutdown();
+    uploader.shutdown();
+    if (landing_fence) glDeleteSync(landing_fence);
+    pager.shutdown();
+    instance_storage.shutdown();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();